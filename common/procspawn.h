@@ -0,0 +1,97 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef PROCSPAWN_H
+#define PROCSPAWN_H
+
+/*
+ * Starting programs without a shell. popen() and system() run the command
+ * line through /bin/sh -c, which costs an extra process and re-parses file
+ * names with spaces or metacharacters; fork() + exec copies the page tables
+ * of the whole parent only to throw them away. These helpers take an
+ * explicit argv and use posix_spawn(), which glibc implements with
+ * clone(CLONE_VM | CLONE_VFORK), so the cost does not grow with the
+ * parent's memory.
+ *
+ * Header-only so that both the C and the C++ programs can include it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char** environ;
+
+/**
+ * Starts a program
+ * @param file - the program; looked up in PATH unless it contains a slash
+ * @param argv - the NULL-terminated arguments; argv[0] is by convention the program name
+ * @param stdinFd - the descriptor the program reads as stdin, or -1 to inherit ours
+ * @param stdoutFd - the descriptor the program writes as stdout, or -1 to inherit ours
+ * @return the process id, or -1 (errno is set)
+ */
+static inline pid_t spawnProcess(const char* file, char* const argv[], int stdinFd, int stdoutFd) {
+	posix_spawn_file_actions_t actions;
+	pid_t pid;
+	int error = posix_spawn_file_actions_init(&actions);
+	if (error == 0 && stdinFd >= 0 && stdinFd != STDIN_FILENO)
+		error = posix_spawn_file_actions_adddup2(&actions, stdinFd, STDIN_FILENO);
+	if (error == 0 && stdoutFd >= 0 && stdoutFd != STDOUT_FILENO)
+		error = posix_spawn_file_actions_adddup2(&actions, stdoutFd, STDOUT_FILENO);
+	if (error == 0)
+		error = posix_spawnp(&pid, file, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (error != 0) {
+		errno = error;
+		return -1;
+	}
+	return pid;
+}
+
+/**
+ * Starts a program with its stdout connected to a new pipe, like
+ * popen(..., "r") without the shell
+ * @param outputFd - receives the read end of the pipe
+ * @return the process id, or -1 (errno is set)
+ */
+static inline pid_t spawnReader(const char* file, char* const argv[], int* outputFd) {
+	int pipeFds[2];
+	pid_t pid;
+	int savedErrno;
+	if (pipe(pipeFds) < 0)
+		return -1;
+	/* Close-on-exec keeps both ends out of the program; dup2() clears the flag on its stdout */
+	fcntl(pipeFds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(pipeFds[1], F_SETFD, FD_CLOEXEC);
+	pid = spawnProcess(file, argv, -1, pipeFds[1]);
+	savedErrno = errno;
+	close(pipeFds[1]);
+	if (pid < 0) {
+		close(pipeFds[0]);
+		errno = savedErrno;
+		return -1;
+	}
+	*outputFd = pipeFds[0];
+	return pid;
+}
+
+/**
+ * Waits for a spawned program, retrying interrupted waits
+ * @param status - receives the wait status, or NULL
+ * @return the process id, or -1 (errno is set)
+ */
+static inline pid_t waitProcess(pid_t pid, int* status) {
+	pid_t result;
+	do {
+		result = waitpid(pid, status, 0);
+	} while (result < 0 && errno == EINTR);
+	return result;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <unistd.h> // provides access to the POSIX operating system API
                     // e.g.: getpid(), execl()...
 #include <sys/wait.h> // e.g.: wait()
+#include "../common/procspawn.h" // spawnProcess(): posix_spawn() with an explicit argv
 
 int main() {
     pid_t child = fork();
@@ -15,26 +16,20 @@ int main() {
         fprintf(stderr, "Forked failed.\n");
         exit(EXIT_FAILURE);
     } else if (child == 0) {
-        pid_t grandchild = fork();
+        printf("I'am a child. My ID is %d.\n", getpid());
+        fflush(stdout);
+        printf("My parent is process %d.\n\n", getppid());
+        fflush(stdout);
+        // posix_spawn() starts the grandchild directly as a Mozilla Firefox process:
+        // - no copy of the child's page tables that exec would blow away at once
+        // - no shell; the arguments are passed as they are
+        char* argv[] = {"firefox", NULL}; // By convention, argv[0] is just the file name of the executable,
+                                          // normally it's set to the same as file.
+        pid_t grandchild = spawnProcess("/usr/bin/firefox", argv, -1, -1);
         if (grandchild < 0) {
-            fprintf(stderr, "Forked failed.\n");
-            exit(EXIT_FAILURE);
-        } else if (grandchild == 0) {
-            printf("I'am a grandchild. My ID is %d.\n", getpid());
-            fflush(stdout);
-            printf("My parent is process %d.\n\n", getppid());
-            fflush(stdout);
-            printf("Grandchild turning into a Mozilla Firefox process.\n");
-            fflush(stdout);
-            // exec family of functions:
-            // - Blow away the current process' virtual address space
-            // - Begin executing the specified program in the current process
-            execl("/usr/bin/firefox", "firefox", NULL); // By convention, argv[0] is just the file name of the executable, 
-                                                        // normally it's set to the same as file.
+            perror("Failed to spawn /usr/bin/firefox");
         } else {
-            printf("I'am a child. My ID is %d.\n", getpid());
-            fflush(stdout);
-            printf("My parent is process %d.\n\n", getppid());
+            printf("Grandchild %d is a Mozilla Firefox process.\n", grandchild);
             fflush(stdout);
         }
     } else {
@@ -0,0 +1,555 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "batch.h"
+#include "benchdata.h"
+#include "clock.h"
+#include "digest.h"
+#include "digestcache.h"
+#include "frame.h"
+#include "multibuffer.h"
+#include "readengine.h"
+#include "workerpool.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool collectBatchPath(const string& path, bool recursive, vector<BatchFile>& files) {
+	struct stat info;
+	if (stat(path.c_str(), &info) < 0) {
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	if (!S_ISDIR(info.st_mode)) {
+		BatchFile file = {path, (long long)info.st_size};
+		files.push_back(file);
+		return true;
+	}
+
+	if (!recursive) {
+		fprintf(stderr, "%s: Is a directory (use -r to descend)\n", path.c_str());
+		return false;
+	}
+
+	DIR* dir = opendir(path.c_str());
+	if (!dir) {
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	vector<string> names;
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL) {
+		if (strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+			names.push_back(entry->d_name);
+	}
+	closedir(dir);
+
+	/* readdir() order depends on the file system; sort so runs are reproducible */
+	sort(names.begin(), names.end());
+
+	bool ok = true;
+	string prefix = path[path.size() - 1] == '/' ? path : path + "/";
+	for (size_t i = 0; i < names.size(); ++i) {
+		string child = prefix + names[i];
+		struct stat childInfo;
+		if (lstat(child.c_str(), &childInfo) < 0) {
+			fprintf(stderr, "%s: %s\n", child.c_str(), strerror(errno));
+			ok = false;
+			continue;
+		}
+		/* Do not follow symbolic links into directories; they can form cycles */
+		if (S_ISLNK(childInfo.st_mode) && stat(child.c_str(), &childInfo) == 0 && S_ISDIR(childInfo.st_mode))
+			continue;
+		if (S_ISDIR(childInfo.st_mode) || S_ISREG(childInfo.st_mode) || S_ISLNK(childInfo.st_mode))
+			ok = collectBatchPath(child, recursive, files) && ok;
+	}
+	return ok;
+}
+
+bool collectBatchPathsFromFd(int fd, bool recursive, vector<BatchFile>& files) {
+	bool ok = true;
+	string pending;
+	char buffer[65536];
+	for (;;) {
+		ssize_t got = read(fd, buffer, sizeof(buffer));
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed to read the list of paths.");
+			return false;
+		}
+		if (got == 0)
+			break;
+		pending.append(buffer, got);
+
+		size_t start = 0, nul;
+		while ((nul = pending.find('\0', start)) != string::npos) {
+			if (nul > start)
+				ok = collectBatchPath(pending.substr(start, nul - start), recursive, files) && ok;
+			start = nul + 1;
+		}
+		pending.erase(0, start);
+	}
+	/* The last path may lack its terminator */
+	if (!pending.empty())
+		ok = collectBatchPath(pending, recursive, files) && ok;
+	return ok;
+}
+
+string escapeBatchPath(const string& path) {
+	string escaped;
+	for (size_t i = 0; i < path.size(); ++i) {
+		switch (path[i]) {
+		case '\\':
+			escaped += "\\\\";
+			break;
+		case '\t':
+			escaped += "\\t";
+			break;
+		case '\n':
+			escaped += "\\n";
+			break;
+		case '\r':
+			escaped += "\\r";
+			break;
+		default:
+			escaped += path[i];
+		}
+	}
+	return escaped;
+}
+
+/* The algorithms computed by the batch workers; set before the pool is forked */
+static vector<int> batchAlgs;
+
+/**
+ * Formats the result lines of one file
+ * @param path - the file
+ * @param hexDigests - one digest per batch algorithm
+ */
+static string formatBatchLines(const string& path, const vector<string>& hexDigests) {
+	string lines;
+	string escapedPath = escapeBatchPath(path);
+	for (size_t i = 0; i < batchAlgs.size(); ++i) {
+		lines += hashAlgs[batchAlgs[i]].name;
+		lines += '\t';
+		lines += hexDigests[i];
+		lines += '\t';
+		lines += escapedPath;
+		lines += '\n';
+	}
+	return lines;
+}
+
+/**
+ * Hashes one file of any size by streaming it, consulting the digest cache
+ * @return "0" followed by the result lines, or "1" followed by an error message
+ */
+static string hashLargeFile(const string& path) {
+	string result;
+	vector<string> hexDigests;
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0 || hashFdCached(fd, batchAlgs, hexDigests) < 0)
+		result = "1" + path + ": " + strerror(errno) + "\n";
+	else
+		result = "0" + formatBatchLines(path, hexDigests);
+	if (fd >= 0)
+		close(fd);
+	return result;
+}
+
+/* A small file read whole by a worker */
+struct SmallFile {
+	string path;
+	string data;
+	struct stat info;
+	/* Whether the file could be read and may be cached */
+	bool ok;
+	bool cacheable;
+	string error;
+	vector<string> hexDigests;
+};
+
+/**
+ * Hashes a group of small files together: each algorithm that has a
+ * multi-buffer kernel runs over all of them at once, lane by lane
+ * @param paths - the files
+ * @return one result per file, as returned by hashLargeFile()
+ */
+static vector<string> hashSmallFiles(const vector<string>& paths) {
+	DigestCache* cache = digestCacheForProcess();
+	vector<SmallFile> files(paths.size());
+
+	for (size_t i = 0; i < paths.size(); ++i) {
+		SmallFile& file = files[i];
+		file.path = paths[i];
+		file.hexDigests.assign(batchAlgs.size(), string());
+		int fd = open(file.path.c_str(), O_RDONLY);
+		file.ok = fd >= 0 && fstat(fd, &file.info) == 0;
+		file.cacheable = file.ok && cache && S_ISREG(file.info.st_mode);
+
+		/* Digests the cache knows need no read at all */
+		bool needsRead = false;
+		for (size_t a = 0; file.ok && a < batchAlgs.size(); ++a) {
+			unsigned char digest[MAX_DIGEST_LENGTH];
+			if (file.cacheable && cache->lookup(file.info, batchAlgs[a], digest))
+				file.hexDigests[a] = toHex(digest, hashAlgs[batchAlgs[a]].digestLength);
+			else
+				needsRead = true;
+		}
+
+		char buffer[16384];
+		ssize_t got = 0;
+		while (file.ok && needsRead && (got = read(fd, buffer, sizeof(buffer))) != 0) {
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got < 0)
+				file.ok = false;
+			else
+				file.data.append(buffer, got);
+		}
+		if (!file.ok)
+			file.error = strerror(errno);
+
+		struct stat after;
+		file.cacheable = file.cacheable && file.ok && fstat(fd, &after) == 0 && after.st_size == file.info.st_size &&
+		                 after.st_mtim.tv_sec == file.info.st_mtim.tv_sec &&
+		                 after.st_mtim.tv_nsec == file.info.st_mtim.tv_nsec;
+		if (fd >= 0)
+			close(fd);
+	}
+
+	for (size_t a = 0; a < batchAlgs.size(); ++a) {
+		int alg = batchAlgs[a];
+		vector<size_t> pending;
+		vector<const unsigned char*> messages;
+		vector<size_t> lengths;
+		for (size_t i = 0; i < files.size(); ++i) {
+			if (files[i].ok && files[i].hexDigests[a].empty()) {
+				pending.push_back(i);
+				messages.push_back((const unsigned char*)files[i].data.data());
+				lengths.push_back(files[i].data.size());
+			}
+		}
+		if (pending.empty())
+			continue;
+
+		vector<unsigned char> digestBytes(pending.size() * MAX_DIGEST_LENGTH);
+		unsigned char (*digests)[MAX_DIGEST_LENGTH] = (unsigned char (*)[MAX_DIGEST_LENGTH])&digestBytes[0];
+		multiBufferHash(alg, &messages[0], &lengths[0], pending.size(), digests);
+		for (size_t k = 0; k < pending.size(); ++k) {
+			SmallFile& file = files[pending[k]];
+			file.hexDigests[a] = toHex(digests[k], hashAlgs[alg].digestLength);
+			if (file.cacheable)
+				cache->store(file.info, alg, digests[k], hashAlgs[alg].digestLength);
+		}
+	}
+
+	vector<string> results;
+	for (size_t i = 0; i < files.size(); ++i) {
+		if (files[i].ok)
+			results.push_back("0" + formatBatchLines(files[i].path, files[i].hexDigests));
+		else
+			results.push_back("1" + files[i].path + ": " + files[i].error + "\n");
+	}
+	return results;
+}
+
+/**
+ * The worker handler
+ * @param request - NUL-separated paths: one file of any size, or a group of small files
+ * @return one frame per file holding "0" and its result lines, or "1" and an error message
+ */
+static string hashBatchRequest(const string& request) {
+	vector<string> paths;
+	size_t start = 0, nul;
+	while ((nul = request.find('\0', start)) != string::npos) {
+		paths.push_back(request.substr(start, nul - start));
+		start = nul + 1;
+	}
+	paths.push_back(request.substr(start));
+
+	vector<string> results;
+	if (paths.size() == 1)
+		results.push_back(hashLargeFile(paths[0]));
+	else
+		results = hashSmallFiles(paths);
+
+	/* The frames inside the response use the same length-prefixed layout as the pipe */
+	string response;
+	for (size_t i = 0; i < results.size(); ++i) {
+		uint32_t length = results[i].size();
+		response.append((const char*)&length, FRAME_HEADER_LENGTH);
+		response += results[i];
+	}
+	return response;
+}
+
+/* The parent's bookkeeping while a batch runs */
+struct BatchProgress {
+	const vector<BatchFile>* files;
+	/* The first file of every request */
+	vector<size_t> requestFirstFile;
+	/* The results not printed yet, indexed like files */
+	vector<string> results;
+	vector<bool> received;
+	/* The next file to print */
+	size_t nextToPrint;
+	long long bytes;
+	size_t failures;
+};
+
+/**
+ * Prints every finished file not printed yet, in input order
+ */
+static void printFinishedFiles(BatchProgress* progress) {
+	while (progress->nextToPrint < progress->results.size() && progress->received[progress->nextToPrint]) {
+		string& done = progress->results[progress->nextToPrint];
+		if (done[0] == '0') {
+			fwrite(done.data() + 1, 1, done.size() - 1, stdout);
+			progress->bytes += (*progress->files)[progress->nextToPrint].size;
+		} else {
+			fwrite(done.data() + 1, 1, done.size() - 1, stderr);
+			++progress->failures;
+		}
+		/* Release the memory of printed results */
+		string().swap(done);
+		++progress->nextToPrint;
+	}
+}
+
+/**
+ * Collects one response from a worker process
+ */
+static void onBatchResult(size_t requestId, const string& response, void* context) {
+	BatchProgress* progress = (BatchProgress*)context;
+
+	string pending = response, result;
+	for (size_t file = progress->requestFirstFile[requestId]; extractFrame(pending, result); ++file) {
+		progress->results[file] = result;
+		progress->received[file] = true;
+	}
+	printFinishedFiles(progress);
+}
+
+/**
+ * Collects one file hashed by an in-process read engine
+ */
+static void onEngineFile(size_t fileIndex, const FileDigests& digests, void* context) {
+	BatchProgress* progress = (BatchProgress*)context;
+	const string& path = (*progress->files)[fileIndex].path;
+	if (digests.ok)
+		progress->results[fileIndex] = "0" + formatBatchLines(path, digests.hexDigests);
+	else
+		progress->results[fileIndex] = "1" + path + ": " + digests.error + "\n";
+	progress->received[fileIndex] = true;
+	printFinishedFiles(progress);
+}
+
+/**
+ * Prints the throughput summary of a batch on stderr
+ * @param hashed - the number of files hashed
+ * @param how - what did the work, e.g. the SIMD level or the read engine
+ * @param width - the lanes or threads of how
+ */
+static void printBatchSummary(size_t hashed, const BatchProgress& progress, double elapsed, const char* how,
+                              size_t width) {
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	double megabytes = progress.bytes / 1e6;
+	fprintf(stderr, "Hashed %zu files (%.1f MB) with %zu error(s) in %.3f s: %.1f files/s, %.1f MB/s [%s x%zu]\n",
+	        hashed, megabytes, progress.failures, elapsed, hashed / elapsed, megabytes / elapsed, how, width);
+}
+
+int runBatch(const vector<BatchFile>& files, const vector<int>& algs, long jobs, ReadEngine engine) {
+	double startTime = monotonicNow();
+	BatchProgress progress;
+	progress.files = &files;
+	progress.results.resize(files.size());
+	progress.received.resize(files.size(), false);
+	progress.nextToPrint = 0;
+	progress.bytes = 0;
+	progress.failures = 0;
+	batchAlgs = algs;
+
+	/* The in-process engines read every file themselves, one block at a time */
+	if (engine != READ_ENGINE_WORKERS) {
+		vector<string> paths;
+		for (size_t i = 0; i < files.size(); ++i)
+			paths.push_back(files[i].path);
+		ReadEngine used = hashWithReadEngine(engine, paths, algs, jobs, onEngineFile, &progress);
+		fflush(stdout);
+		printBatchSummary(files.size() - progress.failures, progress, monotonicNow() - startTime, readEngineName(used), jobs);
+		return progress.failures ? 1 : 0;
+	}
+
+	/* Runs of small files travel together so one worker can hash them lane by lane */
+	size_t groupSize = 1;
+	for (size_t a = 0; a < algs.size(); ++a)
+		groupSize = max(groupSize, multiBufferLanes(algs[a]));
+
+	vector<string> requests;
+	for (size_t i = 0; i < files.size(); ++i) {
+		bool small = files[i].size <= (long long)MULTI_BUFFER_MAX_FILE_SIZE;
+		bool joinsGroup = groupSize > 1 && small && !requests.empty() && i > 0 &&
+		                  files[i - 1].size <= (long long)MULTI_BUFFER_MAX_FILE_SIZE &&
+		                  i - progress.requestFirstFile.back() < groupSize;
+		if (joinsGroup) {
+			requests.back() += '\0';
+			requests.back() += files[i].path;
+		} else {
+			requests.push_back(files[i].path);
+			progress.requestFirstFile.push_back(i);
+		}
+	}
+
+	/* The workers are forked once and serve every file */
+	{
+		WorkerPool pool(jobs, hashBatchRequest);
+		pool.run(requests, onBatchResult, &progress);
+	}
+	fflush(stdout);
+
+	printBatchSummary(files.size() - progress.failures, progress, monotonicNow() - startTime, simdLevelName(simdLevel()),
+	                  groupSize);
+	return progress.failures ? 1 : 0;
+}
+
+/* The shape of the synthetic tree of benchReadEngines() */
+#define BENCH_TREE_DIRS 16
+#define BENCH_TREE_FILES_PER_DIR 128
+
+/**
+ * Creates the synthetic tree: mostly small files with some up to 1 MiB
+ * @param root - the directory to fill
+ * @return false if a file could not be written (a message was printed)
+ */
+static bool createBenchTree(const string& root) {
+	vector<unsigned char> data(1 << 20);
+	uint64_t x = fillRandom(data, 0x9e3779b97f4a7c15ULL);
+
+	for (int d = 0; d < BENCH_TREE_DIRS; ++d) {
+		char dirName[32];
+		snprintf(dirName, sizeof(dirName), "/d%02d", d);
+		string dir = root + dirName;
+		if (mkdir(dir.c_str(), 0755) < 0) {
+			fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+			return false;
+		}
+		for (int f = 0; f < BENCH_TREE_FILES_PER_DIR; ++f) {
+			xorshift64(x);
+			/* Seven in eight files are under 64 KiB */
+			size_t size = x % 8 ? (x >> 8) % (64 << 10) : (x >> 8) % data.size();
+			char fileName[32];
+			snprintf(fileName, sizeof(fileName), "/f%03d", f);
+			string path = dir + fileName;
+			/* The data must be on disk before the page cache can drop it */
+			if (!writeFile(path, &data[(x >> 40) % (data.size() - size + 1)], size, true))
+				return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Removes the synthetic tree
+ */
+static void removeBenchTree(const string& root, const vector<BatchFile>& files) {
+	for (size_t i = 0; i < files.size(); ++i)
+		unlink(files[i].path.c_str());
+	for (int d = 0; d < BENCH_TREE_DIRS; ++d) {
+		char dirName[32];
+		snprintf(dirName, sizeof(dirName), "/d%02d", d);
+		rmdir((root + dirName).c_str());
+	}
+	rmdir(root.c_str());
+}
+
+/* The totals of one benchmark run */
+struct BenchTotals {
+	long long bytes;
+	size_t failures;
+};
+
+/**
+ * Counts one file of a benchmark run
+ */
+static void onBenchFile(size_t, const FileDigests& digests, void* context) {
+	BenchTotals* totals = (BenchTotals*)context;
+	totals->bytes += digests.bytes;
+	if (!digests.ok)
+		++totals->failures;
+}
+
+int benchReadEngines(const string& dir, const vector<int>& algs, long jobs) {
+	string root = dir;
+	if (root.empty()) {
+		const char* tmp = getenv("TMPDIR");
+		string pattern = string(tmp && *tmp ? tmp : "/var/tmp") + "/computeHashValue-bench.XXXXXX";
+		vector<char> name(pattern.begin(), pattern.end());
+		name.push_back('\0');
+		if (!mkdtemp(&name[0])) {
+			fprintf(stderr, "%s: %s\n", pattern.c_str(), strerror(errno));
+			return 1;
+		}
+		root = &name[0];
+		fprintf(stderr, "Creating %d files in %s...\n", BENCH_TREE_DIRS * BENCH_TREE_FILES_PER_DIR, root.c_str());
+		if (!createBenchTree(root)) {
+			vector<BatchFile> partial;
+			collectBatchPath(root, true, partial);
+			removeBenchTree(root, partial);
+			return 1;
+		}
+	}
+
+	vector<BatchFile> files;
+	if (!collectBatchPath(root, true, files))
+		return 1;
+	vector<string> paths;
+	for (size_t i = 0; i < files.size(); ++i)
+		paths.push_back(files[i].path);
+
+	ReadEngine engines[] = {READ_ENGINE_PREAD, READ_ENGINE_URING};
+	for (size_t e = 0; e < sizeof(engines) / sizeof(engines[0]); ++e) {
+		for (int pass = 0; pass < 2; ++pass) {
+			bool cold = pass == 0;
+			/* Drop the (clean) pages of every file so the first pass really reads the device */
+			for (size_t i = 0; cold && i < paths.size(); ++i) {
+				int fd = open(paths[i].c_str(), O_RDONLY);
+				if (fd >= 0) {
+					posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+					close(fd);
+				}
+			}
+
+			BenchTotals totals = {0, 0};
+			double startTime = monotonicNow();
+			ReadEngine used = hashWithReadEngine(engines[e], paths, algs, jobs, onBenchFile, &totals);
+			double elapsed = monotonicNow() - startTime;
+			if (elapsed <= 0)
+				elapsed = 1e-9;
+			fprintf(stdout, "%-8s %-4s %6zu files %9.1f MB %8.3f s %10.1f files/s %8.1f MB/s%s\n",
+			        readEngineName(used), cold ? "cold" : "warm", paths.size() - totals.failures,
+			        totals.bytes / 1e6, elapsed, paths.size() / elapsed, totals.bytes / 1e6 / elapsed,
+			        used != engines[e] ? " (io_uring unavailable)" : "");
+			fflush(stdout);
+		}
+	}
+
+	if (dir.empty())
+		removeBenchTree(root, files);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <string>
+#include <vector>
+
+#include "readengine.h"
+
+/* One file queued for batch hashing */
+struct BatchFile {
+	/* The path as given or as found while walking a directory */
+	std::string path;
+	/* The size reported by stat(), used for the throughput summary */
+	long long size;
+};
+
+/**
+ * Adds a path to the batch; directories are walked when recursive is set
+ * @param path - a file or directory
+ * @param recursive - whether to descend into directories
+ * @param files - receives the regular files found, in a stable order
+ * @return false if the path could not be read (a message was printed)
+ */
+bool collectBatchPath(const std::string& path, bool recursive, std::vector<BatchFile>& files);
+
+/**
+ * Adds the NUL-separated paths read from a descriptor (e.g. find -print0)
+ * @param fd - the descriptor to read
+ * @param recursive - whether to descend into directories
+ * @param files - receives the regular files found
+ * @return false if any path could not be read
+ */
+bool collectBatchPathsFromFd(int fd, bool recursive, std::vector<BatchFile>& files);
+
+/**
+ * Escapes a path so that it fits on one tab-separated line
+ * @param path - the path to escape
+ */
+std::string escapeBatchPath(const std::string& path);
+
+/**
+ * Hashes every file on a pool of jobs pre-forked worker processes, or with
+ * an in-process read engine, and prints one "<algorithm>\t<hex digest>\t<path>"
+ * line per (file, algorithm), in input order, followed by a throughput
+ * summary on stderr
+ * @param files - the files to hash
+ * @param algs - the algorithms to compute
+ * @param jobs - the size of the worker pool, or the digest threads of an engine
+ * @param engine - how the files are read
+ * @return 0 if every file was hashed, 1 otherwise
+ */
+int runBatch(const std::vector<BatchFile>& files, const std::vector<int>& algs, long jobs,
+             ReadEngine engine = READ_ENGINE_WORKERS);
+
+/**
+ * Times the io_uring and pread engines on the files below a directory, first
+ * with the files evicted from the page cache, then again with them cached.
+ * Without a directory, a synthetic tree of small and medium files is created
+ * under $TMPDIR (default /var/tmp) and removed afterwards.
+ * @param dir - the tree to read, or empty for a synthetic one
+ * @param algs - the algorithms to compute
+ * @param jobs - the number of digest threads
+ * @return the exit status
+ */
+int benchReadEngines(const std::string& dir, const std::vector<int>& algs, long jobs);
+
+#endif
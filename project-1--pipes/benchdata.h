@@ -0,0 +1,69 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef BENCHDATA_H
+#define BENCHDATA_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "frame.h"
+
+/*
+ * The inputs of the benchmarks: pseudo-random bytes, so no digest gets
+ * an easy input, and the files they are written to.
+ */
+
+/**
+ * Advances a xorshift64 generator by one step
+ * @param state - the generator; never 0
+ * @return the new state
+ */
+inline uint64_t xorshift64(uint64_t& state) {
+	state ^= state << 13;
+	state ^= state >> 7;
+	state ^= state << 17;
+	return state;
+}
+
+/**
+ * Fills a buffer with pseudo-random bytes
+ * @param buffer - the buffer to fill
+ * @param seed - picks the sequence
+ * @return the generator's state afterwards, for drawing further numbers
+ */
+inline uint64_t fillRandom(std::vector<unsigned char>& buffer, uint64_t seed) {
+	uint64_t state = seed | 1;
+	for (size_t i = 0; i < buffer.size(); ++i)
+		buffer[i] = xorshift64(state);
+	return state;
+}
+
+/**
+ * Creates or truncates a file and writes a buffer to it
+ * @param path - the file
+ * @param data - the bytes to write
+ * @param length - their number
+ * @param sync - also wait until the data is on disk
+ * @return false on an error (a message was printed)
+ */
+inline bool writeFile(const std::string& path, const void* data, size_t length, bool sync = false) {
+	int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	bool ok = fd >= 0 && writeAll(fd, data, length) && (!sync || fdatasync(fd) == 0);
+	int error = errno;
+	if (fd >= 0)
+		close(fd);
+	if (!ok)
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(error));
+	return ok;
+}
+
+#endif
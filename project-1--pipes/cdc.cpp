@@ -0,0 +1,220 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "cdc.h"
+#include "clock.h"
+#include "digest.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <unordered_set>
+
+using namespace std;
+
+/* The Gear table: one fixed pseudo-random word per byte value, so chunk boundaries are reproducible */
+struct GearTable {
+	uint64_t entries[256];
+
+	GearTable() {
+		/* splitmix64 */
+		uint64_t state = 0x6a09e667f3bcc908ULL;
+		for (int i = 0; i < 256; ++i) {
+			uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			entries[i] = z ^ (z >> 31);
+		}
+	}
+};
+
+static const GearTable gear;
+
+bool makeCdcParams(size_t minSize, size_t avgSize, size_t maxSize, CdcParams& params) {
+	if (avgSize < 64 || minSize > avgSize || avgSize > maxSize)
+		return false;
+
+	/* Round avg to the nearest power of two */
+	int bits = 0;
+	while (((size_t)1 << (bits + 1)) <= avgSize)
+		++bits;
+	if (avgSize - ((size_t)1 << bits) > ((size_t)1 << (bits + 1)) - avgSize)
+		++bits;
+	if (bits + 2 >= 64)
+		return false;
+
+	params.minSize = minSize;
+	params.avgSize = (size_t)1 << bits;
+	params.maxSize = maxSize;
+	/* The top bits of a Gear hash depend on the most input bytes */
+	params.strictMask = ~0ULL << (64 - (bits + 2));
+	params.looseMask = ~0ULL << (64 - (bits - 2));
+	return true;
+}
+
+size_t cdcCutPoint(const unsigned char* data, size_t len, const CdcParams& params) {
+	if (len <= params.minSize)
+		return len;
+	size_t end = len < params.maxSize ? len : params.maxSize;
+	size_t normal = end < params.avgSize ? end : params.avgSize;
+
+	uint64_t h = 0;
+	size_t i = params.minSize;
+	for (; i < normal; ++i) {
+		h = (h << 1) + gear.entries[data[i]];
+		if (!(h & params.strictMask))
+			return i + 1;
+	}
+	for (; i < end; ++i) {
+		h = (h << 1) + gear.entries[data[i]];
+		if (!(h & params.looseMask))
+			return i + 1;
+	}
+	return end;
+}
+
+long long chunkFd(int fd, const CdcParams& params, ChunkHandler onChunk, void* context) {
+	/* Tell the kernel to read ahead aggressively; failure is harmless */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	/* Room for one read block after the unfinished tail of the last one */
+	size_t capacity = HASH_READ_BLOCK_SIZE + params.maxSize;
+	unsigned char* buffer = (unsigned char*)malloc(capacity);
+	if (!buffer)
+		return -1;
+
+	long long total = 0, offset = 0;
+	size_t have = 0;
+	bool eof = false;
+	while (!eof || have > 0) {
+		while (!eof && have < capacity) {
+			ssize_t got = read(fd, buffer + have, capacity - have);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got < 0) {
+				int savedErrno = errno;
+				free(buffer);
+				errno = savedErrno;
+				return -1;
+			}
+			if (got == 0)
+				eof = true;
+			have += got;
+			total += got;
+		}
+
+		/* A cut needs a whole maximal chunk ahead of it, unless the stream has ended */
+		size_t pos = 0;
+		while (have - pos >= params.maxSize || (eof && pos < have)) {
+			size_t length = cdcCutPoint(buffer + pos, have - pos, params);
+			onChunk(buffer + pos, offset, length, context);
+			pos += length;
+			offset += length;
+		}
+		memmove(buffer, buffer + pos, have - pos);
+		have -= pos;
+	}
+
+	free(buffer);
+	return total;
+}
+
+/* The state of runCdc() while it walks the files */
+struct CdcRun {
+	Digest* digest;
+	/* The fingerprints seen so far */
+	unordered_set<string> seen;
+	FILE* index;
+	/* The escaped path of the current file, for the index */
+	string escapedPath;
+	long long chunks;
+	long long uniqueChunks;
+	long long uniqueBytes;
+};
+
+/**
+ * Fingerprints one chunk and records whether it is new
+ */
+static void onCdcChunk(const unsigned char* data, long long offset, size_t length, void* context) {
+	CdcRun* run = (CdcRun*)context;
+	unsigned char fingerprint[MAX_DIGEST_LENGTH];
+	run->digest->reset();
+	run->digest->update(data, length);
+	run->digest->final(fingerprint);
+	string key((const char*)fingerprint, run->digest->digestLength());
+
+	++run->chunks;
+	if (run->seen.insert(key).second) {
+		++run->uniqueChunks;
+		run->uniqueBytes += length;
+	}
+	if (run->index)
+		fprintf(run->index, "%s\t%lld\t%zu\t%s\n", run->escapedPath.c_str(), offset, length,
+		        toHex(fingerprint, run->digest->digestLength()).c_str());
+}
+
+int runCdc(const vector<BatchFile>& files, int alg, const CdcParams& params, const string& indexPath) {
+	double startTime = monotonicNow();
+	CdcRun run;
+	run.digest = createDigest(alg);
+	run.index = NULL;
+	run.chunks = run.uniqueChunks = run.uniqueBytes = 0;
+
+	if (!indexPath.empty()) {
+		run.index = fopen(indexPath.c_str(), "w");
+		if (!run.index) {
+			fprintf(stderr, "%s: %s\n", indexPath.c_str(), strerror(errno));
+			delete run.digest;
+			return 1;
+		}
+		fprintf(run.index, "# computeHashValue chunk index v1\n");
+		fprintf(run.index, "cdc %s %zu %zu %zu\n", hashAlgs[alg].name, params.minSize, params.avgSize,
+		        params.maxSize);
+	}
+
+	long long totalBytes = 0;
+	size_t failures = 0;
+	for (size_t i = 0; i < files.size(); ++i) {
+		run.escapedPath = escapeBatchPath(files[i].path);
+		int fd = open(files[i].path.c_str(), O_RDONLY);
+		long long bytesRead = fd < 0 ? -1 : chunkFd(fd, params, onCdcChunk, &run);
+		if (bytesRead < 0) {
+			fprintf(stderr, "%s: %s\n", files[i].path.c_str(), strerror(errno));
+			++failures;
+		} else {
+			totalBytes += bytesRead;
+		}
+		if (fd >= 0)
+			close(fd);
+	}
+
+	bool indexOk = true;
+	if (run.index) {
+		indexOk = fflush(run.index) == 0 && !ferror(run.index);
+		indexOk = fclose(run.index) == 0 && indexOk;
+		if (!indexOk)
+			fprintf(stderr, "%s: failed to write the chunk index\n", indexPath.c_str());
+	}
+	delete run.digest;
+
+	double elapsed = monotonicNow() - startTime;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	fprintf(stdout, "Files:         %zu (%lld bytes)\n", files.size() - failures, totalBytes);
+	fprintf(stdout, "Chunks:        %lld, %.0f bytes on average (min %zu, avg %zu, max %zu)\n", run.chunks,
+	        run.chunks ? (double)totalBytes / run.chunks : 0.0, params.minSize, params.avgSize, params.maxSize);
+	fprintf(stdout, "Unique chunks: %lld (%lld bytes)\n", run.uniqueChunks, run.uniqueBytes);
+	fprintf(stdout, "Dedup ratio:   %.2f:1, %lld bytes (%.1f%%) saved\n",
+	        run.uniqueBytes ? (double)totalBytes / run.uniqueBytes : 1.0, totalBytes - run.uniqueBytes,
+	        totalBytes ? 100.0 * (totalBytes - run.uniqueBytes) / totalBytes : 0.0);
+	fprintf(stdout, "Throughput:    %.1f MB/s (chunking and %s fingerprints)\n", totalBytes / 1e6 / elapsed,
+	        hashAlgs[alg].name);
+	fflush(stdout);
+	return failures || !indexOk ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef CDC_H
+#define CDC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+/*
+ * Content-defined chunking (FastCDC style)
+ *
+ * A Gear rolling hash, h = (h << 1) + gear[byte], runs over the data; a
+ * chunk ends where the top bits of h are all zero. The hash only starts
+ * min bytes into a chunk. Until avg bytes it needs two more zero bits than
+ * log2(avg), and after that two fewer, which pulls chunk sizes towards avg.
+ * A chunk never exceeds max. Because each cut depends only on the last 64
+ * bytes, an insertion only moves the boundaries next to it, and the rest of
+ * a file still produces the same chunks.
+ *
+ * A chunk index lists every chunk with its fingerprint:
+ *
+ *   # computeHashValue chunk index v1
+ *   cdc <algorithm> <min> <avg> <max>
+ *   <escaped path>\t<offset>\t<length>\t<fingerprint hex>
+ *   ...
+ */
+
+/* The default chunk size bounds */
+#define DEFAULT_CDC_MIN_SIZE (2u << 10)
+#define DEFAULT_CDC_AVG_SIZE (8u << 10)
+#define DEFAULT_CDC_MAX_SIZE (64u << 10)
+
+/* The chunking parameters */
+struct CdcParams {
+	size_t minSize;
+	/* Rounded to a power of two */
+	size_t avgSize;
+	size_t maxSize;
+	/* The bits that must be zero before and after avgSize */
+	uint64_t strictMask;
+	uint64_t looseMask;
+};
+
+/**
+ * Validates the size bounds and derives the masks
+ * @param minSize, avgSize, maxSize - need minSize <= avgSize <= maxSize and avgSize >= 64
+ * @param params - receives the parameters
+ * @return false if the bounds are invalid
+ */
+bool makeCdcParams(size_t minSize, size_t avgSize, size_t maxSize, CdcParams& params);
+
+/**
+ * Finds the end of the chunk starting at data
+ * @param data - the bytes from the start of the chunk on
+ * @param len - how many are available; when fewer than maxSize, they must run to the end of the stream
+ * @return the chunk length
+ */
+size_t cdcCutPoint(const unsigned char* data, size_t len, const CdcParams& params);
+
+/**
+ * Called for every chunk of a stream, in order
+ * @param data - the chunk; valid only during the call
+ * @param offset - its offset in the stream
+ * @param length - its length
+ * @param context - the pointer given to chunkFd()
+ */
+typedef void (*ChunkHandler)(const unsigned char* data, long long offset, size_t length, void* context);
+
+/**
+ * Splits everything readable from a descriptor into chunks; memory use is
+ * bounded by one read block plus one maximal chunk
+ * @return the number of bytes read, or -1 on a read error (errno is set)
+ */
+long long chunkFd(int fd, const CdcParams& params, ChunkHandler onChunk, void* context);
+
+/**
+ * Chunks every file, fingerprints each chunk and prints a deduplication
+ * report: total and unique chunks and bytes, and the dedup ratio
+ * @param files - the files
+ * @param alg - the fingerprint algorithm
+ * @param params - the chunking parameters
+ * @param indexPath - where to write the chunk index, or empty
+ * @return 0 if every file was read, 1 otherwise
+ */
+int runCdc(const std::vector<BatchFile>& files, int alg, const CdcParams& params, const std::string& indexPath);
+
+#endif
@@ -0,0 +1,323 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "check.h"
+#include "clock.h"
+#include "digest.h"
+#include "digestcache.h"
+#include "workerpool.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @return whether s is a non-empty string of hex digits
+ */
+static bool isHex(const string& s) {
+	for (size_t i = 0; i < s.size(); ++i) {
+		if (!isxdigit((unsigned char)s[i]))
+			return false;
+	}
+	return !s.empty();
+}
+
+static string lowercase(string s) {
+	for (size_t i = 0; i < s.size(); ++i)
+		s[i] = tolower((unsigned char)s[i]);
+	return s;
+}
+
+/**
+ * @return the algorithm whose digests have this many hex digits, or -1
+ */
+static int algForHexLength(size_t length) {
+	for (int alg = 0; alg < ALG_COUNT; ++alg) {
+		if (hashAlgs[alg].digestLength * 2 == length)
+			return alg;
+	}
+	return -1;
+}
+
+/**
+ * Undoes escapeSumFileName() (backslash, n and r) or escapeBatchPath() (also t)
+ * @param allowTab - whether \t is a valid escape
+ * @return false on an unknown escape sequence
+ */
+static bool unescapeName(const string& escaped, bool allowTab, string& name) {
+	name.clear();
+	for (size_t i = 0; i < escaped.size(); ++i) {
+		if (escaped[i] != '\\') {
+			name += escaped[i];
+			continue;
+		}
+		if (++i == escaped.size())
+			return false;
+		switch (escaped[i]) {
+		case '\\':
+			name += '\\';
+			break;
+		case 'n':
+			name += '\n';
+			break;
+		case 'r':
+			name += '\r';
+			break;
+		case 't':
+			if (!allowTab)
+				return false;
+			name += '\t';
+			break;
+		default:
+			return false;
+		}
+	}
+	return true;
+}
+
+bool parseCheckLine(const string& line, int forcedAlg, CheckEntry& entry) {
+	string rest = line;
+	/* Tolerate manifests written on Windows */
+	if (!rest.empty() && rest[rest.size() - 1] == '\r')
+		rest.erase(rest.size() - 1);
+
+	string hex, escapedPath;
+	bool escaped = false, allowTab = false;
+	int alg = -1;
+
+	size_t tab = rest.find('\t');
+	size_t secondTab = tab == string::npos ? string::npos : rest.find('\t', tab + 1);
+	if (secondTab != string::npos) {
+		/* Batch mode: <algorithm>\t<hex>\t<escaped path> */
+		alg = findHashAlg(rest.substr(0, tab));
+		hex = rest.substr(tab + 1, secondTab - tab - 1);
+		escapedPath = rest.substr(secondTab + 1);
+		escaped = allowTab = true;
+	} else {
+		/* A leading backslash means the name is escaped */
+		if (!rest.empty() && rest[0] == '\\') {
+			escaped = true;
+			rest.erase(0, 1);
+		}
+		size_t space = rest.find(' ');
+		if (space != string::npos && isHex(rest.substr(0, space)) && space + 1 < rest.size() &&
+		    (rest[space + 1] == ' ' || rest[space + 1] == '*')) {
+			/* GNU: <hex>  <path> or <hex> *<path> */
+			hex = rest.substr(0, space);
+			escapedPath = rest.substr(space + 2);
+			alg = algForHexLength(hex.size());
+		} else {
+			/* BSD: <TAG> (<path>) = <hex> */
+			size_t open = rest.find(" (");
+			size_t close = rest.rfind(") = ");
+			if (open == string::npos || close == string::npos || close < open + 2)
+				return false;
+			alg = findHashAlg(lowercase(rest.substr(0, open)));
+			escapedPath = rest.substr(open + 2, close - open - 2);
+			hex = rest.substr(close + 4);
+		}
+	}
+
+	if (alg < 0 || (forcedAlg >= 0 && alg != forcedAlg) || !isHex(hex) ||
+	    hex.size() != hashAlgs[alg].digestLength * 2 || escapedPath.empty())
+		return false;
+	entry.alg = alg;
+	entry.hexDigest = lowercase(hex);
+	if (!escaped) {
+		entry.path = escapedPath;
+		return true;
+	}
+	return unescapeName(escapedPath, allowTab, entry.path);
+}
+
+/**
+ * The worker handler
+ * @param request - the algorithm number, a NUL and the path
+ * @return "0", the file size, a space and the hex digest; or "1" and an error message
+ */
+static string checkRequest(const string& request) {
+	size_t nul = request.find('\0');
+	vector<int> algs(1, atoi(request.substr(0, nul).c_str()));
+	string path = request.substr(nul + 1);
+
+	vector<string> hexDigests;
+	struct stat info;
+	int fd = open(path.c_str(), O_RDONLY);
+	long long bytesRead = fd < 0 ? -1 : hashFdCached(fd, algs, hexDigests);
+	int savedErrno = errno;
+	/* A digest served by the cache reads nothing, but the file still counts as verified */
+	if (bytesRead >= 0 && fstat(fd, &info) == 0 && S_ISREG(info.st_mode))
+		bytesRead = info.st_size;
+	if (fd >= 0)
+		close(fd);
+
+	if (bytesRead < 0)
+		return string("1") + strerror(savedErrno);
+	char size[32];
+	snprintf(size, sizeof(size), "0%lld ", bytesRead);
+	return size + hexDigests[0];
+}
+
+/* The parent's bookkeeping while a check runs */
+struct CheckProgress {
+	const vector<CheckEntry>* entries;
+	/* The responses not printed yet, indexed like entries */
+	vector<string> results;
+	vector<bool> received;
+	/* The next entry to print */
+	size_t nextToPrint;
+	size_t matched;
+	size_t mismatched;
+	size_t unreadable;
+	long long bytes;
+	bool failFast;
+	/* Whether fail-fast stopped the pool */
+	bool stopped;
+	WorkerPool* pool;
+};
+
+/**
+ * Prints the verdict on one entry the way sha256sum -c does
+ */
+static void printCheckResult(CheckProgress* progress, size_t index) {
+	const CheckEntry& entry = (*progress->entries)[index];
+	const string& result = progress->results[index];
+	bool needsEscape;
+	string name = escapeSumFileName(entry.path, needsEscape);
+	const char* prefix = needsEscape ? "\\" : "";
+
+	if (result[0] == '1') {
+		fprintf(stderr, "%s: %s: %s\n", hashAlgs[entry.alg].progName, entry.path.c_str(), result.c_str() + 1);
+		fprintf(stdout, "%s%s: FAILED open or read\n", prefix, name.c_str());
+		++progress->unreadable;
+		return;
+	}
+	size_t space = result.find(' ');
+	progress->bytes += atoll(result.c_str() + 1);
+	if (result.compare(space + 1, string::npos, entry.hexDigest) == 0) {
+		fprintf(stdout, "%s%s: OK\n", prefix, name.c_str());
+		++progress->matched;
+	} else {
+		fprintf(stdout, "%s%s: FAILED\n", prefix, name.c_str());
+		++progress->mismatched;
+	}
+}
+
+/**
+ * Collects one response and prints every finished entry in manifest order
+ */
+static void onCheckResult(size_t requestId, const string& response, void* context) {
+	CheckProgress* progress = (CheckProgress*)context;
+	progress->results[requestId] = response;
+	progress->received[requestId] = true;
+
+	if (progress->failFast && !progress->stopped) {
+		const string& expected = (*progress->entries)[requestId].hexDigest;
+		size_t space = response.find(' ');
+		if (response[0] == '1' || response.compare(space + 1, string::npos, expected) != 0) {
+			progress->stopped = true;
+			progress->pool->stop();
+		}
+	}
+
+	while (progress->nextToPrint < progress->results.size() && progress->received[progress->nextToPrint]) {
+		printCheckResult(progress, progress->nextToPrint);
+		string().swap(progress->results[progress->nextToPrint]);
+		++progress->nextToPrint;
+	}
+}
+
+/**
+ * Prints a coreutils-style warning with the right plural
+ */
+static void warnCount(size_t count, const char* one, const char* many) {
+	if (count)
+		fprintf(stderr, "WARNING: %zu %s\n", count, count == 1 ? one : many);
+}
+
+int runCheck(const string& manifestPath, int forcedAlg, long jobs, bool failFast) {
+	double startTime = monotonicNow();
+	FILE* manifest = manifestPath == "-" ? stdin : fopen(manifestPath.c_str(), "r");
+	if (!manifest) {
+		fprintf(stderr, "%s: %s\n", manifestPath.c_str(), strerror(errno));
+		return 1;
+	}
+
+	vector<CheckEntry> entries;
+	size_t malformed = 0;
+	char* line = NULL;
+	size_t capacity = 0;
+	ssize_t length;
+	while ((length = getline(&line, &capacity, manifest)) >= 0) {
+		string text(line, length);
+		if (!text.empty() && text[text.size() - 1] == '\n')
+			text.erase(text.size() - 1);
+		CheckEntry entry;
+		if (parseCheckLine(text, forcedAlg, entry))
+			entries.push_back(entry);
+		else
+			++malformed;
+	}
+	free(line);
+	if (manifest != stdin)
+		fclose(manifest);
+
+	if (entries.empty()) {
+		fprintf(stderr, "%s: no properly formatted checksum lines found\n", manifestPath.c_str());
+		return 1;
+	}
+
+	/* Each worker computes only the algorithm its entry names */
+	vector<string> requests;
+	for (size_t i = 0; i < entries.size(); ++i) {
+		char alg[16];
+		snprintf(alg, sizeof(alg), "%d", entries[i].alg);
+		requests.push_back(string(alg) + '\0' + entries[i].path);
+	}
+
+	CheckProgress progress;
+	progress.entries = &entries;
+	progress.results.resize(entries.size());
+	progress.received.resize(entries.size(), false);
+	progress.nextToPrint = 0;
+	progress.matched = progress.mismatched = progress.unreadable = 0;
+	progress.bytes = 0;
+	progress.failFast = failFast;
+	progress.stopped = false;
+	{
+		WorkerPool pool(jobs, checkRequest);
+		progress.pool = &pool;
+		pool.run(requests, onCheckResult, &progress);
+	}
+
+	/* After an early stop, later entries may have finished before an earlier one was even sent */
+	for (size_t i = progress.nextToPrint; i < entries.size(); ++i) {
+		if (progress.received[i])
+			printCheckResult(&progress, i);
+	}
+	fflush(stdout);
+
+	warnCount(malformed, "line is improperly formatted", "lines are improperly formatted");
+	warnCount(progress.unreadable, "listed file could not be read", "listed files could not be read");
+	warnCount(progress.mismatched, "computed checksum did NOT match", "computed checksums did NOT match");
+
+	size_t checked = progress.matched + progress.mismatched + progress.unreadable;
+	double elapsed = monotonicNow() - startTime;
+	if (elapsed <= 0)
+		elapsed = 1e-9;
+	fprintf(stderr, "Checked %zu of %zu files (%.1f MB) in %.3f s: %zu OK, %zu FAILED, %zu unreadable, %.1f MB/s%s\n",
+	        checked, entries.size(), progress.bytes / 1e6, elapsed, progress.matched, progress.mismatched,
+	        progress.unreadable, progress.bytes / 1e6 / elapsed, progress.stopped ? " (stopped early)" : "");
+	return progress.mismatched || progress.unreadable ? 1 : 0;
+}
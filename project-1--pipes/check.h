@@ -0,0 +1,48 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stddef.h>
+#include <string>
+
+/* One line of a checksum manifest */
+struct CheckEntry {
+	/* The algorithm named or implied by the line */
+	int alg;
+	/* The expected digest, in lowercase hex */
+	std::string hexDigest;
+	/* The file to check */
+	std::string path;
+};
+
+/**
+ * Parses one manifest line in any of the formats this program or coreutils
+ * writes: "<hex>  <path>" (or "<hex> *<path>") as printed by sha256sum and
+ * friends, "<TAG> (<path>) = <hex>" as printed by their --tag option, and
+ * the "<algorithm>\t<hex>\t<path>" lines of batch mode. The algorithm of the
+ * first format is inferred from the length of the digest.
+ * @param line - the line, without its newline
+ * @param forcedAlg - the only algorithm to accept (from -a), or -1
+ * @param entry - receives the parsed line
+ * @return false if the line is improperly formatted
+ */
+bool parseCheckLine(const std::string& line, int forcedAlg, CheckEntry& entry);
+
+/**
+ * Verifies every file listed in a manifest on a pool of worker processes,
+ * each computing only the algorithm its entry names. Prints "<path>: OK" or
+ * "<path>: FAILED" per entry in manifest order, the coreutils warnings, and
+ * a summary with the elapsed time and the bytes verified on stderr.
+ * @param manifestPath - the manifest, or "-" for stdin
+ * @param forcedAlg - the only algorithm to accept (from -a), or -1
+ * @param jobs - the number of worker processes
+ * @param failFast - whether to stop at the first mismatch or unreadable file
+ * @return 0 if every entry matched, 1 otherwise
+ */
+int runCheck(const std::string& manifestPath, int forcedAlg, long jobs, bool failFast);
+
+#endif
@@ -0,0 +1,20 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <time.h>
+
+/**
+ * @return the monotonic clock in seconds
+ */
+inline double monotonicNow() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
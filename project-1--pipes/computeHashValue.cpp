@@ -10,6 +10,30 @@ Email: gaubert.santiago@csu.fullerton.edu
 #include <unistd.h>
 #include <sys/wait.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <vector>
+
+#include "../common/procspawn.h"
+#include "batch.h"
+#include "benchdata.h"
+#include "cdc.h"
+#include "check.h"
+#include "clock.h"
+#include "digest.h"
+#include "digestcache.h"
+#include "dirmanifest.h"
+#include "frame.h"
+#include "multibuffer.h"
+#include "pipelinebench.h"
+#include "readengine.h"
+#include "treehash.h"
+#include "workerpool.h"
 
 using namespace std;
 
@@ -28,17 +52,148 @@ int childToParentPipe[2];
 /* The maximum size of the array of hash programs */
 #define HASH_PROG_ARRAY_SIZE 6
 
-/* The maximum length of the hash value */
-#define HASH_VALUE_LENGTH 1000
-
-/* The maximum length of the file name */
-#define MAX_FILE_NAME_LENGTH 1000
+/* The size of the chunks read from a hash program or a child's pipe */
+#define READ_CHUNK_LENGTH 4096
 
 /* The array of names of hash programs */
 const string hashProgs[] = {"md5sum", "sha1sum", "sha224sum", "sha256sum", "sha384sum", "sha512sum"};
 
 string fileName;
 
+/* The algorithms to compute, in output order; the first six index hashProgs[] too */
+vector<int> selectedAlgs;
+
+/* Whether to hash in-process (one read pass) instead of forking the *sum programs */
+bool useBuiltin = false;
+
+/* The maximum number of hash children running at once; 0 keeps the serial fork/wait loop */
+long maxJobs = 0;
+
+/* Whether the children hash a shared read-only mapping instead of running the *sum programs */
+bool useZeroCopy = false;
+
+/* The file mapped once by the parent in zero-copy mode, inherited by every child */
+const unsigned char* mappedFile = NULL;
+
+/* The length of mappedFile */
+size_t mappedFileLength = 0;
+
+/* Whether to compute chunk-parallel Merkle roots instead of flat digests */
+bool useTree = false;
+
+/* The chunk size of the tree mode */
+size_t treeChunkSize = DEFAULT_TREE_CHUNK_SIZE;
+
+/* Where the tree mode writes its chunk manifest, if anywhere */
+string treeManifestPath;
+
+/* The tree manifest to check the file against, if any */
+string verifyManifestPath;
+
+/* The chunks to check, e.g. "0,7-9"; empty checks them all */
+string verifyChunkList;
+
+/* The digest cache file; empty disables the cache */
+string cachePath;
+
+/* Whether to print the cache counters */
+bool showCacheStats = false;
+
+/* The number of entries --cache-compact keeps (0: half the slots); -1 if not requested */
+long cacheCompactKeep = -1;
+
+/* Identifiers of the options that only have a long form */
+enum {
+	OPT_CHUNK_SIZE = 256,
+	OPT_MANIFEST,
+	OPT_VERIFY,
+	OPT_CHUNKS,
+	OPT_CACHE,
+	OPT_CACHE_STATS,
+	OPT_CACHE_COMPACT,
+	OPT_SIMD,
+	OPT_BENCH_ALGOS,
+	OPT_TEE,
+	OPT_IO_ENGINE,
+	OPT_BENCH_IO,
+	OPT_CHECK,
+	OPT_FAIL_FAST,
+	OPT_CDC,
+	OPT_CHUNK_INDEX,
+	OPT_TRANSPORT,
+	OPT_BENCH_TRANSPORT,
+	OPT_WATCH,
+	OPT_QUERY,
+	OPT_BENCH_PIPELINE
+};
+
+/* Whether to measure the throughput of the digest code instead of hashing files */
+bool benchAlgorithms = false;
+
+/* Whether the streaming mode copies its input to stdout (the hash values then go to stderr) */
+bool teeOutput = false;
+
+/* The checksum manifest to verify, if any */
+string checkManifestPath;
+
+/* Whether --check stops at the first mismatch */
+bool failFast = false;
+
+/* How batch mode reads the files */
+ReadEngine readEngine = READ_ENGINE_WORKERS;
+
+/* Whether to time the read engines instead of hashing files */
+bool benchIo = false;
+
+/* The tree --bench-io reads; empty for a synthetic one */
+string benchIoDir;
+
+/* The directory whose Merkle manifest the daemon maintains, if any */
+string watchDir;
+
+/* The directory manifest to query, if any */
+string queryManifestPath;
+
+/* Whether to time the worker transports instead of hashing files */
+bool benchTransport = false;
+
+/* Whether to time every stage and mode of the pipeline instead of hashing files */
+bool benchPipelineRun = false;
+
+/* Where --bench-pipeline creates its data sets; empty for a temporary directory */
+string benchPipelineDir;
+
+/* Whether to chunk the files by content and report the duplicate chunks */
+bool useCdc = false;
+
+/* The chunk size bounds of --cdc */
+size_t cdcMinSize = DEFAULT_CDC_MIN_SIZE;
+size_t cdcAvgSize = DEFAULT_CDC_AVG_SIZE;
+size_t cdcMaxSize = DEFAULT_CDC_MAX_SIZE;
+
+/* Where --cdc writes its chunk index, if anywhere */
+string chunkIndexPath;
+
+/* Whether batch mode descends into directories */
+bool recursive = false;
+
+/* Whether batch mode reads a NUL-separated list of paths from stdin */
+bool readPathsFromStdin = false;
+
+/* The parent's view of one hash child started by fanOutHash() */
+struct HashChild {
+	/* The algorithm; an index into hashProgs[] unless the child hashes in-process */
+	int hashAlgNum;
+	/* The process id, or 0 while not started / after it was reaped */
+	pid_t pid;
+	/* The read end of the child's childToParentPipe */
+	int resultFd;
+	/* The framed bytes received so far */
+	string received;
+	/* Set once the child closed its end of the pipe */
+	bool done;
+};
+
 /**
  * The function called by a child
  * @param hashProgName - the name of the hash program
@@ -51,9 +206,7 @@ void computeHash(const string& hashProgName) {
 	   ---------------------- */
 
 	/* The received file name string */
-	char fileNameRecv[MAX_FILE_NAME_LENGTH];
-	/* Fill the buffer with 0's */
-	memset(fileNameRecv, (char)NULL, MAX_FILE_NAME_LENGTH);
+	string fileNameRecv;
 
 	/* Close the unused end */
 	if (close(parentToChildPipe[WRITE_END]) < 0) {
@@ -61,7 +214,7 @@ void computeHash(const string& hashProgName) {
 		exit(-1);
 	}
 	/* Read the file name sent by the parent */
-	if (read(parentToChildPipe[READ_END], fileNameRecv, sizeof(fileNameRecv)) < 0) {
+	if (readFrame(parentToChildPipe[READ_END], fileNameRecv) <= 0) {
 		perror("Child failed to read from pipe.");
 		exit(-1);
 	}
@@ -75,30 +228,34 @@ void computeHash(const string& hashProgName) {
 	   Child-grandchild communication
 	   ------------------------------ */
 
-	/* The hash value buffer */
-	char hashValue[HASH_VALUE_LENGTH];
-	/* Reset the value buffer */
-	memset(hashValue, (char)NULL, HASH_VALUE_LENGTH);
+	/* The hash value, however long the program's output is */
+	string hashValue;
 
-	/* Create command line, e.g. sha512sum <filename>. */
-	string cmdLine(hashProgName);
-	cmdLine += " ";
-	cmdLine += fileNameRecv;	
-	
-    /* Open the pipe to the program (specified in cmdLine) 
-	   using popen() and save the output into hashValue. 
-	   See popen.cpp for examples using popen. */
-	FILE* streamPointer = popen(cmdLine.c_str(), "r");
-	if (!streamPointer) {
-		perror("Failed to create stream.");
+	/* The argument vector, e.g. sha512sum -- <filename>; no shell parses the
+	   name, and "--" keeps a name starting with '-' from being an option */
+	char* argv[] = {(char*)hashProgName.c_str(), (char*)"--", (char*)fileNameRecv.c_str(), NULL};
+
+	/* Spawn the program with its stdout on a pipe and save the output into hashValue */
+	int outputFd;
+	pid_t grandchild = spawnReader(argv[0], argv, &outputFd);
+	if (grandchild < 0) {
+		perror("Failed to spawn the hash program.");
 		exit(-1);
 	}
-	if (fread(hashValue, sizeof(char), sizeof(char) * HASH_VALUE_LENGTH, streamPointer) < 0) {
-		perror("Child failed to read message from the grandchild.");
-		exit(-1);
+	char chunk[READ_CHUNK_LENGTH];
+	ssize_t got;
+	while ((got = read(outputFd, chunk, sizeof(chunk))) != 0) {
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got < 0) {
+			perror("Child failed to read message from the grandchild.");
+			exit(-1);
+		}
+		hashValue.append(chunk, got);
 	}
-	if (pclose(streamPointer) < 0) {
-		perror("Failed to close stream.");
+	close(outputFd);
+	if (waitProcess(grandchild, NULL) < 0) {
+		perror("Failed to wait for the hash program.");
 		exit(-1);
 	}
 
@@ -112,7 +269,7 @@ void computeHash(const string& hashProgName) {
 		exit(-1);
 	}	
 	/* Send the hash value to the parent */
-	if (write(childToParentPipe[WRITE_END], &hashValue, sizeof(hashValue)) < 0) {
+	if (!writeFrame(childToParentPipe[WRITE_END], hashValue)) {
 		perror("Child failed to write to pipe.");
 		exit(-1);
 	}
@@ -139,7 +296,7 @@ void parentFunc(const string& hashProgName) {
 		exit(-1);
 	}
 	/* Send the file name to the child */
-	if (write(parentToChildPipe[WRITE_END], fileName.c_str(), sizeof(fileName)) < 0) {
+	if (!writeFrame(parentToChildPipe[WRITE_END], fileName)) {
 		perror("Parent failed to write to pipe.");
 		exit(-1);
 	}
@@ -153,10 +310,8 @@ void parentFunc(const string& hashProgName) {
 	   Parent read from child 
 	   ---------------------- */
 
-	/* The buffer to hold the string received from the child */
-	char hashValue[HASH_VALUE_LENGTH];
-	/* Reset the hash buffer */
-	memset(hashValue, (char)NULL, HASH_VALUE_LENGTH);
+	/* The string received from the child */
+	string hashValue;
 
 	/* Close the unused end */
 	if (close(childToParentPipe[WRITE_END]) < 0) {
@@ -164,7 +319,7 @@ void parentFunc(const string& hashProgName) {
 		exit(-1);
 	}
 	/* Read the hash value sent by the child */
-	if (read(childToParentPipe[READ_END], hashValue, sizeof(hashValue)) < 0) {
+	if (readFrame(childToParentPipe[READ_END], hashValue) <= 0) {
 		perror("Parent failed to read from pipe.");
 		exit(-1);
 	}
@@ -175,24 +330,942 @@ void parentFunc(const string& hashProgName) {
 	}
 
 	/* Print the hash value */
-	fprintf(stdout, "%s hash value: %s\n", hashProgName.c_str(), hashValue);
+	fprintf(stdout, "%s hash value: %s\n", hashProgName.c_str(), hashValue.c_str());
+	fflush(stdout);
+}
+
+/**
+ * The function called by a child in zero-copy mode: digests the parent's
+ * mapping of the file directly, so the file is neither reopened nor copied
+ * @param hashAlgNum - the index into hashProgs[]
+ */
+void hashMappedFile(int hashAlgNum) {
+	/* Child */
+
+	/* Take the file name from the parent like computeHash() does; it labels the result */
+	string fileNameRecv;
+	if (close(parentToChildPipe[WRITE_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+	if (readFrame(parentToChildPipe[READ_END], fileNameRecv) <= 0) {
+		perror("Child failed to read from pipe.");
+		exit(-1);
+	}
+	if (close(parentToChildPipe[READ_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+
+	Digest* digest = createDigest(hashAlgNum);
+	digest->update(mappedFile, mappedFileLength);
+	string hashValue = formatSumLine(digest->hexDigest(), fileNameRecv);
+	delete digest;
+
+	if (close(childToParentPipe[READ_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+	if (!writeFrame(childToParentPipe[WRITE_END], hashValue)) {
+		perror("Child failed to write to pipe.");
+		exit(-1);
+	}
+	if (close(childToParentPipe[WRITE_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+
+	/* The child terminates */
+	exit(0);
+}
+
+/**
+ * Forks a hash child for one algorithm and sends it the file name
+ * @param child - the child to start; its pid and resultFd are filled in
+ * @param children - every child, so the new process can close inherited pipe ends
+ */
+void startHashChild(HashChild& child, vector<HashChild>& children) {
+	/* Create two pipes */
+	if (pipe(parentToChildPipe) < 0) {
+		perror("Failed to create pipe.");
+		exit(-1);
+	}
+	if (pipe(childToParentPipe) < 0) {
+		perror("Failed to create pipe.");
+		exit(-1);
+	}
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("Failed to fork process.");
+		exit(-1);
+	} else if (pid == 0) {
+		/* Child */
+		/* Drop the result pipes of the siblings that are still running */
+		for (size_t i = 0; i < children.size(); ++i) {
+			if (children[i].pid > 0 && !children[i].done)
+				close(children[i].resultFd);
+		}
+		if (useZeroCopy)
+			hashMappedFile(child.hashAlgNum);
+		computeHash(hashProgs[child.hashAlgNum]);
+	}
+
+	/* Parent */
+	child.pid = pid;
+	child.resultFd = childToParentPipe[READ_END];
+	if (close(parentToChildPipe[READ_END]) < 0 || close(childToParentPipe[WRITE_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+	/* Send the file name to the child */
+	if (!writeFrame(parentToChildPipe[WRITE_END], fileName)) {
+		perror("Parent failed to write to pipe.");
+		exit(-1);
+	}
+	if (close(parentToChildPipe[WRITE_END]) < 0) {
+		perror("Unable to close pipe end.");
+		exit(-1);
+	}
+}
+
+/**
+ * Runs the selected hash programs (or, in zero-copy mode, in-process digests
+ * of the shared mapping) concurrently, at most maxJobs at a time,
+ * multiplexing their result pipes with poll(). Results are printed in the
+ * order of selectedAlgs as soon as every earlier one is available.
+ */
+void fanOutHash() {
+	vector<HashChild> children(selectedAlgs.size());
+	for (size_t i = 0; i < children.size(); ++i) {
+		children[i].hashAlgNum = selectedAlgs[i];
+		children[i].pid = 0;
+		children[i].resultFd = -1;
+		children[i].done = false;
+	}
+
+	/* The next child to start, the next result to print, and the number running */
+	size_t nextToStart = 0, nextToPrint = 0;
+	long running = 0;
+	vector<struct pollfd> pollFds;
+	vector<size_t> pollOwners;
+
+	while (nextToPrint < children.size()) {
+		/* Fill every free slot */
+		while (running < maxJobs && nextToStart < children.size()) {
+			startHashChild(children[nextToStart++], children);
+			++running;
+		}
+
+		/* Wait for any running child to report */
+		pollFds.clear();
+		pollOwners.clear();
+		for (size_t i = 0; i < nextToStart; ++i) {
+			if (!children[i].done) {
+				struct pollfd pfd = {children[i].resultFd, POLLIN, 0};
+				pollFds.push_back(pfd);
+				pollOwners.push_back(i);
+			}
+		}
+		if (!pollFds.empty() && poll(&pollFds[0], pollFds.size(), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed to poll pipes.");
+			exit(-1);
+		}
+
+		for (size_t k = 0; k < pollFds.size(); ++k) {
+			if (!(pollFds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+				continue;
+			HashChild& child = children[pollOwners[k]];
+			char buffer[READ_CHUNK_LENGTH];
+			ssize_t got = read(child.resultFd, buffer, sizeof(buffer));
+			if (got < 0) {
+				if (errno == EINTR)
+					continue;
+				perror("Parent failed to read from pipe.");
+				exit(-1);
+			}
+			if (got > 0) {
+				child.received.append(buffer, got);
+				continue;
+			}
+			/* End of file: the child is finished */
+			if (close(child.resultFd) < 0) {
+				perror("Unable to close pipe end.");
+				exit(-1);
+			}
+			if (waitpid(child.pid, NULL, 0) < 0) {
+				perror("Error occurred while waiting for a child to terminate.");
+				exit(-1);
+			}
+			child.done = true;
+			--running;
+		}
+
+		/* Print the finished prefix in the fixed order */
+		while (nextToPrint < children.size() && children[nextToPrint].done) {
+			HashChild& child = children[nextToPrint++];
+			string hashValue;
+			if (!extractFrame(child.received, hashValue)) {
+				fprintf(stderr, "Truncated message from the %s child.\n", hashAlgs[child.hashAlgNum].progName);
+				exit(-1);
+			}
+			fprintf(stdout, "%s hash value: %s\n", hashAlgs[child.hashAlgNum].progName, hashValue.c_str());
+		}
+		fflush(stdout);
+	}
+}
+
+/**
+ * Opens and maps the file once, then fans out one digest child per
+ * algorithm over the shared read-only mapping
+ */
+void zeroCopyHash() {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	struct stat info;
+	int error = 0;
+	if (fd < 0 || fstat(fd, &info) < 0)
+		error = errno;
+	else if (!S_ISREG(info.st_mode))
+		/* Streams went to streamHash(); what is left and not regular cannot be mapped */
+		error = S_ISDIR(info.st_mode) ? EISDIR : ENODEV;
+	if (error) {
+		/* Mirror the *sum programs: an error goes to stderr and the hash value is empty */
+		if (fd >= 0)
+			close(fd);
+		for (size_t i = 0; i < selectedAlgs.size(); ++i) {
+			const char* progName = hashAlgs[selectedAlgs[i]].progName;
+			fprintf(stderr, "%s: %s: %s\n", progName, fileName.c_str(), strerror(error));
+			fprintf(stdout, "%s hash value: \n", progName);
+		}
+		fflush(stdout);
+		return;
+	}
+
+	/* mmap() rejects empty mappings; an empty file hashes from a NULL, 0-length buffer */
+	mappedFileLength = info.st_size;
+	if (mappedFileLength > 0) {
+		void* mapping = mmap(NULL, mappedFileLength, PROT_READ, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED) {
+			perror("Failed to map the file.");
+			exit(-1);
+		}
+		/* Every child walks the file front to back; start the read-ahead now */
+		madvise(mapping, mappedFileLength, MADV_SEQUENTIAL);
+		madvise(mapping, mappedFileLength, MADV_WILLNEED);
+		mappedFile = (const unsigned char*)mapping;
+	}
+	close(fd);
+
+	/* Without a cap every algorithm runs at once */
+	if (maxJobs == 0)
+		maxJobs = selectedAlgs.size();
+	fanOutHash();
+
+	if (mappedFile)
+		munmap((void*)mappedFile, mappedFileLength);
+}
+
+/**
+ * @return the number of threads for the tree mode: -j, or one per online CPU
+ */
+size_t treeThreads() {
+	long threads = maxJobs > 0 ? maxJobs : sysconf(_SC_NPROCESSORS_ONLN);
+	return threads > 0 ? threads : 1;
+}
+
+/**
+ * Opens the file for the tree mode
+ * @param fileSize - receives the size of the file
+ * @return the descriptor; exits on an error
+ */
+int openTreeFile(long long& fileSize) {
+	int fd = open(fileName.c_str(), O_RDONLY);
+	struct stat info;
+	if (fd < 0 || fstat(fd, &info) < 0) {
+		fprintf(stderr, "%s: %s\n", fileName.c_str(), strerror(errno));
+		exit(-1);
+	}
+	fileSize = info.st_size;
+	return fd;
+}
+
+/**
+ * Prints the Merkle root of every selected algorithm and, if requested,
+ * writes the chunk manifest (see treehash.h for the format)
+ */
+void treeHash() {
+	if (!treeManifestPath.empty() && selectedAlgs.size() != 1) {
+		fprintf(stderr, "--manifest needs exactly one algorithm (-a).\n");
+		exit(-1);
+	}
+
+	long long fileSize;
+	int fd = openTreeFile(fileSize);
+	vector< vector<string> > leaves;
+	if (!hashTreeChunks(fd, fileSize, treeChunkSize, selectedAlgs, treeThreads(), NULL, leaves)) {
+		fprintf(stderr, "%s: %s\n", fileName.c_str(), strerror(errno));
+		exit(-1);
+	}
+	close(fd);
+
+	for (size_t a = 0; a < selectedAlgs.size(); ++a) {
+		string root = merkleRoot(selectedAlgs[a], leaves[a]);
+		string rootHex = toHex((const unsigned char*)root.data(), root.size());
+		fprintf(stdout, "%s tree hash value: %s\n", hashAlgs[selectedAlgs[a]].progName,
+		        formatSumLine(rootHex, fileName).c_str());
+
+		if (!treeManifestPath.empty()) {
+			TreeManifest manifest;
+			manifest.alg = selectedAlgs[a];
+			manifest.chunkSize = treeChunkSize;
+			manifest.fileSize = fileSize;
+			manifest.root = rootHex;
+			for (size_t i = 0; i < leaves[a].size(); ++i)
+				manifest.leaves.push_back(toHex((const unsigned char*)leaves[a][i].data(), leaves[a][i].size()));
+			FILE* out = fopen(treeManifestPath.c_str(), "w");
+			if (!out || !writeTreeManifest(out, manifest) || fclose(out) != 0) {
+				perror("Failed to write the tree manifest.");
+				exit(-1);
+			}
+		}
+	}
+	fflush(stdout);
+}
+
+/**
+ * Re-checks the chunks of the file against a tree manifest
+ * @return 0 if every checked chunk (and, when all were checked, the root) matches
+ */
+int verifyTree() {
+	TreeManifest manifest;
+	if (!readTreeManifest(verifyManifestPath, manifest))
+		return 1;
+
+	long long fileSize;
+	int fd = openTreeFile(fileSize);
+	if (fileSize != manifest.fileSize) {
+		fprintf(stdout, "%s: size %lld does not match the manifest (%lld): FAILED\n", fileName.c_str(), fileSize,
+		        manifest.fileSize);
+		close(fd);
+		return 1;
+	}
+
+	vector<size_t> chunks;
+	if (!verifyChunkList.empty() && !parseChunkList(verifyChunkList, manifest.leaves.size(), chunks)) {
+		fprintf(stderr, "Invalid chunk list: %s\n", verifyChunkList.c_str());
+		exit(-1);
+	}
+	vector<int> algs(1, manifest.alg);
+	vector< vector<string> > leaves;
+	if (!hashTreeChunks(fd, fileSize, manifest.chunkSize, algs, treeThreads(), chunks.empty() ? NULL : &chunks, leaves)) {
+		fprintf(stderr, "%s: %s\n", fileName.c_str(), strerror(errno));
+		exit(-1);
+	}
+	close(fd);
+
+	size_t checked = 0, failed = 0;
+	for (size_t i = 0; i < leaves[0].size(); ++i) {
+		if (leaves[0][i].empty())
+			continue;
+		++checked;
+		string leafHex = toHex((const unsigned char*)leaves[0][i].data(), leaves[0][i].size());
+		if (leafHex != manifest.leaves[i]) {
+			long long offset = (long long)i * manifest.chunkSize;
+			long long length = min((long long)manifest.chunkSize, fileSize - offset);
+			fprintf(stdout, "chunk %zu (offset %lld, %lld bytes): FAILED\n", i, offset, length < 0 ? 0 : length);
+			++failed;
+		}
+	}
+
+	/* The root only means something when every chunk was rehashed */
+	bool rootOk = true;
+	if (chunks.empty()) {
+		string root = merkleRoot(manifest.alg, leaves[0]);
+		rootOk = toHex((const unsigned char*)root.data(), root.size()) == manifest.root;
+	}
+	fprintf(stdout, "%s: %zu of %zu chunk(s) OK%s\n", fileName.c_str(), checked - failed, checked,
+	        chunks.empty() ? (rootOk ? ", root OK" : ", root FAILED") : "");
+	fflush(stdout);
+	return failed || !rootOk ? 1 : 0;
+}
+
+/**
+ * Prints the command line syntax
+ * @param progName - argv[0]
+ */
+void printUsage(const char* progName) {
+	fprintf(stderr, "Usage: %s [-b | -z] [-j <jobs>] [-a <algorithms>] <filename>\n", progName);
+	fprintf(stderr, "       %s [-j <jobs>] [-a <algorithms>] [-r] [-0] <path>...\n", progName);
+	fprintf(stderr, "       %s -t [--chunk-size N] [--manifest FILE] [-j <threads>] [-a <algorithms>] <filename>\n", progName);
+	fprintf(stderr, "       %s --verify MANIFEST [--chunks LIST] [-j <threads>] <filename>\n", progName);
+	fprintf(stderr, "       %s --check MANIFEST [--fail-fast] [-j <jobs>] [-a <algorithm>]\n", progName);
+	fprintf(stderr, "       %s --cache FILE [--cache-stats] [--cache-compact[=N]]\n", progName);
+	fprintf(stderr, "       %s [--tee] [-a <algorithms>] - | <fifo>\n", progName);
+	fprintf(stderr, "       %s --cdc[=MIN,AVG,MAX] [--chunk-index FILE] [-a <algorithm>] [-r] [-0] <path>...\n", progName);
+	fprintf(stderr, "       %s --bench-algos [-a <algorithms>]\n", progName);
+	fprintf(stderr, "       %s --bench-io[=DIR] [-j <threads>] [-a <algorithms>]\n", progName);
+	fprintf(stderr, "       %s --bench-transport\n", progName);
+	fprintf(stderr, "       %s --bench-pipeline[=DIR]\n", progName);
+	fprintf(stderr, "       %s --watch DIR --manifest FILE [-j <threads>] [-a <algorithm>]\n", progName);
+	fprintf(stderr, "       %s --query FILE [<path>...]\n", progName);
+	fprintf(stderr, "  -a, --algorithms LIST  comma-separated subset of md5,sha1,sha224,sha256,sha384,sha512\n");
+	fprintf(stderr, "                         and the checksums crc32c,xxh64 (default and \"all\": the six digests)\n");
+	fprintf(stderr, "  -b, --builtin          compute every digest in-process from a single read of the file\n");
+	fprintf(stderr, "  -z, --zero-copy        map the file once and digest it in one child per algorithm\n");
+	fprintf(stderr, "  -j, --jobs N           run up to N hash programs concurrently (0 = one per online CPU)\n");
+	fprintf(stderr, "  -r, --recursive        hash every file below the given directories (batch mode)\n");
+	fprintf(stderr, "  -0, --null             read NUL-separated paths from stdin, e.g. from find -print0 (batch mode)\n");
+	fprintf(stderr, "  -t, --tree             print a Merkle root over chunks hashed in parallel (default: sha256)\n");
+	fprintf(stderr, "      --chunk-size N     the tree chunk size, optionally with a K, M or G suffix (default: 4M)\n");
+	fprintf(stderr, "      --manifest FILE    write the chunk digests of the tree to FILE (-t), or the directory\n");
+	fprintf(stderr, "                         manifest maintained by --watch\n");
+	fprintf(stderr, "      --verify MANIFEST  re-check the file's chunks against a tree manifest\n");
+	fprintf(stderr, "      --chunks LIST      only re-check these chunks, e.g. 0,7-9\n");
+	fprintf(stderr, "      --check MANIFEST   verify the files listed in a sha256sum-style (or --tag, or batch mode)\n");
+	fprintf(stderr, "                         manifest, \"-\" for stdin; the digest length or tag picks the algorithm\n");
+	fprintf(stderr, "      --fail-fast        stop checking at the first mismatch or unreadable file\n");
+	fprintf(stderr, "      --cdc[=MIN,AVG,MAX] split files into content-defined chunks and report how many are\n");
+	fprintf(stderr, "                         duplicates (default: 2K,8K,64K; AVG is rounded to a power of two)\n");
+	fprintf(stderr, "      --chunk-index FILE write the offset, length and fingerprint of every chunk to FILE\n");
+	fprintf(stderr, "      --cache FILE       reuse digests keyed by device, inode, size and mtime (-b and batch mode)\n");
+	fprintf(stderr, "      --cache-stats      print the entry count and hit/miss counters of the cache\n");
+	fprintf(stderr, "      --cache-compact[=N] keep only the N most recently used entries (default: half the slots)\n");
+	fprintf(stderr, "      --simd LEVEL       cap the multi-buffer kernels at scalar, sse2, avx2 or avx512 (default: auto);\n");
+	fprintf(stderr, "                         scalar also turns off the SHA-NI and SSE4.2 CRC32C code\n");
+	fprintf(stderr, "      --tee              copy the hashed data to stdout and print the hash values on stderr\n");
+	fprintf(stderr, "      --bench-algos      print the in-process throughput of each algorithm in GB/s\n");
+	fprintf(stderr, "      --io-engine NAME   how batch mode reads files: workers (forked processes, default),\n");
+	fprintf(stderr, "                         uring (io_uring, falls back to pread) or pread (threads); -j sets\n");
+	fprintf(stderr, "                         the digest threads of uring and pread, which ignore --cache\n");
+	fprintf(stderr, "      --bench-io[=DIR]   time the uring and pread engines on DIR or on a synthetic tree\n");
+	fprintf(stderr, "      --transport NAME   how batch mode and --check talk to their workers: pipe (default)\n");
+	fprintf(stderr, "                         or shm (shared-memory rings with futex wake-ups)\n");
+	fprintf(stderr, "      --bench-transport  time both transports with messages of 64 B to 1 MB\n");
+	fprintf(stderr, "      --bench-pipeline[=DIR] time each stage and hashing mode on synthetic small and large\n");
+	fprintf(stderr, "                         files (in DIR, kept, or a temporary directory) and print JSON\n");
+	fprintf(stderr, "      --watch DIR        hash the tree below DIR into a Merkle manifest, then keep it current\n");
+	fprintf(stderr, "                         by rehashing only what inotify reports as changed (until SIGTERM)\n");
+	fprintf(stderr, "      --query FILE       print the digests of paths (default: the root) from a directory\n");
+	fprintf(stderr, "                         manifest, read directly from the mapped file\n");
+	fprintf(stderr, "Batch mode (several paths, -r or -0) prints <algorithm>\\t<digest>\\t<path> lines\n");
+	fprintf(stderr, "and a throughput summary on stderr. Small files are hashed several at a time with\n");
+	fprintf(stderr, "multi-buffer SIMD kernels for md5, sha224 and sha256.\n");
+	fprintf(stderr, "crc32c and xxh64 have no *sum program, so they are always computed in-process.\n");
+	fprintf(stderr, "\"-\" (stdin), a FIFO or a device is read once and hashed as the data arrives.\n");
+}
+
+/**
+ * Computes all selected digests in-process, reading the file only once
+ * (or not at all when --cache already knows every digest)
+ */
+void builtinHash() {
+	vector<string> hexDigests;
+	int fd = open(fileName.c_str(), O_RDONLY);
+	long long bytesRead = fd < 0 ? -1 : hashFdCached(fd, selectedAlgs, hexDigests);
+	int savedErrno = errno;
+	if (fd >= 0)
+		close(fd);
+
+	for (size_t i = 0; i < selectedAlgs.size(); ++i) {
+		const char* progName = hashAlgs[selectedAlgs[i]].progName;
+		/* Mirror the *sum programs: an error goes to stderr and the hash value is empty */
+		if (bytesRead < 0) {
+			fprintf(stderr, "%s: %s: %s\n", progName, fileName.c_str(), strerror(savedErrno));
+			fprintf(stdout, "%s hash value: \n", progName);
+		} else {
+			fprintf(stdout, "%s hash value: %s\n", progName, formatSumLine(hexDigests[i], fileName).c_str());
+		}
+	}
 	fflush(stdout);
 }
 
+/**
+ * @return whether the file can only be read once (stdin, a FIFO, a socket or
+ *         a character device), so that every digest must come from one pass
+ */
+bool isStream(const string& path) {
+	struct stat info;
+	return path == "-" || (stat(path.c_str(), &info) == 0 && !S_ISREG(info.st_mode) && !S_ISDIR(info.st_mode));
+}
+
+/**
+ * Hashes stdin ("-") or a FIFO as the data arrives, updating every selected
+ * digest from one block-sized buffer, optionally passing the data through
+ * to stdout
+ * @return the exit status
+ */
+int streamHash() {
+	int fd = fileName == "-" ? STDIN_FILENO : open(fileName.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		/* Bigger pipe buffers mean fewer wakeups per block; failure is harmless */
+		struct stat info;
+		if (fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode))
+			fcntl(fd, F_SETPIPE_SZ, HASH_READ_BLOCK_SIZE);
+		if (teeOutput && fstat(STDOUT_FILENO, &info) == 0 && S_ISFIFO(info.st_mode))
+			fcntl(STDOUT_FILENO, F_SETPIPE_SZ, HASH_READ_BLOCK_SIZE);
+	}
+
+	vector<Digest*> digests;
+	for (size_t i = 0; i < selectedAlgs.size(); ++i)
+		digests.push_back(createDigest(selectedAlgs[i]));
+	long long bytesRead = fd < 0 ? -1 : hashFd(fd, digests, teeOutput ? STDOUT_FILENO : -1);
+	int savedErrno = errno;
+	if (fd > STDIN_FILENO)
+		close(fd);
+
+	if (bytesRead == -2) {
+		fprintf(stderr, "--tee: write error: %s\n", strerror(savedErrno));
+		for (size_t i = 0; i < digests.size(); ++i)
+			delete digests[i];
+		return 1;
+	}
+
+	/* With --tee, stdout carries the data */
+	FILE* out = teeOutput ? stderr : stdout;
+	for (size_t i = 0; i < selectedAlgs.size(); ++i) {
+		const char* progName = hashAlgs[selectedAlgs[i]].progName;
+		/* Mirror the *sum programs: an error goes to stderr and the hash value is empty */
+		if (bytesRead < 0) {
+			fprintf(stderr, "%s: %s: %s\n", progName, fileName.c_str(), strerror(savedErrno));
+			fprintf(out, "%s hash value: \n", progName);
+		} else {
+			fprintf(out, "%s hash value: %s\n", progName,
+			        formatSumLine(digests[i]->hexDigest(), fileName).c_str());
+		}
+		delete digests[i];
+	}
+	fflush(out);
+	return bytesRead < 0 ? 1 : 0;
+}
+
+/**
+ * Parses a byte count with an optional K, M or G suffix
+ * @param text - e.g. "64K"
+ * @param size - receives the count
+ * @return false if the text is not a positive count
+ */
+static bool parseSize(const char* text, size_t& size) {
+	char* end;
+	unsigned long long value = strtoull(text, &end, 10);
+	if (end == text)
+		return false;
+	switch (*end) {
+	case 'G': case 'g':
+		value <<= 10;
+		/* fall through */
+	case 'M': case 'm':
+		value <<= 10;
+		/* fall through */
+	case 'K': case 'k':
+		value <<= 10;
+		++end;
+	}
+	if (*end || value == 0)
+		return false;
+	size = value;
+	return true;
+}
+
+/**
+ * Parses the MIN,AVG,MAX argument of --cdc
+ * @return false if it is malformed
+ */
+static bool parseCdcSizes(const char* text) {
+	string sizes = text;
+	size_t firstComma = sizes.find(',');
+	size_t secondComma = firstComma == string::npos ? string::npos : sizes.find(',', firstComma + 1);
+	if (secondComma == string::npos)
+		return false;
+	return parseSize(sizes.substr(0, firstComma).c_str(), cdcMinSize) &&
+	       parseSize(sizes.substr(firstComma + 1, secondComma - firstComma - 1).c_str(), cdcAvgSize) &&
+	       parseSize(sizes.substr(secondComma + 1).c_str(), cdcMaxSize);
+}
+
+/**
+ * Runs --bench-algos: hashes an in-memory buffer with each algorithm for
+ * about half a second and prints the throughput
+ * @param algs - the algorithms to measure
+ */
+void benchAlgos(const vector<int>& algs) {
+	/* Pseudo-random bytes, so no algorithm gets an easy input */
+	vector<unsigned char> buffer(HASH_READ_BLOCK_SIZE * 16);
+	fillRandom(buffer, 0x9e3779b97f4a7c15ULL);
+
+	for (size_t i = 0; i < algs.size(); ++i) {
+		Digest* digest = createDigest(algs[i]);
+		unsigned char out[MAX_DIGEST_LENGTH];
+		/* One untimed pass warms the caches and the page tables */
+		digest->update(&buffer[0], buffer.size());
+		digest->final(out);
+
+		double startTime = monotonicNow();
+		double elapsed = 0;
+		size_t passes = 0;
+		while (elapsed < 0.5) {
+			digest->reset();
+			digest->update(&buffer[0], buffer.size());
+			digest->final(out);
+			++passes;
+			elapsed = monotonicNow() - startTime;
+		}
+		fprintf(stdout, "%-8s %-8s %8.2f GB/s\n", hashAlgs[algs[i]].name, digestImplementation(algs[i]),
+		        (double)passes * buffer.size() / elapsed / 1e9);
+		fflush(stdout);
+		delete digest;
+	}
+}
+
+/**
+ * Runs --cache-stats or --cache-compact on the cache file
+ * @return the exit status
+ */
+int maintainCache() {
+	DigestCache* cache = DigestCache::open(cachePath);
+	if (!cache)
+		return 1;
+
+	if (cacheCompactKeep >= 0) {
+		CacheStats before = cache->stats();
+		size_t keep = cacheCompactKeep > 0 ? cacheCompactKeep : before.slotCount / 2;
+		size_t evicted = cache->compact(keep);
+		fprintf(stdout, "Compacted %s: evicted %zu of %llu entries\n", cachePath.c_str(), evicted,
+		        (unsigned long long)before.entries);
+	}
+	if (showCacheStats) {
+		CacheStats stats = cache->stats();
+		uint64_t lookups = stats.hits + stats.misses;
+		fprintf(stdout, "entries %llu\nslots %llu\nhits %llu\nmisses %llu\nhit_ratio %.3f\nevictions %llu\n",
+		        (unsigned long long)stats.entries, (unsigned long long)stats.slotCount,
+		        (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+		        lookups ? (double)stats.hits / lookups : 0.0, (unsigned long long)stats.evictions);
+	}
+	delete cache;
+	return 0;
+}
+
 int main(int argc, char** argv) {
+	static const struct option longOptions[] = {
+		{"algorithms", required_argument, NULL, 'a'},
+		{"bench-algos", no_argument, NULL, OPT_BENCH_ALGOS},
+		{"bench-io", optional_argument, NULL, OPT_BENCH_IO},
+		{"bench-pipeline", optional_argument, NULL, OPT_BENCH_PIPELINE},
+		{"bench-transport", no_argument, NULL, OPT_BENCH_TRANSPORT},
+		{"builtin", no_argument, NULL, 'b'},
+		{"cache", required_argument, NULL, OPT_CACHE},
+		{"cache-compact", optional_argument, NULL, OPT_CACHE_COMPACT},
+		{"cache-stats", no_argument, NULL, OPT_CACHE_STATS},
+		{"cdc", optional_argument, NULL, OPT_CDC},
+		{"chunk-index", required_argument, NULL, OPT_CHUNK_INDEX},
+		{"chunk-size", required_argument, NULL, OPT_CHUNK_SIZE},
+		{"check", required_argument, NULL, OPT_CHECK},
+		{"chunks", required_argument, NULL, OPT_CHUNKS},
+		{"fail-fast", no_argument, NULL, OPT_FAIL_FAST},
+		{"help", no_argument, NULL, 'h'},
+		{"io-engine", required_argument, NULL, OPT_IO_ENGINE},
+		{"jobs", required_argument, NULL, 'j'},
+		{"manifest", required_argument, NULL, OPT_MANIFEST},
+		{"null", no_argument, NULL, '0'},
+		{"query", required_argument, NULL, OPT_QUERY},
+		{"recursive", no_argument, NULL, 'r'},
+		{"simd", required_argument, NULL, OPT_SIMD},
+		{"tee", no_argument, NULL, OPT_TEE},
+		{"transport", required_argument, NULL, OPT_TRANSPORT},
+		{"tree", no_argument, NULL, 't'},
+		{"verify", required_argument, NULL, OPT_VERIFY},
+		{"watch", required_argument, NULL, OPT_WATCH},
+		{"zero-copy", no_argument, NULL, 'z'},
+		{NULL, 0, NULL, 0}
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "0a:bhj:rtz", longOptions, NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			if (!parseHashAlgList(optarg, selectedAlgs)) {
+				fprintf(stderr, "Unknown hash algorithm in list: %s\n", optarg);
+				exit(-1);
+			}
+			break;
+		case 'b':
+			useBuiltin = true;
+			break;
+		case 'r':
+			recursive = true;
+			break;
+		case 'z':
+			useZeroCopy = true;
+			break;
+		case 't':
+			useTree = true;
+			break;
+		case OPT_CHUNK_SIZE:
+			if (!parseSize(optarg, treeChunkSize)) {
+				fprintf(stderr, "Invalid chunk size: %s\n", optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_MANIFEST:
+			treeManifestPath = optarg;
+			break;
+		case OPT_VERIFY:
+			verifyManifestPath = optarg;
+			break;
+		case OPT_CHUNKS:
+			verifyChunkList = optarg;
+			break;
+		case OPT_CACHE:
+			cachePath = optarg;
+			setDigestCachePath(cachePath);
+			break;
+		case OPT_SIMD: {
+			SimdLevel level;
+			if (!parseSimdLevel(optarg, level)) {
+				fprintf(stderr, "Unknown SIMD level: %s\n", optarg);
+				exit(-1);
+			}
+			setSimdLevel(level);
+			break;
+		}
+		case OPT_CACHE_STATS:
+			showCacheStats = true;
+			break;
+		case OPT_BENCH_ALGOS:
+			benchAlgorithms = true;
+			break;
+		case OPT_TEE:
+			teeOutput = true;
+			break;
+		case OPT_CHECK:
+			checkManifestPath = optarg;
+			break;
+		case OPT_FAIL_FAST:
+			failFast = true;
+			break;
+		case OPT_IO_ENGINE:
+			if (!parseReadEngine(optarg, readEngine)) {
+				fprintf(stderr, "Unknown read engine: %s\n", optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_WATCH:
+			watchDir = optarg;
+			break;
+		case OPT_QUERY:
+			queryManifestPath = optarg;
+			break;
+		case OPT_TRANSPORT: {
+			WorkerTransport transport;
+			if (!parseWorkerTransport(optarg, transport)) {
+				fprintf(stderr, "Unknown transport: %s\n", optarg);
+				exit(-1);
+			}
+			setWorkerTransport(transport);
+			break;
+		}
+		case OPT_BENCH_TRANSPORT:
+			benchTransport = true;
+			break;
+		case OPT_BENCH_PIPELINE:
+			benchPipelineRun = true;
+			benchPipelineDir = optarg ? optarg : "";
+			break;
+		case OPT_CDC:
+			useCdc = true;
+			if (optarg && !parseCdcSizes(optarg)) {
+				fprintf(stderr, "Invalid chunk sizes (MIN,AVG,MAX): %s\n", optarg);
+				exit(-1);
+			}
+			break;
+		case OPT_CHUNK_INDEX:
+			chunkIndexPath = optarg;
+			break;
+		case OPT_BENCH_IO:
+			benchIo = true;
+			benchIoDir = optarg ? optarg : "";
+			break;
+		case OPT_CACHE_COMPACT: {
+			char* end = NULL;
+			cacheCompactKeep = optarg ? strtol(optarg, &end, 10) : 0;
+			if ((end && *end) || cacheCompactKeep < 0) {
+				fprintf(stderr, "Invalid number of entries to keep: %s\n", optarg);
+				exit(-1);
+			}
+			break;
+		}
+		case '0':
+			readPathsFromStdin = true;
+			break;
+		case 'j': {
+			char* end;
+			maxJobs = strtol(optarg, &end, 10);
+			if (*end || maxJobs < 0) {
+				fprintf(stderr, "Invalid number of jobs: %s\n", optarg);
+				exit(-1);
+			}
+			/* 0 sizes the cap to the machine */
+			if (maxJobs == 0)
+				maxJobs = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+			break;
+		}
+		default:
+			printUsage(argv[0]);
+			exit(-1);
+		}
+	}
+
+	/* Cache maintenance runs on its own */
+	if (showCacheStats || cacheCompactKeep >= 0) {
+		if (cachePath.empty()) {
+			fprintf(stderr, "--cache-stats and --cache-compact need --cache FILE.\n");
+			exit(-1);
+		}
+		return maintainCache();
+	}
+
+	/* The benchmark covers every algorithm unless a subset was requested */
+	if (benchAlgorithms) {
+		if (selectedAlgs.empty()) {
+			for (int alg = 0; alg < ALG_COUNT; ++alg)
+				selectedAlgs.push_back(alg);
+		}
+		benchAlgos(selectedAlgs);
+		return 0;
+	}
+
+	if (benchTransport)
+		return benchTransports();
+
+	if (benchPipelineRun)
+		return benchPipeline(benchPipelineDir);
+
+	/* Queries only read the manifest; the operands are paths inside it */
+	if (!queryManifestPath.empty())
+		return runQuery(queryManifestPath, vector<string>(argv + optind, argv + argc));
+
+	/* The daemon keeps a directory manifest current until it is signalled */
+	if (!watchDir.empty()) {
+		if (treeManifestPath.empty() || selectedAlgs.size() > 1) {
+			fprintf(stderr, "--watch needs --manifest FILE and at most one algorithm (-a).\n");
+			exit(-1);
+		}
+		long threads = maxJobs > 0 ? maxJobs : sysconf(_SC_NPROCESSORS_ONLN);
+		/* The workers engine forks processes per request; the daemon hashes on threads */
+		ReadEngine engine = readEngine == READ_ENGINE_URING ? READ_ENGINE_URING : READ_ENGINE_PREAD;
+		return runWatchDaemon(watchDir, treeManifestPath, selectedAlgs.empty() ? ALG_SHA256 : selectedAlgs[0], engine,
+		                      threads > 0 ? threads : 1);
+	}
+
+	/* Verification reads its file list from the manifest */
+	if (!checkManifestPath.empty()) {
+		if (selectedAlgs.size() > 1) {
+			fprintf(stderr, "--check accepts at most one algorithm (-a).\n");
+			exit(-1);
+		}
+		long jobs = maxJobs > 0 ? maxJobs : sysconf(_SC_NPROCESSORS_ONLN);
+		return runCheck(checkManifestPath, selectedAlgs.empty() ? -1 : selectedAlgs[0], jobs > 0 ? jobs : 1, failFast);
+	}
+
+	if (benchIo) {
+		if (selectedAlgs.empty())
+			selectedAlgs.push_back(ALG_SHA256);
+		long jobs = maxJobs > 0 ? maxJobs : sysconf(_SC_NPROCESSORS_ONLN);
+		return benchReadEngines(benchIoDir, selectedAlgs, jobs > 0 ? jobs : 1);
+	}
+
 	/* Check for errors */
-	if (argc < 2) {
-		fprintf(stderr, "Usage: %s <filename>\n", argv[0]); 
+	if (optind >= argc && !readPathsFromStdin) {
+		printUsage(argv[0]);
 		exit(-1);
-	}	
-	
+	}
+
+	/* A tree and the chunk fingerprints default to a single SHA-256 */
+	if ((useTree || !verifyManifestPath.empty() || useCdc) && selectedAlgs.empty())
+		selectedAlgs.push_back(ALG_SHA256);
+	if (useCdc && selectedAlgs.size() > 1) {
+		fprintf(stderr, "--cdc fingerprints chunks with a single algorithm (-a).\n");
+		exit(-1);
+	}
+
+	/* Compute every algorithm unless a subset was requested */
+	if (selectedAlgs.empty()) {
+		for (int hashAlgNum = 0; hashAlgNum < HASH_PROG_ARRAY_SIZE; ++hashAlgNum)
+			selectedAlgs.push_back(hashAlgNum);
+	}
+
+	/* Chunking and batch mode take their files the same way */
+	if (useCdc || argc - optind > 1 || recursive || readPathsFromStdin) {
+		vector<BatchFile> files;
+		bool ok = true;
+		for (int i = optind; i < argc; ++i)
+			ok = collectBatchPath(argv[i], recursive, files) && ok;
+		if (readPathsFromStdin)
+			ok = collectBatchPathsFromFd(STDIN_FILENO, recursive, files) && ok;
+
+		if (useCdc) {
+			CdcParams params;
+			if (!makeCdcParams(cdcMinSize, cdcAvgSize, cdcMaxSize, params)) {
+				fprintf(stderr, "--cdc needs MIN <= AVG <= MAX and AVG >= 64.\n");
+				exit(-1);
+			}
+			int status = runCdc(files, selectedAlgs[0], params, chunkIndexPath);
+			return ok ? status : 1;
+		}
+
+		long jobs = maxJobs > 0 ? maxJobs : sysconf(_SC_NPROCESSORS_ONLN);
+		int status = runBatch(files, selectedAlgs, jobs > 0 ? jobs : 1, readEngine);
+		return ok ? status : 1;
+	}
+
 	/* Save the name of the file */
-	fileName = argv[1];
+	fileName = argv[optind];
+
+	/* Data that can only be read once is hashed in a single streaming pass */
+	if (teeOutput || isStream(fileName)) {
+		if (useTree || !verifyManifestPath.empty()) {
+			fprintf(stderr, "-t and --verify need a regular file, not a stream.\n");
+			exit(-1);
+		}
+		return streamHash();
+	}
+
+	if (!verifyManifestPath.empty())
+		return verifyTree();
+
+	/* There is no *sum program to run for the checksums; compute everything in-process instead */
+	for (size_t i = 0; i < selectedAlgs.size(); ++i) {
+		if (selectedAlgs[i] >= HASH_PROG_ARRAY_SIZE && !useZeroCopy)
+			useBuiltin = true;
+	}
+
+	if (useTree) {
+		treeHash();
+		return 0;
+	}
+
+	if (useBuiltin) {
+		builtinHash();
+		return 0;
+	}
+
+	if (useZeroCopy) {
+		zeroCopyHash();
+		return 0;
+	}
+
+	if (maxJobs > 0) {
+		fanOutHash();
+		return 0;
+	}
+
 	/* The process id */
 	pid_t pid;
 	
-	/* Run a program for each type of hash algorithm */	
-	for (int hashAlgNum = 0; hashAlgNum < HASH_PROG_ARRAY_SIZE; ++hashAlgNum) {
+	/* Run a program for each selected hash algorithm */	
+	for (size_t i = 0; i < selectedAlgs.size(); ++i) {
+		int hashAlgNum = selectedAlgs[i];
+
 		/* Create two pipes */
 		if (pipe(parentToChildPipe) < 0) {
 			perror("Failed to create pipe.");
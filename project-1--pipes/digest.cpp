@@ -0,0 +1,820 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "digest.h"
+#include "frame.h"
+#include "hwaccel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+using namespace std;
+
+const HashAlgInfo hashAlgs[ALG_COUNT] = {
+	{"md5", "md5sum", 16},
+	{"sha1", "sha1sum", 20},
+	{"sha224", "sha224sum", 28},
+	{"sha256", "sha256sum", 32},
+	{"sha384", "sha384sum", 48},
+	{"sha512", "sha512sum", 64},
+	{"crc32c", "crc32c", 4},
+	{"xxh64", "xxh64", 8},
+};
+
+/* ---------------
+   Byte helpers
+   --------------- */
+
+static inline uint32_t rotl32(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+static inline uint32_t rotr32(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+static inline uint64_t rotl64(uint64_t x, int n) { return (x << n) | (x >> (64 - n)); }
+static inline uint64_t rotr64(uint64_t x, int n) { return (x >> n) | (x << (64 - n)); }
+
+static inline uint32_t loadLe32(const unsigned char* p) {
+	return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t loadBe32(const unsigned char* p) {
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static inline uint64_t loadLe64(const unsigned char* p) {
+	return ((uint64_t)loadLe32(p + 4) << 32) | loadLe32(p);
+}
+
+static inline uint64_t loadBe64(const unsigned char* p) {
+	return ((uint64_t)loadBe32(p) << 32) | loadBe32(p + 4);
+}
+
+static inline void storeLe32(unsigned char* p, uint32_t v) {
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static inline void storeBe32(unsigned char* p, uint32_t v) {
+	p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+}
+
+static inline void storeBe64(unsigned char* p, uint64_t v) {
+	storeBe32(p, v >> 32);
+	storeBe32(p + 4, (uint32_t)v);
+}
+
+/**
+ * Buffers partial blocks and implements the Merkle-Damgard padding shared by
+ * MD5 and the SHA family. Subclasses only provide the compression function.
+ * @param BLOCK - the block size in bytes (64 or 128)
+ */
+template <size_t BLOCK>
+class BlockDigest : public Digest {
+public:
+	void update(const unsigned char* data, size_t len) {
+		totalLength += len;
+		/* Top up a partially filled block first */
+		if (bufferUsed) {
+			size_t take = BLOCK - bufferUsed;
+			if (take > len)
+				take = len;
+			memcpy(buffer + bufferUsed, data, take);
+			bufferUsed += take;
+			data += take;
+			len -= take;
+			if (bufferUsed < BLOCK)
+				return;
+			compress(buffer, 1);
+			bufferUsed = 0;
+		}
+		/* Hash whole blocks straight from the caller's buffer */
+		if (len >= BLOCK) {
+			compress(data, len / BLOCK);
+			data += len - len % BLOCK;
+			len %= BLOCK;
+		}
+		memcpy(buffer, data, len);
+		bufferUsed = len;
+	}
+
+protected:
+	BlockDigest() : totalLength(0), bufferUsed(0) {}
+
+	/**
+	 * Runs the compression function over whole blocks
+	 * @param blocks - the input blocks
+	 * @param count - the number of blocks
+	 */
+	virtual void compress(const unsigned char* blocks, size_t count) = 0;
+
+	/**
+	 * Appends the 0x80 marker, zero fill and the message length
+	 * @param lengthBytes - the size of the length field (8 or 16)
+	 * @param bigEndian - the byte order of the length field
+	 */
+	void pad(size_t lengthBytes, bool bigEndian) {
+		uint64_t bitLength = totalLength * 8;
+		buffer[bufferUsed++] = 0x80;
+		if (bufferUsed > BLOCK - lengthBytes) {
+			memset(buffer + bufferUsed, 0, BLOCK - bufferUsed);
+			compress(buffer, 1);
+			bufferUsed = 0;
+		}
+		memset(buffer + bufferUsed, 0, BLOCK - bufferUsed);
+		if (bigEndian) {
+			storeBe64(buffer + BLOCK - 8, bitLength);
+			/* The upper half of a 128-bit length holds the bits shifted out of totalLength * 8 */
+			if (lengthBytes == 16)
+				storeBe64(buffer + BLOCK - 16, totalLength >> 61);
+		} else {
+			storeLe32(buffer + BLOCK - 8, (uint32_t)bitLength);
+			storeLe32(buffer + BLOCK - 4, (uint32_t)(bitLength >> 32));
+		}
+		compress(buffer, 1);
+		bufferUsed = 0;
+	}
+
+	void resetBuffer() {
+		totalLength = 0;
+		bufferUsed = 0;
+	}
+
+private:
+	/* The number of message bytes hashed so far */
+	uint64_t totalLength;
+	/* The number of bytes waiting in buffer */
+	size_t bufferUsed;
+	/* A partial block */
+	unsigned char buffer[BLOCK];
+};
+
+/* ---------------
+   MD5 (RFC 1321)
+   --------------- */
+
+const uint32_t md5K[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+const int md5Shift[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+class Md5 : public BlockDigest<64> {
+public:
+	Md5() { reset(); }
+
+	void reset() {
+		resetBuffer();
+		state[0] = 0x67452301;
+		state[1] = 0xefcdab89;
+		state[2] = 0x98badcfe;
+		state[3] = 0x10325476;
+	}
+
+	void final(unsigned char* out) {
+		pad(8, false);
+		for (int i = 0; i < 4; ++i)
+			storeLe32(out + 4 * i, state[i]);
+	}
+
+	size_t digestLength() const { return 16; }
+
+protected:
+	void compress(const unsigned char* blocks, size_t count) {
+		for (; count--; blocks += 64) {
+			uint32_t m[16];
+			for (int i = 0; i < 16; ++i)
+				m[i] = loadLe32(blocks + 4 * i);
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			for (int i = 0; i < 64; ++i) {
+				uint32_t f;
+				int g;
+				if (i < 16) {
+					f = (b & c) | (~b & d);
+					g = i;
+				} else if (i < 32) {
+					f = (d & b) | (~d & c);
+					g = (5 * i + 1) & 15;
+				} else if (i < 48) {
+					f = b ^ c ^ d;
+					g = (3 * i + 5) & 15;
+				} else {
+					f = c ^ (b | ~d);
+					g = (7 * i) & 15;
+				}
+				uint32_t tmp = d;
+				d = c;
+				c = b;
+				b = b + rotl32(a + f + md5K[i] + m[g], md5Shift[i]);
+				a = tmp;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+		}
+	}
+
+private:
+	uint32_t state[4];
+};
+
+/* ------------------
+   SHA-1 (FIPS 180-4)
+   ------------------ */
+
+class Sha1 : public BlockDigest<64> {
+public:
+	Sha1() : shaNi(shaExtensionsEnabled()) { reset(); }
+
+	void reset() {
+		resetBuffer();
+		state[0] = 0x67452301;
+		state[1] = 0xefcdab89;
+		state[2] = 0x98badcfe;
+		state[3] = 0x10325476;
+		state[4] = 0xc3d2e1f0;
+	}
+
+	void final(unsigned char* out) {
+		pad(8, true);
+		for (int i = 0; i < 5; ++i)
+			storeBe32(out + 4 * i, state[i]);
+	}
+
+	size_t digestLength() const { return 20; }
+
+protected:
+	void compress(const unsigned char* blocks, size_t count) {
+		if (shaNi) {
+			sha1CompressShaNi(state, blocks, count);
+			return;
+		}
+		for (; count--; blocks += 64) {
+			uint32_t w[80];
+			for (int i = 0; i < 16; ++i)
+				w[i] = loadBe32(blocks + 4 * i);
+			for (int i = 16; i < 80; ++i)
+				w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+			for (int i = 0; i < 80; ++i) {
+				uint32_t f, k;
+				if (i < 20) {
+					f = (b & c) | (~b & d);
+					k = 0x5a827999;
+				} else if (i < 40) {
+					f = b ^ c ^ d;
+					k = 0x6ed9eba1;
+				} else if (i < 60) {
+					f = (b & c) | (b & d) | (c & d);
+					k = 0x8f1bbcdc;
+				} else {
+					f = b ^ c ^ d;
+					k = 0xca62c1d6;
+				}
+				uint32_t tmp = rotl32(a, 5) + f + e + k + w[i];
+				e = d;
+				d = c;
+				c = rotl32(b, 30);
+				b = a;
+				a = tmp;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+		}
+	}
+
+private:
+	/* Whether the SHA extensions run the compression function */
+	bool shaNi;
+	uint32_t state[5];
+};
+
+/* ----------------------------------
+   SHA-224 / SHA-256 (FIPS 180-4)
+   ---------------------------------- */
+
+const uint32_t sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const uint32_t sha256Iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const uint32_t sha224Iv[8] = {
+	0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939, 0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+};
+
+class Sha256 : public BlockDigest<64> {
+public:
+	/**
+	 * @param truncated - true for SHA-224
+	 */
+	explicit Sha256(bool truncated) : is224(truncated), shaNi(shaExtensionsEnabled()) { reset(); }
+
+	void reset() {
+		resetBuffer();
+		memcpy(state, is224 ? sha224Iv : sha256Iv, sizeof(state));
+	}
+
+	void final(unsigned char* out) {
+		pad(8, true);
+		for (size_t i = 0; i < digestLength() / 4; ++i)
+			storeBe32(out + 4 * i, state[i]);
+	}
+
+	size_t digestLength() const { return is224 ? 28 : 32; }
+
+protected:
+	void compress(const unsigned char* blocks, size_t count) {
+		if (shaNi) {
+			sha256CompressShaNi(state, blocks, count);
+			return;
+		}
+		for (; count--; blocks += 64) {
+			uint32_t w[64];
+			for (int i = 0; i < 16; ++i)
+				w[i] = loadBe32(blocks + 4 * i);
+			for (int i = 16; i < 64; ++i) {
+				uint32_t s0 = rotr32(w[i - 15], 7) ^ rotr32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+				uint32_t s1 = rotr32(w[i - 2], 17) ^ rotr32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 64; ++i) {
+				uint32_t s1 = rotr32(e, 6) ^ rotr32(e, 11) ^ rotr32(e, 25);
+				uint32_t ch = (e & f) ^ (~e & g);
+				uint32_t t1 = h + s1 + ch + sha256K[i] + w[i];
+				uint32_t s0 = rotr32(a, 2) ^ rotr32(a, 13) ^ rotr32(a, 22);
+				uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+				uint32_t t2 = s0 + maj;
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+	}
+
+private:
+	/* True for SHA-224 */
+	bool is224;
+	/* Whether the SHA extensions run the compression function */
+	bool shaNi;
+	uint32_t state[8];
+};
+
+/* ----------------------------------
+   SHA-384 / SHA-512 (FIPS 180-4)
+   ---------------------------------- */
+
+static const uint64_t sha512K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL, 0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL, 0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL, 0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL, 0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL, 0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL, 0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL, 0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+class Sha512 : public BlockDigest<128> {
+public:
+	/**
+	 * @param truncated - true for SHA-384
+	 */
+	explicit Sha512(bool truncated) : is384(truncated) { reset(); }
+
+	void reset() {
+		static const uint64_t iv512[8] = {
+			0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+			0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL, 0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+		};
+		static const uint64_t iv384[8] = {
+			0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL, 0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+			0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL, 0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+		};
+		resetBuffer();
+		memcpy(state, is384 ? iv384 : iv512, sizeof(state));
+	}
+
+	void final(unsigned char* out) {
+		pad(16, true);
+		for (size_t i = 0; i < digestLength() / 8; ++i)
+			storeBe64(out + 8 * i, state[i]);
+	}
+
+	size_t digestLength() const { return is384 ? 48 : 64; }
+
+protected:
+	void compress(const unsigned char* blocks, size_t count) {
+		for (; count--; blocks += 128) {
+			uint64_t w[80];
+			for (int i = 0; i < 16; ++i)
+				w[i] = loadBe64(blocks + 8 * i);
+			for (int i = 16; i < 80; ++i) {
+				uint64_t s0 = rotr64(w[i - 15], 1) ^ rotr64(w[i - 15], 8) ^ (w[i - 15] >> 7);
+				uint64_t s1 = rotr64(w[i - 2], 19) ^ rotr64(w[i - 2], 61) ^ (w[i - 2] >> 6);
+				w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+			}
+
+			uint64_t a = state[0], b = state[1], c = state[2], d = state[3];
+			uint64_t e = state[4], f = state[5], g = state[6], h = state[7];
+			for (int i = 0; i < 80; ++i) {
+				uint64_t s1 = rotr64(e, 14) ^ rotr64(e, 18) ^ rotr64(e, 41);
+				uint64_t ch = (e & f) ^ (~e & g);
+				uint64_t t1 = h + s1 + ch + sha512K[i] + w[i];
+				uint64_t s0 = rotr64(a, 28) ^ rotr64(a, 34) ^ rotr64(a, 39);
+				uint64_t maj = (a & b) ^ (a & c) ^ (b & c);
+				uint64_t t2 = s0 + maj;
+				h = g;
+				g = f;
+				f = e;
+				e = d + t1;
+				d = c;
+				c = b;
+				b = a;
+				a = t1 + t2;
+			}
+			state[0] += a;
+			state[1] += b;
+			state[2] += c;
+			state[3] += d;
+			state[4] += e;
+			state[5] += f;
+			state[6] += g;
+			state[7] += h;
+		}
+	}
+
+private:
+	/* True for SHA-384 */
+	bool is384;
+	uint64_t state[8];
+};
+
+/* ---------------------------------
+   CRC32C (Castagnoli, RFC 3720)
+   --------------------------------- */
+
+/* The byte-at-a-time table of the reflected Castagnoli polynomial */
+struct Crc32cTable {
+	uint32_t entries[256];
+
+	Crc32cTable() {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+			entries[i] = crc;
+		}
+	}
+};
+
+class Crc32c : public Digest {
+public:
+	Crc32c() : sse42(crc32InstructionEnabled()) { reset(); }
+
+	void reset() { crc = 0xffffffff; }
+
+	void update(const unsigned char* data, size_t len) {
+		if (sse42) {
+			crc = crc32cUpdateSse42(crc, data, len);
+			return;
+		}
+		static const Crc32cTable table;
+		while (len--)
+			crc = (crc >> 8) ^ table.entries[(crc ^ *data++) & 0xff];
+	}
+
+	/* Written most significant byte first, the way the check value is usually quoted */
+	void final(unsigned char* out) { storeBe32(out, ~crc); }
+
+	size_t digestLength() const { return 4; }
+
+private:
+	/* Whether the SSE4.2 crc32 instruction does the work */
+	bool sse42;
+	/* The inverted running CRC */
+	uint32_t crc;
+};
+
+/* -----------------------------
+   xxHash64 (seed 0)
+   ----------------------------- */
+
+static const uint64_t xxhPrime1 = 0x9e3779b185ebca87ULL;
+static const uint64_t xxhPrime2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t xxhPrime3 = 0x165667b19e3779f9ULL;
+static const uint64_t xxhPrime4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t xxhPrime5 = 0x27d4eb2f165667c5ULL;
+
+static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+	return rotl64(acc + input * xxhPrime2, 31) * xxhPrime1;
+}
+
+static inline uint64_t xxhMergeRound(uint64_t acc, uint64_t value) {
+	return (acc ^ xxhRound(0, value)) * xxhPrime1 + xxhPrime4;
+}
+
+class Xxh64 : public Digest {
+public:
+	Xxh64() { reset(); }
+
+	void reset() {
+		acc[0] = xxhPrime1 + xxhPrime2;
+		acc[1] = xxhPrime2;
+		acc[2] = 0;
+		acc[3] = -xxhPrime1;
+		totalLength = 0;
+		bufferUsed = 0;
+	}
+
+	void update(const unsigned char* data, size_t len) {
+		totalLength += len;
+		/* Top up a partial stripe first */
+		if (bufferUsed) {
+			size_t take = 32 - bufferUsed;
+			if (take > len)
+				take = len;
+			memcpy(buffer + bufferUsed, data, take);
+			bufferUsed += take;
+			data += take;
+			len -= take;
+			if (bufferUsed < 32)
+				return;
+			stripe(buffer);
+			bufferUsed = 0;
+		}
+		for (; len >= 32; data += 32, len -= 32)
+			stripe(data);
+		memcpy(buffer, data, len);
+		bufferUsed = len;
+	}
+
+	void final(unsigned char* out) {
+		uint64_t h;
+		if (totalLength >= 32) {
+			h = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+			for (int i = 0; i < 4; ++i)
+				h = xxhMergeRound(h, acc[i]);
+		} else {
+			h = xxhPrime5;
+		}
+		h += totalLength;
+
+		const unsigned char* p = buffer;
+		size_t left = bufferUsed;
+		for (; left >= 8; p += 8, left -= 8)
+			h = rotl64(h ^ xxhRound(0, loadLe64(p)), 27) * xxhPrime1 + xxhPrime4;
+		if (left >= 4) {
+			h = rotl64(h ^ (uint64_t)loadLe32(p) * xxhPrime1, 23) * xxhPrime2 + xxhPrime3;
+			p += 4;
+			left -= 4;
+		}
+		for (; left; ++p, --left)
+			h = rotl64(h ^ *p * xxhPrime5, 11) * xxhPrime1;
+
+		h ^= h >> 33;
+		h *= xxhPrime2;
+		h ^= h >> 29;
+		h *= xxhPrime3;
+		h ^= h >> 32;
+		/* The canonical (big-endian) form printed by xxhsum */
+		storeBe64(out, h);
+	}
+
+	size_t digestLength() const { return 8; }
+
+private:
+	void stripe(const unsigned char* p) {
+		for (int i = 0; i < 4; ++i)
+			acc[i] = xxhRound(acc[i], loadLe64(p + 8 * i));
+	}
+
+	/* The four lane accumulators */
+	uint64_t acc[4];
+	/* The number of message bytes hashed so far */
+	uint64_t totalLength;
+	/* The number of bytes waiting in buffer */
+	size_t bufferUsed;
+	/* A partial 32-byte stripe */
+	unsigned char buffer[32];
+};
+
+/* ---------------
+   Public helpers
+   --------------- */
+
+string Digest::hexDigest() {
+	unsigned char out[MAX_DIGEST_LENGTH];
+	final(out);
+	return toHex(out, digestLength());
+}
+
+Digest* createDigest(int alg) {
+	switch (alg) {
+	case ALG_MD5:
+		return new Md5();
+	case ALG_SHA1:
+		return new Sha1();
+	case ALG_SHA224:
+		return new Sha256(true);
+	case ALG_SHA256:
+		return new Sha256(false);
+	case ALG_SHA384:
+		return new Sha512(true);
+	case ALG_SHA512:
+		return new Sha512(false);
+	case ALG_CRC32C:
+		return new Crc32c();
+	case ALG_XXH64:
+		return new Xxh64();
+	default:
+		return NULL;
+	}
+}
+
+const char* digestImplementation(int alg) {
+	switch (alg) {
+	case ALG_SHA1:
+	case ALG_SHA224:
+	case ALG_SHA256:
+		return shaExtensionsEnabled() ? "sha-ni" : "scalar";
+	case ALG_CRC32C:
+		return crc32InstructionEnabled() ? "sse4.2" : "table";
+	default:
+		return "scalar";
+	}
+}
+
+int findHashAlg(const string& name) {
+	for (int alg = 0; alg < ALG_COUNT; ++alg) {
+		if (name == hashAlgs[alg].name || name == hashAlgs[alg].progName)
+			return alg;
+	}
+	return -1;
+}
+
+bool parseHashAlgList(const string& list, vector<int>& algs) {
+	size_t start = 0;
+	while (start <= list.size()) {
+		size_t comma = list.find(',', start);
+		if (comma == string::npos)
+			comma = list.size();
+		string name = list.substr(start, comma - start);
+		start = comma + 1;
+		if (name.empty())
+			continue;
+		if (name == "all") {
+			for (int alg = 0; alg < SUM_PROG_ALG_COUNT; ++alg)
+				algs.push_back(alg);
+			continue;
+		}
+		int alg = findHashAlg(name);
+		if (alg < 0)
+			return false;
+		algs.push_back(alg);
+	}
+
+	/* Drop duplicates but keep the first occurrence of each */
+	vector<int> unique;
+	for (size_t i = 0; i < algs.size(); ++i) {
+		bool seen = false;
+		for (size_t j = 0; j < unique.size(); ++j)
+			seen = seen || unique[j] == algs[i];
+		if (!seen)
+			unique.push_back(algs[i]);
+	}
+	algs.swap(unique);
+	return !algs.empty();
+}
+
+string toHex(const unsigned char* digest, size_t len) {
+	static const char digits[] = "0123456789abcdef";
+	string hex(len * 2, '0');
+	for (size_t i = 0; i < len; ++i) {
+		hex[2 * i] = digits[digest[i] >> 4];
+		hex[2 * i + 1] = digits[digest[i] & 0xf];
+	}
+	return hex;
+}
+
+long long hashFd(int fd, const vector<Digest*>& digests, int teeFd) {
+	/* Tell the kernel to read ahead aggressively; failure is harmless */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	unsigned char* buffer = (unsigned char*)malloc(HASH_READ_BLOCK_SIZE);
+	if (!buffer)
+		return -1;
+
+	long long total = 0;
+	for (;;) {
+		ssize_t got = read(fd, buffer, HASH_READ_BLOCK_SIZE);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			int savedErrno = errno;
+			free(buffer);
+			errno = savedErrno;
+			return -1;
+		}
+		if (got == 0)
+			break;
+		/* Every selected digest consumes the same block while it is hot in cache */
+		for (size_t i = 0; i < digests.size(); ++i)
+			digests[i]->update(buffer, got);
+		total += got;
+		if (teeFd >= 0 && !writeAll(teeFd, buffer, got)) {
+			int savedErrno = errno;
+			free(buffer);
+			errno = savedErrno;
+			return -2;
+		}
+	}
+
+	free(buffer);
+	return total;
+}
+
+string escapeSumFileName(const string& fileName, bool& needsEscape) {
+	string escaped;
+	needsEscape = false;
+	for (size_t i = 0; i < fileName.size(); ++i) {
+		switch (fileName[i]) {
+		case '\\':
+			escaped += "\\\\";
+			needsEscape = true;
+			break;
+		case '\n':
+			escaped += "\\n";
+			needsEscape = true;
+			break;
+		case '\r':
+			escaped += "\\r";
+			needsEscape = true;
+			break;
+		default:
+			escaped += fileName[i];
+		}
+	}
+	return escaped;
+}
+
+string formatSumLine(const string& hexValue, const string& fileName) {
+	bool needsEscape;
+	string escaped = escapeSumFileName(fileName, needsEscape);
+	return (needsEscape ? "\\" : "") + hexValue + "  " + escaped + "\n";
+}
@@ -0,0 +1,154 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+
+/* The identifiers of the built-in hash algorithms. The first six match hashProgs[]. */
+enum HashAlg {
+	ALG_MD5 = 0,
+	ALG_SHA1,
+	ALG_SHA224,
+	ALG_SHA256,
+	ALG_SHA384,
+	ALG_SHA512,
+	/* Fast non-cryptographic checksums; no coreutils program computes them */
+	ALG_CRC32C,
+	ALG_XXH64,
+	ALG_COUNT
+};
+
+/* The number of algorithms with a coreutils *sum program (ALG_MD5 to ALG_SHA512) */
+#define SUM_PROG_ALG_COUNT (ALG_SHA512 + 1)
+
+/* The largest digest produced by any built-in algorithm (SHA-512) */
+#define MAX_DIGEST_LENGTH 64
+
+/* The size of the blocks read from a file when hashing it in-process */
+#define HASH_READ_BLOCK_SIZE (1 << 20)
+
+/* Static description of a hash algorithm */
+struct HashAlgInfo {
+	/* The short name, e.g. sha256 */
+	const char* name;
+	/* The coreutils program computing the same digest, e.g. sha256sum, or the short name if there is none */
+	const char* progName;
+	/* The length of the binary digest in bytes */
+	size_t digestLength;
+};
+
+/* The table of built-in algorithms, indexed by HashAlg */
+extern const HashAlgInfo hashAlgs[ALG_COUNT];
+
+/* Round constants and initial values, shared with the multi-buffer kernels */
+extern const uint32_t md5K[64];
+extern const int md5Shift[64];
+extern const uint32_t sha256K[64];
+extern const uint32_t sha256Iv[8];
+extern const uint32_t sha224Iv[8];
+
+/**
+ * An incremental message digest
+ */
+class Digest {
+public:
+	virtual ~Digest() {}
+
+	/**
+	 * Restarts the digest as if nothing had been hashed
+	 */
+	virtual void reset() = 0;
+
+	/**
+	 * Feeds more bytes of the message to the digest
+	 * @param data - the bytes to hash
+	 * @param len - the number of bytes
+	 */
+	virtual void update(const unsigned char* data, size_t len) = 0;
+
+	/**
+	 * Finishes the digest; the object must be reset() before it is reused
+	 * @param out - receives digestLength() bytes
+	 */
+	virtual void final(unsigned char* out) = 0;
+
+	/**
+	 * @return the length of the binary digest in bytes
+	 */
+	virtual size_t digestLength() const = 0;
+
+	/**
+	 * Finishes the digest and returns it as lowercase hex
+	 */
+	std::string hexDigest();
+};
+
+/**
+ * Creates a fresh digest object
+ * @param alg - the algorithm identifier
+ * @return the digest, owned by the caller
+ */
+Digest* createDigest(int alg);
+
+/**
+ * @param alg - the algorithm identifier
+ * @return a printable name of the code createDigest() uses for alg on this CPU, e.g. "sha-ni"
+ */
+const char* digestImplementation(int alg);
+
+/**
+ * Looks up an algorithm by its short or program name (sha256 or sha256sum)
+ * @param name - the name to look up
+ * @return the algorithm identifier, or -1 if unknown
+ */
+int findHashAlg(const std::string& name);
+
+/**
+ * Parses a comma-separated list of algorithm names; "all" stands for the six *sum algorithms
+ * @param list - e.g. "md5,sha256sum"
+ * @param algs - receives the identifiers in list order, without duplicates
+ * @return false if any name is unknown
+ */
+bool parseHashAlgList(const std::string& list, std::vector<int>& algs);
+
+/**
+ * Converts a binary digest to lowercase hex
+ * @param digest - the binary digest
+ * @param len - its length in bytes
+ */
+std::string toHex(const unsigned char* digest, size_t len);
+
+/**
+ * Reads a file descriptor to the end once, feeding every digest from the same buffer
+ * @param fd - the descriptor to read
+ * @param digests - the digests to update; they are not finalized
+ * @param teeFd - if not -1, every block is also written here unchanged before the next read
+ * @return the number of bytes read, -1 on a read error or -2 on a write error to teeFd (errno is set)
+ */
+long long hashFd(int fd, const std::vector<Digest*>& digests, int teeFd = -1);
+
+/**
+ * Escapes backslashes, newlines and carriage returns in a file name the way
+ * the coreutils *sum programs do
+ * @param fileName - the name to escape
+ * @param needsEscape - set to whether anything was escaped, in which case
+ *                      the line holding the name must start with a backslash
+ */
+std::string escapeSumFileName(const std::string& fileName, bool& needsEscape);
+
+/**
+ * Formats a digest line exactly the way the coreutils *sum programs do,
+ * including their escaping of backslashes and newlines in the file name
+ * @param hexValue - the hex digest
+ * @param fileName - the name of the hashed file
+ */
+std::string formatSumLine(const std::string& hexValue, const std::string& fileName);
+
+#endif
@@ -0,0 +1,283 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "digestcache.h"
+#include "digest.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+static const char CACHE_MAGIC[8] = {'C', 'H', 'V', 'C', 'A', 'C', 'H', 'E'};
+
+/**
+ * @return the modification time in nanoseconds
+ */
+static int64_t mtimeNs(const struct stat& info) {
+	return (int64_t)info.st_mtim.tv_sec * 1000000000 + info.st_mtim.tv_nsec;
+}
+
+/**
+ * Mixes the key into a slot index (splitmix64 finalizer)
+ */
+static uint64_t hashKey(const struct stat& info, int alg) {
+	uint64_t h = info.st_dev * 0x9e3779b97f4a7c15ULL;
+	h ^= info.st_ino + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= info.st_size + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= mtimeNs(info) + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+	h ^= alg;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	return h ^ (h >> 31);
+}
+
+/**
+ * @return whether a slot holds the given key
+ */
+static bool slotMatches(const CacheSlot& slot, const struct stat& info, int alg) {
+	return slot.used && slot.dev == (uint64_t)info.st_dev && slot.ino == (uint64_t)info.st_ino &&
+	       slot.size == (uint64_t)info.st_size && slot.mtimeNs == mtimeNs(info) && slot.alg == alg;
+}
+
+DigestCache::DigestCache(int fd, void* mapping, size_t mappingLength)
+	: fd(fd), mapping(mapping), mappingLength(mappingLength) {
+	header = (CacheHeader*)mapping;
+	slots = (CacheSlot*)((char*)mapping + sizeof(CacheHeader));
+}
+
+DigestCache::~DigestCache() {
+	munmap(mapping, mappingLength);
+	close(fd);
+}
+
+DigestCache* DigestCache::open(const string& path, size_t slotCount) {
+	int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "%s: %s (continuing without the cache)\n", path.c_str(), strerror(errno));
+		return NULL;
+	}
+
+	/* Creation and validation happen under the exclusive lock so two creators cannot race */
+	flock(fd, LOCK_EX);
+	struct stat info;
+	fstat(fd, &info);
+	if (info.st_size == 0) {
+		CacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = DIGEST_CACHE_VERSION;
+		header.slotSize = sizeof(CacheSlot);
+		header.slotCount = slotCount;
+		/* The slots start out as a hole in the file, which reads back as zeroes */
+		if (ftruncate(fd, sizeof(CacheHeader) + slotCount * sizeof(CacheSlot)) < 0 ||
+		    pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+			fprintf(stderr, "%s: %s (continuing without the cache)\n", path.c_str(), strerror(errno));
+			flock(fd, LOCK_UN);
+			close(fd);
+			return NULL;
+		}
+		fstat(fd, &info);
+	}
+
+	CacheHeader header;
+	bool valid = pread(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+	             !memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) &&
+	             header.version == DIGEST_CACHE_VERSION && header.slotSize == sizeof(CacheSlot) &&
+	             header.slotCount > 0 &&
+	             (uint64_t)info.st_size == sizeof(CacheHeader) + header.slotCount * sizeof(CacheSlot);
+	flock(fd, LOCK_UN);
+	if (!valid) {
+		fprintf(stderr, "%s: not a digest cache of this version (continuing without the cache)\n", path.c_str());
+		close(fd);
+		return NULL;
+	}
+
+	void* mapping = mmap(NULL, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (mapping == MAP_FAILED) {
+		fprintf(stderr, "%s: %s (continuing without the cache)\n", path.c_str(), strerror(errno));
+		close(fd);
+		return NULL;
+	}
+	return new DigestCache(fd, mapping, info.st_size);
+}
+
+CacheSlot* DigestCache::probe(const struct stat& info, int alg) {
+	uint64_t count = header->slotCount;
+	uint64_t index = hashKey(info, alg) % count;
+	for (uint64_t step = 0; step < count; ++step) {
+		CacheSlot* slot = &slots[(index + step) % count];
+		if (!slot->used || slotMatches(*slot, info, alg))
+			return slot;
+	}
+	return NULL;
+}
+
+bool DigestCache::lookup(const struct stat& info, int alg, unsigned char* digest) {
+	flock(fd, LOCK_SH);
+	CacheSlot* slot = probe(info, alg);
+	bool hit = slot && slot->used;
+	if (hit) {
+		memcpy(digest, slot->digest, slot->digestLength);
+		/* Readers share the lock, so the bookkeeping must be atomic */
+		__atomic_store_n(&slot->lastUsed, __atomic_add_fetch(&header->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+		__atomic_add_fetch(&header->hits, 1, __ATOMIC_RELAXED);
+	} else {
+		__atomic_add_fetch(&header->misses, 1, __ATOMIC_RELAXED);
+	}
+	flock(fd, LOCK_UN);
+	return hit;
+}
+
+void DigestCache::store(const struct stat& info, int alg, const unsigned char* digest, size_t length) {
+	if (length > sizeof(slots[0].digest))
+		return;
+
+	flock(fd, LOCK_EX);
+	CacheSlot* slot = probe(info, alg);
+	if (slot && !slot->used && (header->entries + 1) * 4 > header->slotCount * 3) {
+		/* Make room, then look again: the table was rebuilt */
+		compactLocked(header->slotCount / 2);
+		slot = probe(info, alg);
+	}
+	if (slot) {
+		if (!slot->used)
+			++header->entries;
+		slot->dev = info.st_dev;
+		slot->ino = info.st_ino;
+		slot->size = info.st_size;
+		slot->mtimeNs = mtimeNs(info);
+		slot->alg = alg;
+		slot->digestLength = length;
+		memcpy(slot->digest, digest, length);
+		slot->lastUsed = ++header->clock;
+		slot->used = 1;
+	}
+	flock(fd, LOCK_UN);
+}
+
+/**
+ * Orders slots from the most to the least recently used
+ */
+static bool moreRecentlyUsed(const CacheSlot& a, const CacheSlot& b) {
+	return a.lastUsed > b.lastUsed;
+}
+
+size_t DigestCache::compactLocked(size_t keep) {
+	vector<CacheSlot> live;
+	for (uint64_t i = 0; i < header->slotCount; ++i) {
+		if (slots[i].used)
+			live.push_back(slots[i]);
+	}
+	sort(live.begin(), live.end(), moreRecentlyUsed);
+	size_t evicted = 0;
+	if (live.size() > keep) {
+		evicted = live.size() - keep;
+		live.resize(keep);
+	}
+
+	/* Rebuilding from scratch also shortens the probe chains left by evicted entries */
+	memset(slots, 0, header->slotCount * sizeof(CacheSlot));
+	for (size_t i = 0; i < live.size(); ++i) {
+		struct stat key;
+		key.st_dev = live[i].dev;
+		key.st_ino = live[i].ino;
+		key.st_size = live[i].size;
+		key.st_mtim.tv_sec = live[i].mtimeNs / 1000000000;
+		key.st_mtim.tv_nsec = live[i].mtimeNs % 1000000000;
+		*probe(key, live[i].alg) = live[i];
+	}
+	header->entries = live.size();
+	header->evictions += evicted;
+	return evicted;
+}
+
+size_t DigestCache::compact(size_t keep) {
+	flock(fd, LOCK_EX);
+	size_t evicted = compactLocked(keep);
+	flock(fd, LOCK_UN);
+	return evicted;
+}
+
+CacheStats DigestCache::stats() {
+	flock(fd, LOCK_SH);
+	CacheStats stats;
+	stats.slotCount = header->slotCount;
+	stats.entries = header->entries;
+	stats.hits = __atomic_load_n(&header->hits, __ATOMIC_RELAXED);
+	stats.misses = __atomic_load_n(&header->misses, __ATOMIC_RELAXED);
+	stats.evictions = header->evictions;
+	flock(fd, LOCK_UN);
+	return stats;
+}
+
+/* The cache file selected on the command line */
+static string cachePath;
+
+/* This process's handle and the process that opened it */
+static DigestCache* processCache = NULL;
+static pid_t processCacheOwner = 0;
+
+void setDigestCachePath(const string& path) {
+	cachePath = path;
+}
+
+DigestCache* digestCacheForProcess() {
+	if (cachePath.empty())
+		return NULL;
+	if (processCacheOwner != getpid()) {
+		/* The inherited handle shares its lock with the parent; leak it and open our own */
+		processCache = DigestCache::open(cachePath);
+		processCacheOwner = getpid();
+	}
+	return processCache;
+}
+
+long long hashFdCached(int fd, const vector<int>& algs, vector<string>& hexDigests) {
+	hexDigests.assign(algs.size(), string());
+	DigestCache* cache = digestCacheForProcess();
+
+	struct stat before;
+	bool cacheable = cache && fstat(fd, &before) == 0 && S_ISREG(before.st_mode);
+
+	/* Answer what we can from the cache */
+	vector<size_t> missing;
+	for (size_t i = 0; i < algs.size(); ++i) {
+		unsigned char digest[MAX_DIGEST_LENGTH];
+		if (cacheable && cache->lookup(before, algs[i], digest))
+			hexDigests[i] = toHex(digest, hashAlgs[algs[i]].digestLength);
+		else
+			missing.push_back(i);
+	}
+	if (missing.empty())
+		return 0;
+
+	vector<Digest*> digests;
+	for (size_t i = 0; i < missing.size(); ++i)
+		digests.push_back(createDigest(algs[missing[i]]));
+	long long bytesRead = hashFd(fd, digests);
+
+	/* Only remember digests of a file that did not change while it was read */
+	struct stat after;
+	cacheable = cacheable && bytesRead >= 0 && fstat(fd, &after) == 0 && after.st_size == before.st_size &&
+	            mtimeNs(after) == mtimeNs(before);
+	for (size_t i = 0; i < missing.size(); ++i) {
+		if (bytesRead >= 0) {
+			unsigned char digest[MAX_DIGEST_LENGTH];
+			digests[i]->final(digest);
+			hexDigests[missing[i]] = toHex(digest, digests[i]->digestLength());
+			if (cacheable)
+				cache->store(before, algs[missing[i]], digest, digests[i]->digestLength());
+		}
+		delete digests[i];
+	}
+	return bytesRead;
+}
@@ -0,0 +1,162 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef DIGESTCACHE_H
+#define DIGESTCACHE_H
+
+#include <string>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+/*
+ * On-disk cache of file digests keyed by (device, inode, size, mtime in
+ * nanoseconds, algorithm). The file is a fixed-size open addressing hash
+ * table that every process maps with MAP_SHARED:
+ *
+ *   CacheHeader | CacheSlot[slotCount]
+ *
+ * Lookups run under a shared flock() and only touch the counters and the
+ * LRU clock with atomic operations; inserts and compaction take the lock
+ * exclusively. An insert that would push the table past 3/4 full first
+ * evicts the least recently used half, so the file never grows.
+ */
+
+/* The number of slots of a newly created cache (about 29 MB on disk) */
+#define DEFAULT_CACHE_SLOTS (1u << 18)
+
+/* The layout version written into new cache files */
+#define DIGEST_CACHE_VERSION 1
+
+/* The fixed header at the start of the cache file */
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t slotSize;
+	uint64_t slotCount;
+	uint64_t entries;
+	uint64_t hits;
+	uint64_t misses;
+	/* Incremented on every access; stamps CacheSlot::lastUsed */
+	uint64_t clock;
+	uint64_t evictions;
+};
+
+/* One cached digest */
+struct CacheSlot {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtimeNs;
+	uint64_t lastUsed;
+	uint8_t alg;
+	uint8_t digestLength;
+	/* Nonzero if the slot holds an entry */
+	uint8_t used;
+	uint8_t reserved[5];
+	unsigned char digest[64];
+};
+
+/* A snapshot of the cache counters */
+struct CacheStats {
+	uint64_t slotCount;
+	uint64_t entries;
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t evictions;
+};
+
+class DigestCache {
+public:
+	/**
+	 * Opens a cache file, creating it if needed
+	 * @param path - the cache file
+	 * @param slots - the capacity if the file is created
+	 * @return the cache, or NULL if it cannot be used (a message was printed)
+	 */
+	static DigestCache* open(const std::string& path, size_t slots = DEFAULT_CACHE_SLOTS);
+
+	~DigestCache();
+
+	/**
+	 * Looks up a digest without touching the file it belongs to
+	 * @param info - stat() of the file
+	 * @param alg - the algorithm
+	 * @param digest - receives the binary digest on a hit
+	 * @return true on a hit
+	 */
+	bool lookup(const struct stat& info, int alg, unsigned char* digest);
+
+	/**
+	 * Records a digest, evicting old entries if the table is getting full
+	 * @param info - stat() of the file, taken before it was read
+	 * @param alg - the algorithm
+	 * @param digest - the binary digest
+	 * @param length - its length
+	 */
+	void store(const struct stat& info, int alg, const unsigned char* digest, size_t length);
+
+	/**
+	 * Drops all but the most recently used entries and rebuilds the table
+	 * @param keep - the number of entries to keep
+	 * @return the number of entries evicted
+	 */
+	size_t compact(size_t keep);
+
+	/**
+	 * @return the counters stored in the file
+	 */
+	CacheStats stats();
+
+private:
+	DigestCache(int fd, void* mapping, size_t mappingLength);
+
+	/**
+	 * Finds the slot of a key, or the empty slot where it would go
+	 * @return the slot, or NULL if the table is full
+	 */
+	CacheSlot* probe(const struct stat& info, int alg);
+
+	/**
+	 * Keeps the keep most recently used entries; the exclusive lock must be held
+	 */
+	size_t compactLocked(size_t keep);
+
+	int fd;
+	void* mapping;
+	size_t mappingLength;
+	CacheHeader* header;
+	CacheSlot* slots;
+
+	DigestCache(const DigestCache&);
+	DigestCache& operator=(const DigestCache&);
+};
+
+/**
+ * Selects the cache file used by digestCacheForProcess()
+ * @param path - the cache file, or empty to disable caching
+ */
+void setDigestCachePath(const std::string& path);
+
+/**
+ * Returns this process's handle on the cache, opening it on first use.
+ * Forked workers get their own descriptor, because flock() locks are
+ * shared by every process using the same open file description.
+ * @return the cache, or NULL if caching is disabled or unavailable
+ */
+DigestCache* digestCacheForProcess();
+
+/**
+ * Hashes an open file with every algorithm, answering from the cache where
+ * possible and reading the file once for the rest
+ * @param fd - the open file
+ * @param algs - the algorithms
+ * @param hexDigests - receives one lowercase hex digest per algorithm
+ * @return the number of bytes read (0 if every digest was cached), or -1 on an error
+ */
+long long hashFdCached(int fd, const std::vector<int>& algs, std::vector<std::string>& hexDigests);
+
+#endif
@@ -0,0 +1,772 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "dirmanifest.h"
+#include "clock.h"
+#include "digest.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
+#include <poll.h>
+#include <sched.h>
+#include <set>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+/* The magic at the start of a manifest */
+static const char manifestMagic[8] = {'C', 'H', 'V', 'D', 'M', 'A', 'N', '\0'};
+
+/* The events that can change a directory's manifest */
+#define WATCH_MASK                                                                                          \
+	(IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |          \
+	 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
+
+/* The daemon's view of one file or directory */
+struct TreeEntry {
+	bool isDir;
+	/* For a directory, the total size of the files below it */
+	uint64_t size;
+	int64_t mtimeNs;
+	unsigned char digest[MAX_DIGEST_LENGTH];
+	string name;
+	TreeEntry* parent;
+	/* The children of a directory, in the order of the manifest */
+	map<string, TreeEntry*> children;
+	/* The node index in the mapped manifest, or -1 before the next layout */
+	long slot;
+	/* The inotify watch of a directory, or -1 */
+	int wd;
+	/* Whether the current batch must recompute this directory */
+	bool dirty;
+	/* Whether the current batch created this entry, so events below it are already covered */
+	bool fresh;
+};
+
+/* The state of the daemon */
+struct WatchState {
+	string root;
+	string manifestPath;
+	int alg;
+	ReadEngine engine;
+	size_t threads;
+	TreeEntry* top;
+	int inotifyFd;
+	/* The directory each watch belongs to */
+	map<int, TreeEntry*> watches;
+	/* The manifest mapping */
+	int manifestFd;
+	ManifestHeader* header;
+	size_t mappedLength;
+	uint64_t fileCount;
+};
+
+/* Set by SIGINT and SIGTERM */
+static volatile sig_atomic_t stopSignalled = 0;
+
+static void onStopSignal(int) {
+	stopSignalled = 1;
+}
+
+static string joinPath(const string& dir, const string& name) {
+	return dir.empty() ? name : dir + "/" + name;
+}
+
+/**
+ * @return the path of an entry relative to the top of the tree ("" for the top)
+ */
+static string entryPath(const TreeEntry* entry) {
+	if (!entry->parent)
+		return "";
+	return joinPath(entryPath(entry->parent), entry->name);
+}
+
+static string fullPath(const WatchState& state, const string& relative) {
+	return relative.empty() ? state.root : state.root + "/" + relative;
+}
+
+static int64_t mtimeNs(const struct stat& info) {
+	return (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+}
+
+static TreeEntry* newEntry(const string& name, TreeEntry* parent, bool isDir) {
+	TreeEntry* entry = new TreeEntry;
+	entry->isDir = isDir;
+	entry->size = 0;
+	entry->mtimeNs = 0;
+	memset(entry->digest, 0, sizeof(entry->digest));
+	entry->name = name;
+	entry->parent = parent;
+	entry->slot = -1;
+	entry->wd = -1;
+	entry->dirty = false;
+	entry->fresh = false;
+	if (parent)
+		parent->children[name] = entry;
+	return entry;
+}
+
+/**
+ * Starts watching a directory; a failure only costs freshness, so it is a warning
+ */
+static void addWatch(WatchState& state, TreeEntry* dir) {
+	string path = fullPath(state, entryPath(dir));
+	dir->wd = inotify_add_watch(state.inotifyFd, path.c_str(), WATCH_MASK);
+	if (dir->wd < 0) {
+		fprintf(stderr, "%s: cannot watch: %s%s\n", path.c_str(), strerror(errno),
+		        errno == ENOSPC ? " (raise fs.inotify.max_user_watches)" : "");
+		return;
+	}
+	state.watches[dir->wd] = dir;
+}
+
+/**
+ * Deletes an entry and everything below it, dropping their watches; the
+ * caller unlinks it from its parent
+ */
+static void deleteSubtree(WatchState& state, TreeEntry* entry) {
+	for (map<string, TreeEntry*>::iterator it = entry->children.begin(); it != entry->children.end(); ++it)
+		deleteSubtree(state, it->second);
+	/* A directory moved within the tree keeps its watch, which its new entry already took over */
+	map<int, TreeEntry*>::iterator it = state.watches.find(entry->wd);
+	if (it != state.watches.end() && it->second == entry) {
+		inotify_rm_watch(state.inotifyFd, entry->wd);
+		state.watches.erase(it);
+	}
+	delete entry;
+}
+
+static void removeEntry(WatchState& state, TreeEntry* entry) {
+	entry->parent->children.erase(entry->name);
+	deleteSubtree(state, entry);
+}
+
+/**
+ * Watches a directory and adds everything below it; the watch comes first,
+ * so a file created during the scan is either seen here or reported later
+ * @param files - receives the files to hash
+ */
+static void scanDir(WatchState& state, TreeEntry* dir, vector<TreeEntry*>& files) {
+	addWatch(state, dir);
+	string path = fullPath(state, entryPath(dir));
+	DIR* stream = opendir(path.c_str());
+	if (!stream) {
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return;
+	}
+	struct dirent* item;
+	while ((item = readdir(stream)) != NULL) {
+		if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0)
+			continue;
+		struct stat info;
+		if (fstatat(dirfd(stream), item->d_name, &info, AT_SYMLINK_NOFOLLOW) < 0)
+			continue;
+		if (S_ISDIR(info.st_mode)) {
+			TreeEntry* child = newEntry(item->d_name, dir, true);
+			scanDir(state, child, files);
+		} else if (S_ISREG(info.st_mode)) {
+			TreeEntry* child = newEntry(item->d_name, dir, false);
+			child->size = info.st_size;
+			child->mtimeNs = mtimeNs(info);
+			files.push_back(child);
+		}
+	}
+	closedir(stream);
+}
+
+static int hexValue(char c) {
+	return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+}
+
+/* The files hashWithReadEngine() is working on */
+struct HashBatch {
+	const vector<TreeEntry*>* files;
+	const vector<string>* paths;
+	size_t failures;
+	long long bytes;
+};
+
+static void onFileHashed(size_t fileIndex, const FileDigests& result, void* context) {
+	HashBatch* batch = (HashBatch*)context;
+	TreeEntry* file = (*batch->files)[fileIndex];
+	if (!result.ok) {
+		/* A file that vanished is removed by its delete event; an unreadable one keeps a zero digest */
+		memset(file->digest, 0, sizeof(file->digest));
+		if (result.error != strerror(ENOENT))
+			fprintf(stderr, "%s: %s\n", (*batch->paths)[fileIndex].c_str(), result.error.c_str());
+		++batch->failures;
+		return;
+	}
+	const string& hex = result.hexDigests[0];
+	for (size_t i = 0; i + 1 < hex.size(); i += 2)
+		file->digest[i / 2] = hexValue(hex[i]) << 4 | hexValue(hex[i + 1]);
+	file->size = result.bytes;
+	batch->bytes += result.bytes;
+}
+
+/**
+ * Hashes files on the read engine's threads
+ * @return the number of bytes read
+ */
+static long long hashFiles(WatchState& state, const vector<TreeEntry*>& files) {
+	if (files.empty())
+		return 0;
+	vector<string> paths;
+	for (size_t i = 0; i < files.size(); ++i)
+		paths.push_back(fullPath(state, entryPath(files[i])));
+	HashBatch batch;
+	batch.files = &files;
+	batch.paths = &paths;
+	batch.failures = 0;
+	batch.bytes = 0;
+	hashWithReadEngine(state.engine, paths, vector<int>(1, state.alg), state.threads, onFileHashed, &batch);
+	return batch.bytes;
+}
+
+/**
+ * Recomputes a directory's digest and size from its children
+ */
+static void computeDir(const WatchState& state, TreeEntry* dir) {
+	size_t length = hashAlgs[state.alg].digestLength;
+	Digest* digest = createDigest(state.alg);
+	unsigned char prefix = 0x01;
+	digest->update(&prefix, 1);
+	dir->size = 0;
+	for (map<string, TreeEntry*>::iterator it = dir->children.begin(); it != dir->children.end(); ++it) {
+		TreeEntry* child = it->second;
+		unsigned char type = child->isDir ? 0x01 : 0x00;
+		digest->update(&type, 1);
+		digest->update((const unsigned char*)child->name.c_str(), child->name.size() + 1);
+		digest->update(child->digest, length);
+		dir->size += child->size;
+	}
+	digest->final(dir->digest);
+	delete digest;
+}
+
+/**
+ * Computes every directory below and including entry, children first
+ */
+static void computeAll(const WatchState& state, TreeEntry* entry) {
+	if (!entry->isDir)
+		return;
+	for (map<string, TreeEntry*>::iterator it = entry->children.begin(); it != entry->children.end(); ++it)
+		computeAll(state, it->second);
+	computeDir(state, entry);
+}
+
+static size_t depth(const TreeEntry* entry) {
+	size_t levels = 0;
+	for (; entry->parent; entry = entry->parent)
+		++levels;
+	return levels;
+}
+
+/**
+ * Marks a directory and its ancestors for recomputation
+ * @param dirty - collects the directories marked for the first time
+ */
+static void markDirty(TreeEntry* dir, vector<TreeEntry*>& dirty) {
+	for (; dir && !dir->dirty; dir = dir->parent) {
+		dir->dirty = true;
+		dirty.push_back(dir);
+	}
+}
+
+static bool deeperFirst(const TreeEntry* a, const TreeEntry* b) {
+	return depth(a) > depth(b);
+}
+
+static uint64_t countFiles(const TreeEntry* entry) {
+	if (!entry->isDir)
+		return 1;
+	uint64_t count = 0;
+	for (map<string, TreeEntry*>::const_iterator it = entry->children.begin(); it != entry->children.end(); ++it)
+		count += countFiles(it->second);
+	return count;
+}
+
+static void unmapManifest(WatchState& state) {
+	if (state.header) {
+		munmap(state.header, state.mappedLength);
+		close(state.manifestFd);
+		state.header = NULL;
+	}
+}
+
+/**
+ * Lays the tree out breadth first and replaces the manifest file with it
+ * @return false on a write error (a message was printed)
+ */
+static bool writeManifest(WatchState& state) {
+	vector<TreeEntry*> order(1, state.top);
+	for (size_t i = 0; i < order.size(); ++i) {
+		order[i]->slot = i;
+		for (map<string, TreeEntry*>::iterator it = order[i]->children.begin(); it != order[i]->children.end(); ++it)
+			order.push_back(it->second);
+	}
+
+	string names;
+	vector<ManifestNode> nodes(order.size());
+	size_t nextChild = 1;
+	for (size_t i = 0; i < order.size(); ++i) {
+		TreeEntry* entry = order[i];
+		ManifestNode& node = nodes[i];
+		memset(&node, 0, sizeof(node));
+		node.parent = entry->parent ? entry->parent->slot : 0;
+		node.firstChild = nextChild;
+		node.childCount = entry->children.size();
+		nextChild += entry->children.size();
+		node.nameOffset = names.size();
+		node.nameLength = entry->name.size();
+		names += entry->name;
+		node.isDir = entry->isDir;
+		node.size = entry->size;
+		node.mtimeNs = entry->mtimeNs;
+		memcpy(node.digest, entry->digest, sizeof(node.digest));
+	}
+
+	ManifestHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, manifestMagic, sizeof(header.magic));
+	header.version = DIR_MANIFEST_VERSION;
+	header.alg = state.alg;
+	header.digestLength = hashAlgs[state.alg].digestLength;
+	header.nodeCount = nodes.size();
+	header.namesLength = names.size();
+	header.fileCount = state.fileCount = countFiles(state.top);
+	header.totalBytes = state.top->size;
+
+	/* Written beside the old file and renamed over it, so a reader sees one or the other */
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".tmp.%d", (int)getpid());
+	string tempPath = state.manifestPath + suffix;
+	int fd = open(tempPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	size_t length = sizeof(header) + nodes.size() * sizeof(ManifestNode) + names.size();
+	bool ok = fd >= 0 && write(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+	          write(fd, &nodes[0], nodes.size() * sizeof(ManifestNode)) == (ssize_t)(nodes.size() * sizeof(ManifestNode)) &&
+	          write(fd, names.data(), names.size()) == (ssize_t)names.size();
+	void* mapping = ok ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+	if (mapping == MAP_FAILED || rename(tempPath.c_str(), state.manifestPath.c_str()) < 0) {
+		fprintf(stderr, "%s: %s\n", state.manifestPath.c_str(), strerror(errno));
+		if (mapping != MAP_FAILED)
+			munmap(mapping, length);
+		if (fd >= 0) {
+			close(fd);
+			unlink(tempPath.c_str());
+		}
+		return false;
+	}
+
+	/* Readers still holding the old file go back to the path */
+	if (state.header)
+		__atomic_store_n(&state.header->superseded, 1, __ATOMIC_RELEASE);
+	unmapManifest(state);
+	state.manifestFd = fd;
+	state.header = (ManifestHeader*)mapping;
+	state.mappedLength = length;
+	return true;
+}
+
+/**
+ * Writes changed digests and sizes into the mapped manifest under the sequence lock
+ * @param changed - entries that already have a slot
+ */
+static void updateManifest(WatchState& state, const vector<TreeEntry*>& changed) {
+	ManifestHeader* header = state.header;
+	ManifestNode* nodes = (ManifestNode*)(header + 1);
+	uint64_t sequence = header->sequence;
+	__atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	for (size_t i = 0; i < changed.size(); ++i) {
+		ManifestNode& node = nodes[changed[i]->slot];
+		node.size = changed[i]->size;
+		node.mtimeNs = changed[i]->mtimeNs;
+		memcpy(node.digest, changed[i]->digest, sizeof(node.digest));
+	}
+	header->totalBytes = state.top->size;
+	__atomic_store_n(&header->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Finds an entry by its relative path
+ * @param covered - set if the entry or an ancestor was created by the current batch
+ * @return the entry, or NULL
+ */
+static TreeEntry* findEntry(WatchState& state, const string& path, bool& covered) {
+	TreeEntry* entry = state.top;
+	covered = false;
+	size_t start = 0;
+	while (start < path.size()) {
+		size_t slash = path.find('/', start);
+		if (slash == string::npos)
+			slash = path.size();
+		map<string, TreeEntry*>::iterator it = entry->children.find(path.substr(start, slash - start));
+		if (it == entry->children.end())
+			return NULL;
+		entry = it->second;
+		covered = covered || entry->fresh;
+		start = slash + 1;
+	}
+	return entry;
+}
+
+static string hexRoot(const WatchState& state) {
+	return toHex(state.top->digest, hashAlgs[state.alg].digestLength);
+}
+
+/**
+ * Rebuilds the whole tree, e.g. at start-up or after the event queue overflowed
+ */
+static bool rebuild(WatchState& state) {
+	double startTime = monotonicNow();
+	for (map<string, TreeEntry*>::iterator it = state.top->children.begin(); it != state.top->children.end(); ++it)
+		deleteSubtree(state, it->second);
+	state.top->children.clear();
+	if (state.top->wd >= 0) {
+		inotify_rm_watch(state.inotifyFd, state.top->wd);
+		state.watches.erase(state.top->wd);
+	}
+
+	vector<TreeEntry*> files;
+	scanDir(state, state.top, files);
+	long long bytes = hashFiles(state, files);
+	computeAll(state, state.top);
+	if (!writeManifest(state))
+		return false;
+	double elapsed = monotonicNow() - startTime;
+	fprintf(stderr, "Built the manifest of %zu files (%.1f MB) in %.3f s, %.1f MB/s; root %s\n", files.size(),
+	        bytes / 1e6, elapsed, bytes / 1e6 / (elapsed > 0 ? elapsed : 1e-9), hexRoot(state).c_str());
+	return true;
+}
+
+/**
+ * Applies one coalesced burst of changes
+ * @param pending - the relative paths events were reported for
+ */
+static bool applyChanges(WatchState& state, const set<string>& pending) {
+	double startTime = monotonicNow();
+	vector<TreeEntry*> toHash, dirty, created;
+	bool reshaped = false;
+
+	for (set<string>::const_iterator p = pending.begin(); p != pending.end(); ++p) {
+		size_t slash = p->rfind('/');
+		string parentPath = slash == string::npos ? "" : p->substr(0, slash);
+		string name = slash == string::npos ? *p : p->substr(slash + 1);
+		bool covered;
+		TreeEntry* parent = findEntry(state, parentPath, covered);
+		/* A parent that is gone or was just scanned already accounts for this path */
+		if (!parent || !parent->isDir || covered)
+			continue;
+
+		struct stat info;
+		bool isDir = false, isFile = false;
+		if (lstat(fullPath(state, *p).c_str(), &info) == 0) {
+			isDir = S_ISDIR(info.st_mode);
+			isFile = S_ISREG(info.st_mode);
+		}
+		map<string, TreeEntry*>::iterator it = parent->children.find(name);
+		TreeEntry* existing = it == parent->children.end() ? NULL : it->second;
+		if (existing && existing->isDir != isDir) {
+			removeEntry(state, existing);
+			existing = NULL;
+			markDirty(parent, dirty);
+			reshaped = true;
+		} else if (existing && !isDir && !isFile) {
+			removeEntry(state, existing);
+			existing = NULL;
+			markDirty(parent, dirty);
+			reshaped = true;
+		}
+
+		if (isDir && !existing) {
+			TreeEntry* dir = newEntry(name, parent, true);
+			dir->fresh = true;
+			created.push_back(dir);
+			scanDir(state, dir, toHash);
+			markDirty(dir, dirty);
+			reshaped = true;
+		} else if (isFile) {
+			if (existing && existing->size == (uint64_t)info.st_size && existing->mtimeNs == mtimeNs(info))
+				continue;
+			if (!existing) {
+				existing = newEntry(name, parent, false);
+				existing->fresh = true;
+				created.push_back(existing);
+				reshaped = true;
+			}
+			existing->size = info.st_size;
+			existing->mtimeNs = mtimeNs(info);
+			toHash.push_back(existing);
+			markDirty(parent, dirty);
+		}
+	}
+
+	hashFiles(state, toHash);
+	for (size_t i = 0; i < created.size(); ++i) {
+		/* A new directory's subdirectories were never marked; compute them all */
+		if (created[i]->isDir)
+			computeAll(state, created[i]);
+		created[i]->fresh = false;
+	}
+
+	/* Recompute the touched directories, deepest first, so every child is current */
+	sort(dirty.begin(), dirty.end(), deeperFirst);
+	for (size_t i = 0; i < dirty.size(); ++i) {
+		computeDir(state, dirty[i]);
+		dirty[i]->dirty = false;
+	}
+	if (toHash.empty() && dirty.empty())
+		return true;
+
+	if (reshaped) {
+		if (!writeManifest(state))
+			return false;
+	} else {
+		vector<TreeEntry*> changed(toHash);
+		changed.insert(changed.end(), dirty.begin(), dirty.end());
+		updateManifest(state, changed);
+	}
+	fprintf(stderr, "Rehashed %zu file(s), recomputed %zu directories%s in %.1f ms; root %s\n", toHash.size(),
+	        dirty.size(), reshaped ? " and rewrote the manifest" : "", (monotonicNow() - startTime) * 1e3,
+	        hexRoot(state).c_str());
+	return true;
+}
+
+/**
+ * Reads the queued inotify events into the set of changed paths
+ * @param rescan - set when the kernel dropped events
+ * @param topGone - set when the watched directory itself was removed or moved
+ */
+static void readEvents(WatchState& state, set<string>& pending, bool& rescan, bool& topGone) {
+	char buffer[65536] __attribute__((aligned(__alignof__(struct inotify_event))));
+	ssize_t got = read(state.inotifyFd, buffer, sizeof(buffer));
+	if (got <= 0)
+		return;
+	for (char* p = buffer; p < buffer + got;) {
+		struct inotify_event* event = (struct inotify_event*)p;
+		p += sizeof(struct inotify_event) + event->len;
+		if (event->mask & IN_Q_OVERFLOW) {
+			rescan = true;
+			continue;
+		}
+		map<int, TreeEntry*>::iterator it = state.watches.find(event->wd);
+		if (it == state.watches.end() || (event->mask & IN_IGNORED))
+			continue;
+		if ((event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)) && it->second == state.top)
+			topGone = true;
+		if (event->len)
+			pending.insert(joinPath(entryPath(it->second), event->name));
+	}
+}
+
+int runWatchDaemon(const string& dir, const string& manifestPath, int alg, ReadEngine engine, size_t threads) {
+	struct stat info;
+	if (stat(dir.c_str(), &info) < 0) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return 1;
+	}
+	if (!S_ISDIR(info.st_mode)) {
+		fprintf(stderr, "%s: not a directory\n", dir.c_str());
+		return 1;
+	}
+
+	WatchState state;
+	state.root = dir.size() > 1 && dir[dir.size() - 1] == '/' ? dir.substr(0, dir.size() - 1) : dir;
+	state.manifestPath = manifestPath;
+	state.alg = alg;
+	state.engine = engine;
+	state.threads = threads;
+	state.top = newEntry("", NULL, true);
+	state.manifestFd = -1;
+	state.header = NULL;
+	state.mappedLength = 0;
+	state.fileCount = 0;
+	state.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (state.inotifyFd < 0) {
+		perror("Failed to initialize inotify");
+		return 1;
+	}
+
+	/* No SA_RESTART, so a signal interrupts poll() */
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onStopSignal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	int status = rebuild(state) ? 0 : 1;
+	while (status == 0 && !stopSignalled) {
+		struct pollfd pfd = {state.inotifyFd, POLLIN, 0};
+		if (poll(&pfd, 1, -1) <= 0)
+			continue;
+
+		/* Coalesce a burst: wait until it goes quiet, but not forever */
+		set<string> pending;
+		bool rescan = false, topGone = false;
+		double deadline = monotonicNow() + WATCH_MAX_DELAY_MS / 1e3;
+		for (;;) {
+			readEvents(state, pending, rescan, topGone);
+			int timeout = min(WATCH_QUIET_MS, (int)((deadline - monotonicNow()) * 1e3));
+			if (timeout <= 0 || stopSignalled || poll(&pfd, 1, timeout) <= 0)
+				break;
+		}
+
+		if (topGone) {
+			fprintf(stderr, "%s: the watched directory is gone\n", state.root.c_str());
+			status = 1;
+		} else if (rescan) {
+			fprintf(stderr, "The event queue overflowed; rescanning\n");
+			status = rebuild(state) ? 0 : 1;
+		} else if (!applyChanges(state, pending)) {
+			status = 1;
+		}
+	}
+
+	deleteSubtree(state, state.top);
+	unmapManifest(state);
+	close(state.inotifyFd);
+	return status;
+}
+
+/**
+ * Finds the node of a relative path in a mapped manifest
+ * @return the node index, or -1
+ */
+static long lookupNode(const ManifestHeader* header, const string& path) {
+	const ManifestNode* nodes = (const ManifestNode*)(header + 1);
+	const char* names = (const char*)(nodes + header->nodeCount);
+	uint64_t index = 0;
+	size_t start = 0;
+	while (start <= path.size()) {
+		size_t slash = path.find('/', start);
+		if (slash == string::npos)
+			slash = path.size();
+		string component = path.substr(start, slash - start);
+		start = slash + 1;
+		if (component.empty() || component == ".")
+			continue;
+
+		const ManifestNode& node = nodes[index];
+		if (!node.isDir || node.firstChild > header->nodeCount || node.childCount > header->nodeCount - node.firstChild)
+			return -1;
+		/* Children are sorted by name in byte order */
+		uint64_t low = node.firstChild, high = node.firstChild + node.childCount;
+		bool found = false;
+		while (low < high) {
+			uint64_t middle = low + (high - low) / 2;
+			const ManifestNode& child = nodes[middle];
+			if ((uint64_t)child.nameOffset + child.nameLength > header->namesLength)
+				return -1;
+			int order = memcmp(names + child.nameOffset, component.data(), min((size_t)child.nameLength, component.size()));
+			if (order == 0)
+				order = child.nameLength < component.size() ? -1 : child.nameLength > component.size() ? 1 : 0;
+			if (order == 0) {
+				index = middle;
+				found = true;
+				break;
+			}
+			if (order < 0)
+				low = middle + 1;
+			else
+				high = middle;
+		}
+		if (!found)
+			return -1;
+	}
+	return index;
+}
+
+bool queryManifest(const string& manifestPath, const vector<string>& paths, vector<ManifestEntry>& entries,
+                   vector<bool>& found) {
+	for (;;) {
+		int fd = open(manifestPath.c_str(), O_RDONLY);
+		struct stat info;
+		if (fd < 0 || fstat(fd, &info) < 0) {
+			fprintf(stderr, "%s: %s\n", manifestPath.c_str(), strerror(errno));
+			if (fd >= 0)
+				close(fd);
+			return false;
+		}
+		size_t length = info.st_size;
+		void* mapping = length >= sizeof(ManifestHeader) ? mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		close(fd);
+		const ManifestHeader* header = (const ManifestHeader*)mapping;
+		if (mapping == MAP_FAILED || memcmp(header->magic, manifestMagic, sizeof(manifestMagic)) != 0 ||
+		    header->version != DIR_MANIFEST_VERSION || header->alg >= ALG_COUNT || header->nodeCount == 0 ||
+		    header->nodeCount > (length - sizeof(ManifestHeader)) / sizeof(ManifestNode) ||
+		    header->namesLength > length - sizeof(ManifestHeader) - header->nodeCount * sizeof(ManifestNode)) {
+			fprintf(stderr, "%s: not a directory manifest\n", manifestPath.c_str());
+			if (mapping != MAP_FAILED)
+				munmap(mapping, length);
+			return false;
+		}
+
+		/* Read under the sequence lock: retry while the daemon is writing */
+		const ManifestNode* nodes = (const ManifestNode*)(header + 1);
+		bool superseded = false;
+		for (;;) {
+			uint64_t sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+			if (sequence & 1) {
+				sched_yield();
+				continue;
+			}
+			superseded = __atomic_load_n(&header->superseded, __ATOMIC_ACQUIRE);
+			if (superseded)
+				break;
+			entries.assign(paths.size(), ManifestEntry());
+			found.assign(paths.size(), false);
+			for (size_t i = 0; i < paths.size(); ++i) {
+				long index = lookupNode(header, paths[i]);
+				if (index < 0)
+					continue;
+				found[i] = true;
+				entries[i].isDir = nodes[index].isDir;
+				entries[i].size = nodes[index].size;
+				entries[i].hexDigest = toHex(nodes[index].digest, hashAlgs[header->alg].digestLength);
+			}
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == sequence)
+				break;
+		}
+		munmap(mapping, length);
+		/* A newer manifest replaced this one while we looked */
+		if (!superseded)
+			return true;
+	}
+}
+
+int runQuery(const string& manifestPath, const vector<string>& paths) {
+	vector<string> queries(paths);
+	if (queries.empty())
+		queries.push_back(".");
+	vector<ManifestEntry> entries;
+	vector<bool> found;
+	if (!queryManifest(manifestPath, queries, entries, found))
+		return 1;
+
+	int status = 0;
+	for (size_t i = 0; i < queries.size(); ++i) {
+		if (!found[i]) {
+			fprintf(stderr, "%s: not in the manifest\n", queries[i].c_str());
+			status = 1;
+			continue;
+		}
+		fprintf(stdout, "%s  %s%s\n", entries[i].hexDigest.c_str(), queries[i].c_str(), entries[i].isDir ? "/" : "");
+	}
+	fflush(stdout);
+	return status;
+}
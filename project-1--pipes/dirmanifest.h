@@ -0,0 +1,125 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef DIRMANIFEST_H
+#define DIRMANIFEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "readengine.h"
+
+/*
+ * Directory Merkle manifest (version 1)
+ *
+ * Every regular file of a tree is a leaf whose digest is the plain digest of
+ * its contents, the same value the *sum programs print. With H the selected
+ * algorithm and || concatenation, a directory is
+ *
+ *   dir = H(0x01 || entry || entry || ...)
+ *   entry = type || name || 0x00 || digest    (type 0x00 file, 0x01 directory)
+ *
+ * over its children sorted by name (byte order). Symbolic links and other
+ * special files are left out. The root of the tree is the digest of the
+ * top directory.
+ *
+ * The manifest is a file that the daemon keeps mapped with MAP_SHARED and
+ * other processes map read-only:
+ *
+ *   ManifestHeader | ManifestNode[nodeCount] | names[namesLength]
+ *
+ * Nodes are stored breadth first with the children of a directory next to
+ * each other in name order, so a lookup binary searches one path component
+ * at a time. Content changes are written in place under a sequence lock:
+ * the daemon makes sequence odd, writes, and makes it even again; a reader
+ * retries whenever it saw an odd or changed sequence. Changes to the shape
+ * of the tree write a new file and rename() it over the old one, and mark
+ * the old header superseded so a reader holding it opens the path again.
+ */
+
+/* The layout version written into new manifests */
+#define DIR_MANIFEST_VERSION 1
+
+/* How long the daemon waits for a burst of changes to go quiet, and at most */
+#define WATCH_QUIET_MS 100
+#define WATCH_MAX_DELAY_MS 1000
+
+/* The fixed header at the start of a manifest */
+struct ManifestHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t alg;
+	uint32_t digestLength;
+	/* Nonzero once a newer file was renamed over this one */
+	uint32_t superseded;
+	/* Odd while the daemon writes; bumped twice per update */
+	uint64_t sequence;
+	uint64_t nodeCount;
+	uint64_t namesLength;
+	/* The number of files and their total size */
+	uint64_t fileCount;
+	uint64_t totalBytes;
+};
+
+/* One file or directory of a manifest */
+struct ManifestNode {
+	/* The index of the parent; the root is its own parent */
+	uint32_t parent;
+	/* The children of a directory are nodes firstChild .. firstChild + childCount - 1 */
+	uint32_t firstChild;
+	uint32_t childCount;
+	/* The name, relative to the parent, in the names area */
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint8_t isDir;
+	uint8_t reserved[3];
+	uint64_t size;
+	int64_t mtimeNs;
+	unsigned char digest[64];
+};
+
+/* The answer to one query */
+struct ManifestEntry {
+	bool isDir;
+	/* For a directory, the total size of the files below it */
+	uint64_t size;
+	std::string hexDigest;
+};
+
+/**
+ * Builds the manifest of a tree, hashing its files in parallel, then keeps
+ * it current: inotify reports changes, bursts are coalesced, only changed
+ * files are rehashed and only their ancestors recomputed. Runs until
+ * SIGINT or SIGTERM.
+ * @param dir - the top of the tree
+ * @param manifestPath - the manifest file to maintain
+ * @param alg - the algorithm
+ * @param engine - the read engine of the parallel hashing
+ * @param threads - the number of digest threads
+ * @return the exit status
+ */
+int runWatchDaemon(const std::string& dir, const std::string& manifestPath, int alg, ReadEngine engine,
+                   size_t threads);
+
+/**
+ * Looks paths up in a manifest without any help from the daemon
+ * @param manifestPath - the manifest
+ * @param paths - paths relative to the top of the tree; "" or "." is the root
+ * @param entries - receives one entry per path
+ * @param found - receives whether each path is in the manifest
+ * @return false if the manifest cannot be read (a message was printed)
+ */
+bool queryManifest(const std::string& manifestPath, const std::vector<std::string>& paths,
+                   std::vector<ManifestEntry>& entries, std::vector<bool>& found);
+
+/**
+ * Runs --query: prints "<hex>  <path>" per path, or the root if none is given
+ * @return 0 if every path was found, 1 otherwise
+ */
+int runQuery(const std::string& manifestPath, const std::vector<std::string>& paths);
+
+#endif
@@ -0,0 +1,97 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "frame.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+bool writeAll(int fd, const void* buffer, size_t len) {
+	const char* data = (const char*)buffer;
+	while (len > 0) {
+		ssize_t sent = write(fd, data, len);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += sent;
+		len -= sent;
+	}
+	return true;
+}
+
+/**
+ * Reads exactly len bytes unless the other end is closed first
+ * @return the number of bytes read, or -1 on an error
+ */
+static ssize_t readAll(int fd, char* data, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		ssize_t got = read(fd, data + done, len - done);
+		if (got < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (got == 0)
+			break;
+		done += got;
+	}
+	return done;
+}
+
+bool writeFrame(int fd, const string& payload) {
+	if (payload.size() > MAX_FRAME_LENGTH) {
+		errno = EMSGSIZE;
+		return false;
+	}
+	/* Send the header and a small payload in one write so it stays atomic on a pipe,
+	   gathering them with writev() rather than copying the payload behind the header */
+	uint32_t length = payload.size();
+	struct iovec parts[2] = {{&length, FRAME_HEADER_LENGTH}, {(void*)payload.data(), payload.size()}};
+	ssize_t sent;
+	do
+		sent = writev(fd, parts, 2);
+	while (sent < 0 && errno == EINTR);
+	if (sent < 0)
+		return false;
+
+	/* A short write leaves the rest of the header, then the rest of the payload */
+	size_t headerSent = min((size_t)sent, (size_t)FRAME_HEADER_LENGTH);
+	return writeAll(fd, (const char*)&length + headerSent, FRAME_HEADER_LENGTH - headerSent) &&
+	       writeAll(fd, payload.data() + (sent - headerSent), payload.size() - (sent - headerSent));
+}
+
+int readFrame(int fd, string& payload) {
+	uint32_t length;
+	ssize_t got = readAll(fd, (char*)&length, FRAME_HEADER_LENGTH);
+	if (got == 0)
+		return 0;
+	if (got != FRAME_HEADER_LENGTH || length > MAX_FRAME_LENGTH)
+		return -1;
+
+	payload.resize(length);
+	if (length && readAll(fd, &payload[0], length) != (ssize_t)length)
+		return -1;
+	return 1;
+}
+
+bool extractFrame(string& buffer, string& payload) {
+	if (buffer.size() < FRAME_HEADER_LENGTH)
+		return false;
+	uint32_t length;
+	memcpy(&length, buffer.data(), FRAME_HEADER_LENGTH);
+	if (buffer.size() < FRAME_HEADER_LENGTH + (size_t)length)
+		return false;
+	payload.assign(buffer, FRAME_HEADER_LENGTH, length);
+	buffer.erase(0, FRAME_HEADER_LENGTH + (size_t)length);
+	return true;
+}
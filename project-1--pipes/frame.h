@@ -0,0 +1,58 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Messages between the parent and its children are framed as a 4-byte
+ * length in host byte order followed by that many payload bytes. Both
+ * ends always run on the same machine, so no byte swapping is needed.
+ */
+
+/* The size of the length prefix */
+#define FRAME_HEADER_LENGTH 4
+
+/* The largest payload accepted from the other end */
+#define MAX_FRAME_LENGTH (64u << 20)
+
+/**
+ * Writes a whole buffer, retrying short and interrupted writes
+ * @param fd - a pipe, socket or file
+ * @param data - the bytes to write
+ * @param len - their number
+ * @return false on a write error (errno is set)
+ */
+bool writeAll(int fd, const void* data, size_t len);
+
+/**
+ * Writes one framed message, retrying short writes
+ * @param fd - the write end of a pipe
+ * @param payload - the message
+ * @return false on a write error (errno is set)
+ */
+bool writeFrame(int fd, const std::string& payload);
+
+/**
+ * Reads one framed message, blocking until it is complete
+ * @param fd - the read end of a pipe
+ * @param payload - receives the message
+ * @return 1 on success, 0 on a clean end of file, -1 on an error or a truncated frame
+ */
+int readFrame(int fd, std::string& payload);
+
+/**
+ * Removes the first complete frame from bytes received so far (for poll() loops)
+ * @param buffer - the bytes received; the frame is erased from its front
+ * @param payload - receives the message
+ * @return true if a whole frame was available
+ */
+bool extractFrame(std::string& buffer, std::string& payload);
+
+#endif
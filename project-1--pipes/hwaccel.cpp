@@ -0,0 +1,202 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "hwaccel.h"
+#include "multibuffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* The CPUID feature bits we need, read once */
+struct CpuFeatures {
+	bool sha;
+	bool sse41;
+	bool sse42;
+
+	CpuFeatures() : sha(false), sse41(false), sse42(false) {
+		unsigned int eax, ebx, ecx, edx;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+			sse41 = (ecx & bit_SSE4_1) != 0;
+			sse42 = (ecx & bit_SSE4_2) != 0;
+		}
+		if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+			sha = (ebx & (1u << 29)) != 0;
+	}
+};
+
+static const CpuFeatures& cpuFeatures() {
+	static const CpuFeatures features;
+	return features;
+}
+
+bool shaExtensionsEnabled() {
+	return simdLevel() != SIMD_SCALAR && cpuFeatures().sha && cpuFeatures().sse41;
+}
+
+bool crc32InstructionEnabled() {
+	return simdLevel() != SIMD_SCALAR && cpuFeatures().sse42;
+}
+
+/* ------------------------
+   SHA-1 with SHA extensions
+   ------------------------ */
+
+/**
+ * Runs the message schedule and rounds of groups [first, last) of four
+ * rounds each; the round function selector must be an immediate
+ * @param FUNC - the round function of these groups (group / 5)
+ * @param previous - the state before the previous group, from which E is derived
+ */
+template <int FUNC>
+__attribute__((target("sha,sse4.1")))
+static inline void sha1Groups(__m128i& abcd, __m128i& previous, __m128i* msg, int first, int last) {
+	for (int group = first; group < last; ++group) {
+		if (group >= 4) {
+			__m128i w = _mm_sha1msg1_epu32(msg[group & 3], msg[(group + 1) & 3]);
+			w = _mm_xor_si128(w, msg[(group + 2) & 3]);
+			msg[group & 3] = _mm_sha1msg2_epu32(w, msg[(group + 3) & 3]);
+		}
+		__m128i e = _mm_sha1nexte_epu32(previous, msg[group & 3]);
+		previous = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e, FUNC);
+	}
+}
+
+__attribute__((target("sha,sse4.1")))
+void sha1CompressShaNi(uint32_t state[5], const unsigned char* blocks, size_t count) {
+	/* Reverses the bytes of the whole register: big-endian words in reverse lane order */
+	const __m128i byteSwap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+	__m128i abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1b);
+	__m128i e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	for (; count--; blocks += 64) {
+		__m128i abcdSave = abcd;
+		__m128i e0Save = e0;
+
+		/* The message schedule in four rolling groups of four words */
+		__m128i msg[4];
+		for (int i = 0; i < 4; ++i)
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 16 * i)), byteSwap);
+
+		/* The first group takes E from the chaining value, every later one from the A of two groups back */
+		__m128i previous = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, _mm_add_epi32(e0, msg[0]), 0);
+		sha1Groups<0>(abcd, previous, msg, 1, 5);
+		sha1Groups<1>(abcd, previous, msg, 5, 10);
+		sha1Groups<2>(abcd, previous, msg, 10, 15);
+		sha1Groups<3>(abcd, previous, msg, 15, 20);
+
+		e0 = _mm_sha1nexte_epu32(previous, e0Save);
+		abcd = _mm_add_epi32(abcd, abcdSave);
+	}
+
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(abcd, 0x1b));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+/* --------------------------
+   SHA-256 with SHA extensions
+   -------------------------- */
+
+__attribute__((target("sha,sse4.1")))
+void sha256CompressShaNi(uint32_t state[8], const unsigned char* blocks, size_t count) {
+	/* Swaps the bytes of each 32-bit word */
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	/* The instructions keep the state as ABEF and CDGH */
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[0]), 0xb1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&state[4]), 0x1b);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	for (; count--; blocks += 64) {
+		__m128i abefSave = state0;
+		__m128i cdghSave = state1;
+
+		__m128i msg[4];
+		for (int i = 0; i < 4; ++i)
+			msg[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(blocks + 16 * i)), byteSwap);
+
+		for (int group = 0; group < 16; ++group) {
+			__m128i k = _mm_loadu_si128((const __m128i*)&sha256K[4 * group]);
+			__m128i wk = _mm_add_epi32(msg[group & 3], k);
+			state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+
+			/* Schedule the words four groups ahead while the slot's current words are no longer needed */
+			if (group < 12) {
+				__m128i w = _mm_sha256msg1_epu32(msg[group & 3], msg[(group + 1) & 3]);
+				w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(group + 3) & 3], msg[(group + 2) & 3], 4));
+				msg[group & 3] = _mm_sha256msg2_epu32(w, msg[(group + 3) & 3]);
+			}
+
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0e));
+		}
+
+		state0 = _mm_add_epi32(state0, abefSave);
+		state1 = _mm_add_epi32(state1, cdghSave);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	_mm_storeu_si128((__m128i*)&state[0], _mm_blend_epi16(tmp, state1, 0xf0));
+	_mm_storeu_si128((__m128i*)&state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+/* ------------------------
+   CRC32C with SSE4.2
+   ------------------------ */
+
+__attribute__((target("sse4.2")))
+uint32_t crc32cUpdateSse42(uint32_t crc, const unsigned char* data, size_t len) {
+#if defined(__x86_64__)
+	uint64_t wide = crc;
+	for (; len >= 8; data += 8, len -= 8) {
+		uint64_t word;
+		memcpy(&word, data, 8);
+		wide = _mm_crc32_u64(wide, word);
+	}
+	crc = (uint32_t)wide;
+#endif
+	for (; len >= 4; data += 4, len -= 4) {
+		uint32_t word;
+		memcpy(&word, data, 4);
+		crc = _mm_crc32_u32(crc, word);
+	}
+	while (len--)
+		crc = _mm_crc32_u8(crc, *data++);
+	return crc;
+}
+
+#else
+
+/* No kernels for this architecture: the portable code always runs */
+
+bool shaExtensionsEnabled() {
+	return false;
+}
+
+bool crc32InstructionEnabled() {
+	return false;
+}
+
+void sha1CompressShaNi(uint32_t*, const unsigned char*, size_t) {
+	abort();
+}
+
+void sha256CompressShaNi(uint32_t*, const unsigned char*, size_t) {
+	abort();
+}
+
+uint32_t crc32cUpdateSse42(uint32_t, const unsigned char*, size_t) {
+	abort();
+}
+
+#endif
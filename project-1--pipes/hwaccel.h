@@ -0,0 +1,56 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef HWACCEL_H
+#define HWACCEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Digest kernels built on dedicated CPU instructions: the x86 SHA extensions
+ * (SHA-NI) for SHA-1 and SHA-256, and the SSE4.2 crc32 instruction for
+ * CRC32C. They are compiled with target() attributes and only called after
+ * the run-time checks below succeed; the digests fall back to portable code
+ * otherwise, and on every other architecture.
+ */
+
+/**
+ * @return whether SHA-1 and SHA-256 should use the SHA extensions: the CPU
+ *         has them and --simd scalar did not rule out vector code
+ */
+bool shaExtensionsEnabled();
+
+/**
+ * @return whether CRC32C should use the SSE4.2 crc32 instruction (same rules)
+ */
+bool crc32InstructionEnabled();
+
+/**
+ * Runs the SHA-1 compression function with the SHA extensions
+ * @param state - the five chaining words
+ * @param blocks - the 64-byte input blocks
+ * @param count - the number of blocks
+ */
+void sha1CompressShaNi(uint32_t state[5], const unsigned char* blocks, size_t count);
+
+/**
+ * Runs the SHA-256 compression function with the SHA extensions
+ * @param state - the eight chaining words
+ * @param blocks - the 64-byte input blocks
+ * @param count - the number of blocks
+ */
+void sha256CompressShaNi(uint32_t state[8], const unsigned char* blocks, size_t count);
+
+/**
+ * Folds bytes into a CRC32C register with the crc32 instruction
+ * @param crc - the register (already inverted, as the table code keeps it)
+ * @param data - the bytes
+ * @param len - the number of bytes
+ * @return the updated register
+ */
+uint32_t crc32cUpdateSse42(uint32_t crc, const unsigned char* data, size_t len);
+
+#endif
@@ -0,0 +1,385 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "multibuffer.h"
+
+#include <algorithm>
+#include <string.h>
+#include <strings.h>
+#include <vector>
+
+using namespace std;
+
+/*
+ * The kernels are written once against GCC/Clang generic vectors of N
+ * 32-bit lanes and instantiated inside functions carrying a target()
+ * attribute, so a single binary holds SSE2, AVX2 and AVX-512 versions and
+ * picks one at run time. Lanes whose message has no block left at a given
+ * step still compute, but a mask keeps their state unchanged.
+ */
+
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+
+/* The helpers pass vectors by value, but they are always inlined, so no call ABI is involved */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+template <int N>
+struct LaneVector {
+	typedef uint32_t Type __attribute__((vector_size(N * 4)));
+};
+
+/* One message prepared for the kernels: whole blocks come straight from the
+   message, the padded tail from a private buffer */
+struct LaneMessage {
+	const unsigned char* data;
+	size_t fullBlocks;
+	size_t blockCount;
+	unsigned char tail[128];
+
+	/**
+	 * @param bigEndianLength - the byte order of the length field (SHA-2: true, MD5: false)
+	 */
+	void prepare(const unsigned char* message, size_t length, bool bigEndianLength) {
+		data = message;
+		fullBlocks = length / 64;
+		size_t tailLength = length % 64;
+		size_t tailBlocks = tailLength + 1 + 8 <= 64 ? 1 : 2;
+		blockCount = fullBlocks + tailBlocks;
+
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, message + fullBlocks * 64, tailLength);
+		tail[tailLength] = 0x80;
+		uint64_t bitLength = (uint64_t)length * 8;
+		unsigned char* lengthField = tail + tailBlocks * 64 - 8;
+		for (int i = 0; i < 8; ++i)
+			lengthField[i] = bigEndianLength ? bitLength >> (56 - 8 * i) : bitLength >> (8 * i);
+	}
+
+	const unsigned char* block(size_t index) const {
+		return index < fullBlocks ? data + index * 64 : tail + (index - fullBlocks) * 64;
+	}
+};
+
+/* The block fed to lanes that are already finished */
+static const unsigned char idleBlock[64] = {0};
+
+template <int N>
+static ALWAYS_INLINE typename LaneVector<N>::Type rotr(typename LaneVector<N>::Type x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+template <int N>
+static ALWAYS_INLINE typename LaneVector<N>::Type loadLanes(const uint32_t* words) {
+	typename LaneVector<N>::Type v;
+	memcpy(&v, words, sizeof(v));
+	return v;
+}
+
+template <int N>
+static ALWAYS_INLINE void storeLanes(uint32_t* words, typename LaneVector<N>::Type v) {
+	memcpy(words, &v, sizeof(v));
+}
+
+/**
+ * One SHA-256 compression per lane
+ * @param state - state[word][lane]
+ * @param blocks - one 64-byte block per lane
+ * @param active - all ones for lanes whose state may change, zero otherwise
+ */
+template <int N>
+static ALWAYS_INLINE void sha256Compress(uint32_t state[8][N], const unsigned char* const* blocks, const uint32_t* active) {
+	typedef typename LaneVector<N>::Type V;
+
+	/* Transpose the message words so that w[i] holds word i of every lane */
+	uint32_t words[16][N];
+	for (int lane = 0; lane < N; ++lane) {
+		const unsigned char* p = blocks[lane];
+		for (int i = 0; i < 16; ++i, p += 4)
+			words[i][lane] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	}
+
+	V w[64];
+	for (int i = 0; i < 16; ++i)
+		w[i] = loadLanes<N>(words[i]);
+	for (int i = 16; i < 64; ++i) {
+		V s0 = rotr<N>(w[i - 15], 7) ^ rotr<N>(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		V s1 = rotr<N>(w[i - 2], 17) ^ rotr<N>(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	V s[8];
+	for (int j = 0; j < 8; ++j)
+		s[j] = loadLanes<N>(state[j]);
+	V a = s[0], b = s[1], c = s[2], d = s[3], e = s[4], f = s[5], g = s[6], h = s[7];
+	for (int i = 0; i < 64; ++i) {
+		V t1 = h + (rotr<N>(e, 6) ^ rotr<N>(e, 11) ^ rotr<N>(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+		V t2 = (rotr<N>(a, 2) ^ rotr<N>(a, 13) ^ rotr<N>(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	V mask = loadLanes<N>(active);
+	V result[8] = {a, b, c, d, e, f, g, h};
+	for (int j = 0; j < 8; ++j)
+		storeLanes<N>(state[j], s[j] + (result[j] & mask));
+}
+
+/**
+ * One MD5 compression per lane; see sha256Compress()
+ */
+template <int N>
+static ALWAYS_INLINE void md5Compress(uint32_t state[4][N], const unsigned char* const* blocks, const uint32_t* active) {
+	typedef typename LaneVector<N>::Type V;
+
+	uint32_t words[16][N];
+	for (int lane = 0; lane < N; ++lane) {
+		const unsigned char* p = blocks[lane];
+		for (int i = 0; i < 16; ++i, p += 4)
+			words[i][lane] = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+	V m[16];
+	for (int i = 0; i < 16; ++i)
+		m[i] = loadLanes<N>(words[i]);
+
+	V s[4];
+	for (int j = 0; j < 4; ++j)
+		s[j] = loadLanes<N>(state[j]);
+	V a = s[0], b = s[1], c = s[2], d = s[3];
+	for (int i = 0; i < 64; ++i) {
+		V f;
+		int g;
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		V x = a + f + md5K[i] + m[g];
+		V tmp = d;
+		d = c;
+		c = b;
+		b = b + ((x << md5Shift[i]) | (x >> (32 - md5Shift[i])));
+		a = tmp;
+	}
+
+	V mask = loadLanes<N>(active);
+	V result[4] = {a, b, c, d};
+	for (int j = 0; j < 4; ++j)
+		storeLanes<N>(state[j], s[j] + (result[j] & mask));
+}
+
+/**
+ * Hashes up to N prepared messages with one algorithm
+ * @param lanes - the messages; lanes past count are idle
+ * @param count - the number of messages
+ * @param digests - receives one digest per message
+ */
+template <int N>
+static ALWAYS_INLINE void hashLanes(int alg, const LaneMessage* lanes, size_t count,
+                                    unsigned char (*digests)[MAX_DIGEST_LENGTH]) {
+	const bool isMd5 = alg == ALG_MD5;
+	const int words = isMd5 ? 4 : 8;
+
+	uint32_t state[8][N];
+	for (int lane = 0; lane < N; ++lane) {
+		for (int j = 0; j < words; ++j) {
+			static const uint32_t md5Iv[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+			state[j][lane] = isMd5 ? md5Iv[j] : alg == ALG_SHA224 ? sha224Iv[j] : sha256Iv[j];
+		}
+	}
+
+	size_t maxBlocks = 0;
+	for (size_t lane = 0; lane < count; ++lane)
+		maxBlocks = max(maxBlocks, lanes[lane].blockCount);
+
+	const unsigned char* blocks[N];
+	uint32_t active[N];
+	for (size_t index = 0; index < maxBlocks; ++index) {
+		for (size_t lane = 0; lane < (size_t)N; ++lane) {
+			bool live = lane < count && index < lanes[lane].blockCount;
+			blocks[lane] = live ? lanes[lane].block(index) : idleBlock;
+			active[lane] = live ? 0xffffffffu : 0;
+		}
+		if (isMd5)
+			md5Compress<N>((uint32_t(*)[N])state, blocks, active);
+		else
+			sha256Compress<N>(state, blocks, active);
+	}
+
+	size_t length = hashAlgs[alg].digestLength;
+	for (size_t lane = 0; lane < count; ++lane) {
+		for (size_t j = 0; j < length / 4; ++j) {
+			uint32_t v = state[j][lane];
+			unsigned char* out = digests[lane] + 4 * j;
+			if (isMd5) {
+				out[0] = v; out[1] = v >> 8; out[2] = v >> 16; out[3] = v >> 24;
+			} else {
+				out[0] = v >> 24; out[1] = v >> 16; out[2] = v >> 8; out[3] = v;
+			}
+		}
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MULTI_BUFFER_X86 1
+
+__attribute__((target("avx512f")))
+static void hashLanes16(int alg, const LaneMessage* lanes, size_t count, unsigned char (*digests)[MAX_DIGEST_LENGTH]) {
+	hashLanes<16>(alg, lanes, count, digests);
+}
+
+__attribute__((target("avx2")))
+static void hashLanes8(int alg, const LaneMessage* lanes, size_t count, unsigned char (*digests)[MAX_DIGEST_LENGTH]) {
+	hashLanes<8>(alg, lanes, count, digests);
+}
+#endif
+
+/* 128-bit vectors: SSE2 on x86-64, NEON on ARMv8, plain code elsewhere */
+static void hashLanes4(int alg, const LaneMessage* lanes, size_t count, unsigned char (*digests)[MAX_DIGEST_LENGTH]) {
+	hashLanes<4>(alg, lanes, count, digests);
+}
+
+/* The detected level, and the level requested with setSimdLevel() */
+static SimdLevel detectedLevel = SIMD_SCALAR;
+static SimdLevel requestedLevel = SIMD_AVX512;
+static bool detected = false;
+
+SimdLevel simdLevel() {
+	if (!detected) {
+#ifdef MULTI_BUFFER_X86
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			detectedLevel = SIMD_AVX512;
+		else if (__builtin_cpu_supports("avx2"))
+			detectedLevel = SIMD_AVX2;
+		else
+			detectedLevel = SIMD_SSE2;
+#else
+		detectedLevel = SIMD_SSE2;
+#endif
+		detected = true;
+	}
+	return min(detectedLevel, requestedLevel);
+}
+
+void setSimdLevel(SimdLevel level) {
+	requestedLevel = level;
+}
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_AVX512:
+		return "avx512";
+	case SIMD_AVX2:
+		return "avx2";
+	case SIMD_SSE2:
+#ifdef MULTI_BUFFER_X86
+		return "sse2";
+#else
+		return "vec128";
+#endif
+	default:
+		return "scalar";
+	}
+}
+
+bool parseSimdLevel(const char* name, SimdLevel& level) {
+	static const struct {
+		const char* name;
+		SimdLevel level;
+	} names[] = {
+		{"scalar", SIMD_SCALAR}, {"sse2", SIMD_SSE2}, {"vec128", SIMD_SSE2},
+		{"avx2", SIMD_AVX2}, {"avx512", SIMD_AVX512}, {"auto", SIMD_AVX512},
+	};
+	for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (!strcasecmp(name, names[i].name)) {
+			level = names[i].level;
+			return true;
+		}
+	}
+	return false;
+}
+
+size_t multiBufferLanes(int alg) {
+	if (alg != ALG_MD5 && alg != ALG_SHA224 && alg != ALG_SHA256)
+		return 1;
+	switch (simdLevel()) {
+	case SIMD_AVX512:
+		return 16;
+	case SIMD_AVX2:
+		return 8;
+	case SIMD_SSE2:
+		return 4;
+	default:
+		return 1;
+	}
+}
+
+/* Sorts message indices by length so each group's lanes finish together */
+struct ShorterMessage {
+	const size_t* lengths;
+	bool operator()(size_t a, size_t b) const { return lengths[a] < lengths[b]; }
+};
+
+void multiBufferHash(int alg, const unsigned char* const* messages, const size_t* lengths, size_t count,
+                     unsigned char (*digests)[MAX_DIGEST_LENGTH]) {
+	size_t lanes = multiBufferLanes(alg);
+
+	vector<size_t> order(count);
+	for (size_t i = 0; i < count; ++i)
+		order[i] = i;
+	ShorterMessage shorter = {lengths};
+	sort(order.begin(), order.end(), shorter);
+
+	LaneMessage group[MAX_MULTI_BUFFER_LANES];
+	unsigned char groupDigests[MAX_MULTI_BUFFER_LANES][MAX_DIGEST_LENGTH];
+	for (size_t start = 0; start < count; start += lanes) {
+		size_t groupSize = min(lanes, count - start);
+
+		/* A lone message gains nothing from the vector unit */
+		if (groupSize == 1) {
+			size_t i = order[start];
+			Digest* digest = createDigest(alg);
+			digest->update(messages[i], lengths[i]);
+			digest->final(digests[i]);
+			delete digest;
+			continue;
+		}
+
+		for (size_t lane = 0; lane < groupSize; ++lane) {
+			size_t i = order[start + lane];
+			group[lane].prepare(messages[i], lengths[i], alg != ALG_MD5);
+		}
+		switch (lanes) {
+#ifdef MULTI_BUFFER_X86
+		case 16:
+			hashLanes16(alg, group, groupSize, groupDigests);
+			break;
+		case 8:
+			hashLanes8(alg, group, groupSize, groupDigests);
+			break;
+#endif
+		default:
+			hashLanes4(alg, group, groupSize, groupDigests);
+		}
+		for (size_t lane = 0; lane < groupSize; ++lane)
+			memcpy(digests[order[start + lane]], groupDigests[lane], MAX_DIGEST_LENGTH);
+	}
+}
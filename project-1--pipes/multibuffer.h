@@ -0,0 +1,74 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef MULTIBUFFER_H
+#define MULTIBUFFER_H
+
+#include <stddef.h>
+
+#include "digest.h"
+
+/*
+ * Multi-buffer hashing: the same algorithm runs over several independent
+ * messages at once, one message per 32-bit lane of a SIMD register. Only
+ * algorithms built on 32-bit words (MD5, SHA-256, SHA-224) have a kernel.
+ * The lane count follows the widest instruction set the CPU supports.
+ */
+
+/* The instruction sets a kernel can be built for */
+enum SimdLevel {
+	SIMD_SCALAR = 0,
+	SIMD_SSE2,
+	SIMD_AVX2,
+	SIMD_AVX512
+};
+
+/* The largest number of lanes of any kernel */
+#define MAX_MULTI_BUFFER_LANES 16
+
+/* Files up to this size are read whole and hashed by the multi-buffer kernels in batch mode */
+#define MULTI_BUFFER_MAX_FILE_SIZE (64u << 10)
+
+/**
+ * Restricts the instruction set used by the kernels, e.g. to compare them
+ * @param level - the widest instruction set to use; it is clamped to what the CPU supports
+ */
+void setSimdLevel(SimdLevel level);
+
+/**
+ * @return the instruction set the kernels use (detected on first call)
+ */
+SimdLevel simdLevel();
+
+/**
+ * @return a printable name of an instruction set level
+ */
+const char* simdLevelName(SimdLevel level);
+
+/**
+ * Parses a --simd argument (scalar, sse2, avx2, avx512 or auto)
+ * @return false if the name is unknown
+ */
+bool parseSimdLevel(const char* name, SimdLevel& level);
+
+/**
+ * @param alg - the algorithm
+ * @return the number of messages hashed together for alg, or 1 if it has no kernel
+ */
+size_t multiBufferLanes(int alg);
+
+/**
+ * Hashes whole in-memory messages, as many at a time as there are lanes.
+ * The result is identical to hashing each message with createDigest().
+ * @param alg - the algorithm
+ * @param messages - the messages
+ * @param lengths - their lengths
+ * @param count - the number of messages
+ * @param digests - receives count digests of MAX_DIGEST_LENGTH bytes each
+ */
+void multiBufferHash(int alg, const unsigned char* const* messages, const size_t* lengths, size_t count,
+                     unsigned char (*digests)[MAX_DIGEST_LENGTH]);
+
+#endif
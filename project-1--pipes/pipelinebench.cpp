@@ -0,0 +1,455 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "pipelinebench.h"
+#include "../common/procspawn.h"
+#include "benchdata.h"
+#include "clock.h"
+#include "digest.h"
+#include "multibuffer.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/* The paths of the data sets */
+struct BenchData {
+	string root;
+	string smallDir;
+	string largeDir;
+	vector<string> smallFiles;
+	vector<string> largeFiles;
+};
+
+/**
+ * Creates a directory of a data set; one left by an earlier run is reused
+ * @return false if it could not be created (a message was printed)
+ */
+static bool createBenchDir(const string& dir) {
+	if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Creates both data sets below data.root, overwriting the files of an earlier run
+ * @return false if a file could not be written (a message was printed)
+ */
+static bool createBenchData(BenchData& data) {
+	data.smallDir = data.root + "/small";
+	data.largeDir = data.root + "/large";
+	if (!createBenchDir(data.smallDir) || !createBenchDir(data.largeDir))
+		return false;
+
+	vector<unsigned char> block(BENCH_SMALL_FILE_SIZE * BENCH_SMALL_FILES_PER_DIR);
+	fillRandom(block, 0x9e3779b97f4a7c15ULL);
+	for (int d = 0; d < BENCH_SMALL_DIRS; ++d) {
+		char name[32];
+		snprintf(name, sizeof(name), "/d%02d", d);
+		string dir = data.smallDir + name;
+		if (!createBenchDir(dir))
+			return false;
+		for (int f = 0; f < BENCH_SMALL_FILES_PER_DIR; ++f) {
+			/* Every file differs, or a cache could make the set look smaller than it is */
+			block[f * BENCH_SMALL_FILE_SIZE] = d;
+			snprintf(name, sizeof(name), "/f%03d", f);
+			data.smallFiles.push_back(dir + name);
+			if (!writeFile(data.smallFiles.back(), &block[f * BENCH_SMALL_FILE_SIZE], BENCH_SMALL_FILE_SIZE))
+				return false;
+		}
+	}
+
+	vector<unsigned char> large(BENCH_LARGE_FILE_SIZE);
+	for (int f = 0; f < BENCH_LARGE_FILES; ++f) {
+		fillRandom(large, 0x6a09e667f3bcc908ULL + f);
+		char name[32];
+		snprintf(name, sizeof(name), "/large%d", f);
+		data.largeFiles.push_back(data.largeDir + name);
+		if (!writeFile(data.largeFiles.back(), &large[0], large.size()))
+			return false;
+	}
+	return true;
+}
+
+static void removeBenchData(const BenchData& data) {
+	for (size_t i = 0; i < data.smallFiles.size(); ++i)
+		unlink(data.smallFiles[i].c_str());
+	for (size_t i = 0; i < data.largeFiles.size(); ++i)
+		unlink(data.largeFiles[i].c_str());
+	for (int d = 0; d < BENCH_SMALL_DIRS; ++d) {
+		char name[32];
+		snprintf(name, sizeof(name), "/d%02d", d);
+		rmdir((data.smallDir + name).c_str());
+	}
+	rmdir(data.smallDir.c_str());
+	rmdir(data.largeDir.c_str());
+	rmdir(data.root.c_str());
+}
+
+/**
+ * @return the average microseconds of fork() + _exit() + waitpid()
+ */
+static double timeFork(int iterations) {
+	double startTime = monotonicNow();
+	for (int i = 0; i < iterations; ++i) {
+		pid_t pid = fork();
+		if (pid == 0)
+			_exit(0);
+		if (pid > 0)
+			waitProcess(pid, NULL);
+	}
+	return (monotonicNow() - startTime) / iterations * 1e6;
+}
+
+/**
+ * @return the average microseconds of spawning a program and waiting for it
+ * @param stdoutFd - where the program writes
+ */
+static double timeSpawn(char* const argv[], int stdoutFd, int iterations) {
+	double startTime = monotonicNow();
+	for (int i = 0; i < iterations; ++i) {
+		pid_t pid = spawnProcess(argv[0], argv, -1, stdoutFd);
+		if (pid < 0)
+			return -1;
+		waitProcess(pid, NULL);
+	}
+	return (monotonicNow() - startTime) / iterations * 1e6;
+}
+
+/**
+ * @return the average microseconds of popen() + pclose() of a command line
+ */
+static double timePopen(const char* command, int iterations) {
+	double startTime = monotonicNow();
+	for (int i = 0; i < iterations; ++i) {
+		FILE* stream = popen(command, "r");
+		if (!stream)
+			return -1;
+		char buffer[256];
+		while (fread(buffer, 1, sizeof(buffer), stream) > 0)
+			;
+		pclose(stream);
+	}
+	return (monotonicNow() - startTime) / iterations * 1e6;
+}
+
+/**
+ * @return the MB/s of reading a file that is in the page cache
+ */
+static double readThroughput(const string& path) {
+	vector<char> buffer(HASH_READ_BLOCK_SIZE);
+	double best = 0;
+	for (int run = 0; run < BENCH_RUNS; ++run) {
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			return -1;
+		long long total = 0;
+		ssize_t got;
+		double startTime = monotonicNow();
+		while ((got = read(fd, &buffer[0], buffer.size())) > 0)
+			total += got;
+		double elapsed = monotonicNow() - startTime;
+		close(fd);
+		if (elapsed > 0 && total / 1e6 / elapsed > best)
+			best = total / 1e6 / elapsed;
+	}
+	return best;
+}
+
+/**
+ * @return the MB/s of moving bytes from a child through a pipe in 64 KiB writes
+ */
+static double pipeThroughput(size_t totalBytes) {
+	int fds[2];
+	if (pipe(fds) < 0)
+		return -1;
+	double startTime = monotonicNow();
+	pid_t pid = fork();
+	if (pid == 0) {
+		close(fds[0]);
+		vector<char> chunk(64 << 10, 'x');
+		for (size_t sent = 0; sent < totalBytes; sent += chunk.size()) {
+			if (write(fds[1], &chunk[0], chunk.size()) < 0)
+				_exit(1);
+		}
+		_exit(0);
+	}
+	close(fds[1]);
+	vector<char> buffer(64 << 10);
+	long long total = 0;
+	ssize_t got;
+	while ((got = read(fds[0], &buffer[0], buffer.size())) > 0)
+		total += got;
+	close(fds[0]);
+	if (pid > 0)
+		waitProcess(pid, NULL);
+	double elapsed = monotonicNow() - startTime;
+	return elapsed > 0 ? total / 1e6 / elapsed : 0;
+}
+
+/**
+ * @return the MB/s of one digest over an in-memory buffer
+ */
+static double digestThroughput(int alg, const vector<unsigned char>& buffer) {
+	Digest* digest = createDigest(alg);
+	unsigned char out[MAX_DIGEST_LENGTH];
+	digest->update(&buffer[0], buffer.size());
+	digest->final(out);
+	double best = 0;
+	for (int run = 0; run < BENCH_RUNS; ++run) {
+		digest->reset();
+		double startTime = monotonicNow();
+		digest->update(&buffer[0], buffer.size());
+		digest->final(out);
+		double elapsed = monotonicNow() - startTime;
+		if (elapsed > 0 && buffer.size() / 1e6 / elapsed > best)
+			best = buffer.size() / 1e6 / elapsed;
+	}
+	delete digest;
+	return best;
+}
+
+/* One mode of this program to time */
+struct BenchMode {
+	const char* name;
+	/* "small" or "large" */
+	const char* dataset;
+	/* The arguments before the operands; "-" operands read the first large file on stdin */
+	vector<string> args;
+	vector<string> operands;
+	size_t files;
+	long long bytes;
+};
+
+/**
+ * Runs this program once with its output discarded
+ * @return the wall time in seconds, or -1 if it failed
+ */
+static double runMode(const string& self, const BenchMode& mode, const string& stdinPath) {
+	vector<string> words(1, self);
+	words.insert(words.end(), mode.args.begin(), mode.args.end());
+	words.insert(words.end(), mode.operands.begin(), mode.operands.end());
+	vector<char*> argv;
+	for (size_t i = 0; i < words.size(); ++i)
+		argv.push_back((char*)words[i].c_str());
+	argv.push_back(NULL);
+
+	int devNull = open("/dev/null", O_WRONLY);
+	int input = stdinPath.empty() ? -1 : open(stdinPath.c_str(), O_RDONLY);
+	/* The summaries on stderr would get in the way of the JSON */
+	int savedStderr = dup(STDERR_FILENO);
+	dup2(devNull, STDERR_FILENO);
+	double startTime = monotonicNow();
+	pid_t pid = spawnProcess(argv[0], &argv[0], input, devNull);
+	int status = -1;
+	if (pid > 0)
+		waitProcess(pid, &status);
+	double elapsed = monotonicNow() - startTime;
+	dup2(savedStderr, STDERR_FILENO);
+	close(savedStderr);
+	close(devNull);
+	if (input >= 0)
+		close(input);
+	return pid > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0 ? elapsed : -1;
+}
+
+/**
+ * @return s as a JSON string literal
+ */
+static string jsonString(const string& s) {
+	string quoted = "\"";
+	for (size_t i = 0; i < s.size(); ++i) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') {
+			quoted += '\\';
+			quoted += c;
+		} else if (c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", c);
+			quoted += escape;
+		} else {
+			quoted += c;
+		}
+	}
+	return quoted + "\"";
+}
+
+/**
+ * Adds a mode to the list
+ */
+static void addMode(vector<BenchMode>& modes, const char* name, const char* dataset, const char* args, const BenchData& data) {
+	BenchMode mode;
+	mode.name = name;
+	mode.dataset = dataset;
+	/* Split the space-separated arguments */
+	string words = args;
+	for (size_t start = 0; start < words.size();) {
+		size_t space = words.find(' ', start);
+		if (space == string::npos)
+			space = words.size();
+		if (space > start)
+			mode.args.push_back(words.substr(start, space - start));
+		start = space + 1;
+	}
+	bool small = strcmp(dataset, "small") == 0;
+	bool batch = mode.args.size() && (mode.args.back() == "-r");
+	if (small) {
+		mode.operands.push_back(data.smallDir);
+		mode.files = data.smallFiles.size();
+		mode.bytes = (long long)mode.files * BENCH_SMALL_FILE_SIZE;
+	} else if (batch) {
+		mode.operands.push_back(data.largeDir);
+		mode.files = data.largeFiles.size();
+		mode.bytes = (long long)mode.files * BENCH_LARGE_FILE_SIZE;
+	} else {
+		/* The single-file modes hash the first large file */
+		mode.operands.push_back(strcmp(name, "stream") == 0 ? "-" : data.largeFiles[0]);
+		mode.files = 1;
+		mode.bytes = BENCH_LARGE_FILE_SIZE;
+	}
+	modes.push_back(mode);
+}
+
+int benchPipeline(const string& dir) {
+	BenchData data;
+	data.root = dir;
+	bool temporary = dir.empty();
+	if (temporary) {
+		const char* tmp = getenv("TMPDIR");
+		string pattern = string(tmp && *tmp ? tmp : "/var/tmp") + "/computeHashValue-pipeline.XXXXXX";
+		vector<char> name(pattern.begin(), pattern.end());
+		name.push_back('\0');
+		if (!mkdtemp(&name[0])) {
+			fprintf(stderr, "%s: %s\n", pattern.c_str(), strerror(errno));
+			return 1;
+		}
+		data.root = &name[0];
+	} else if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+		fprintf(stderr, "%s: %s\n", dir.c_str(), strerror(errno));
+		return 1;
+	}
+	fprintf(stderr, "Creating the data sets in %s...\n", data.root.c_str());
+	if (!createBenchData(data)) {
+		removeBenchData(data);
+		return 1;
+	}
+
+	char selfPath[PATH_MAX];
+	ssize_t selfLength = readlink("/proc/self/exe", selfPath, sizeof(selfPath) - 1);
+	if (selfLength < 0) {
+		perror("Failed to find this program");
+		removeBenchData(data);
+		return 1;
+	}
+	string self(selfPath, selfLength);
+
+	/* ---- Stages ---- */
+	fprintf(stderr, "Timing the stages...\n");
+	int devNull = open("/dev/null", O_WRONLY);
+	char trueName[] = "true";
+	char* trueArgv[] = {trueName, NULL};
+	string emptyFile = data.root + "/empty";
+	writeFile(emptyFile, NULL, 0);
+	char sumName[] = "sha256sum", dashes[] = "--";
+	char* sumArgv[] = {sumName, dashes, (char*)emptyFile.c_str(), NULL};
+
+	double forkUs = timeFork(200);
+	double spawnUs = timeSpawn(trueArgv, devNull, 200);
+	double popenUs = timePopen("true", 200);
+	double sumStartUs = timeSpawn(sumArgv, devNull, 100);
+	double readMBps = readThroughput(data.largeFiles[0]);
+	double pipeMBps = pipeThroughput(256u << 20);
+	close(devNull);
+	unlink(emptyFile.c_str());
+
+	vector<unsigned char> buffer(16u << 20);
+	fillRandom(buffer, 0xbb67ae8584caa73bULL);
+
+	fprintf(stdout, "{\n");
+	fprintf(stdout, "  \"version\": 1,\n");
+	fprintf(stdout, "  \"host\": {\"cpus\": %ld, \"simd\": %s},\n", sysconf(_SC_NPROCESSORS_ONLN),
+	        jsonString(simdLevelName(simdLevel())).c_str());
+	fprintf(stdout, "  \"datasets\": {\n");
+	fprintf(stdout, "    \"small\": {\"files\": %zu, \"bytes\": %lld},\n", data.smallFiles.size(),
+	        (long long)data.smallFiles.size() * BENCH_SMALL_FILE_SIZE);
+	fprintf(stdout, "    \"large\": {\"files\": %zu, \"bytes\": %lld}\n", data.largeFiles.size(),
+	        (long long)data.largeFiles.size() * BENCH_LARGE_FILE_SIZE);
+	fprintf(stdout, "  },\n");
+	fprintf(stdout, "  \"stages\": {\n");
+	fprintf(stdout, "    \"fork_us\": %.2f,\n", forkUs);
+	fprintf(stdout, "    \"posix_spawn_us\": %.2f,\n", spawnUs);
+	fprintf(stdout, "    \"popen_us\": %.2f,\n", popenUs);
+	fprintf(stdout, "    \"sum_program_start_us\": %.2f,\n", sumStartUs);
+	fprintf(stdout, "    \"read_MBps\": %.1f,\n", readMBps);
+	fprintf(stdout, "    \"pipe_MBps\": %.1f,\n", pipeMBps);
+	fprintf(stdout, "    \"digest_MBps\": {");
+	for (int alg = 0; alg < ALG_COUNT; ++alg)
+		fprintf(stdout, "%s%s: %.1f", alg ? ", " : "", jsonString(hashAlgs[alg].name).c_str(),
+		        digestThroughput(alg, buffer));
+	fprintf(stdout, "}\n");
+	fprintf(stdout, "  },\n");
+	fflush(stdout);
+
+	/* ---- Modes ---- */
+	vector<BenchMode> modes;
+	addMode(modes, "serial", "large", "-a sha256", data);
+	addMode(modes, "serial-all", "large", "", data);
+	addMode(modes, "fan-out", "large", "-j 0", data);
+	addMode(modes, "builtin", "large", "-b -a sha256", data);
+	addMode(modes, "builtin-all", "large", "-b", data);
+	addMode(modes, "zero-copy", "large", "-z -j 0", data);
+	addMode(modes, "tree", "large", "-t -j 0", data);
+	addMode(modes, "stream", "large", "-a sha256", data);
+	addMode(modes, "cdc", "large", "--cdc -a xxh64", data);
+	addMode(modes, "batch-workers", "large", "-j 0 -a sha256 -r", data);
+	addMode(modes, "batch-pread", "large", "-j 0 -a sha256 --io-engine pread -r", data);
+	addMode(modes, "batch-workers", "small", "-j 0 -a sha256 -r", data);
+	addMode(modes, "batch-workers-shm", "small", "-j 0 -a sha256 --transport shm -r", data);
+	addMode(modes, "batch-pread", "small", "-j 0 -a sha256 --io-engine pread -r", data);
+	addMode(modes, "batch-uring", "small", "-j 0 -a sha256 --io-engine uring -r", data);
+
+	fprintf(stdout, "  \"modes\": [\n");
+	for (size_t i = 0; i < modes.size(); ++i) {
+		const BenchMode& mode = modes[i];
+		fprintf(stderr, "Timing %s on the %s files...\n", mode.name, mode.dataset);
+		string stdinPath = mode.operands[0] == "-" ? data.largeFiles[0] : "";
+		double best = -1;
+		for (int run = 0; run < BENCH_RUNS; ++run) {
+			double elapsed = runMode(self, mode, stdinPath);
+			if (elapsed > 0 && (best < 0 || elapsed < best))
+				best = elapsed;
+		}
+		string args;
+		for (size_t a = 0; a < mode.args.size(); ++a)
+			args += (a ? " " : "") + mode.args[a];
+		fprintf(stdout, "    {\"mode\": %s, \"dataset\": %s, \"args\": %s, ", jsonString(mode.name).c_str(),
+		        jsonString(mode.dataset).c_str(), jsonString(args).c_str());
+		if (best < 0)
+			fprintf(stdout, "\"error\": \"the run failed\"}");
+		else
+			fprintf(stdout, "\"seconds\": %.4f, \"MBps\": %.1f, \"files_per_second\": %.1f}", best,
+			        mode.bytes / 1e6 / best, mode.files / best);
+		fprintf(stdout, "%s\n", i + 1 < modes.size() ? "," : "");
+		fflush(stdout);
+	}
+	fprintf(stdout, "  ]\n}\n");
+	fflush(stdout);
+
+	if (temporary)
+		removeBenchData(data);
+	return 0;
+}
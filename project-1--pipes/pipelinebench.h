@@ -0,0 +1,44 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef PIPELINEBENCH_H
+#define PIPELINEBENCH_H
+
+#include <string>
+
+/*
+ * The pipeline benchmark (make bench) answers two questions: what each
+ * stage of the hashing pipeline costs on this machine, and which mode is
+ * fastest for a workload. It generates two synthetic data sets, many small
+ * files and a few huge ones, then prints one JSON document:
+ *
+ *   stages  the cost of fork(), of posix_spawn() and popen() of a trivial
+ *           program, of starting a *sum program, the warm read() and pipe
+ *           transfer throughput, and the in-memory throughput of every digest
+ *   modes   the wall time of this program in each hashing mode on the data
+ *           set that suits it, best of BENCH_RUNS, with MB/s and files/s
+ */
+
+/* The small data set: files of BENCH_SMALL_FILE_SIZE in BENCH_SMALL_DIRS directories */
+#define BENCH_SMALL_DIRS 16
+#define BENCH_SMALL_FILES_PER_DIR 128
+#define BENCH_SMALL_FILE_SIZE (4u << 10)
+
+/* The large data set */
+#define BENCH_LARGE_FILES 2
+#define BENCH_LARGE_FILE_SIZE (128u << 20)
+
+/* How often each mode runs; the fastest run counts */
+#define BENCH_RUNS 3
+
+/**
+ * Runs the benchmark and prints the JSON report on stdout
+ * @param dir - where to create the data sets; empty for a temporary
+ *              directory under $TMPDIR (or /var/tmp) that is removed afterwards
+ * @return the exit status
+ */
+int benchPipeline(const std::string& dir);
+
+#endif
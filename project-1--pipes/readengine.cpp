@@ -0,0 +1,501 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "readengine.h"
+#include "digest.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+bool parseReadEngine(const char* name, ReadEngine& engine) {
+	if (!strcmp(name, "workers"))
+		engine = READ_ENGINE_WORKERS;
+	else if (!strcmp(name, "uring") || !strcmp(name, "io_uring"))
+		engine = READ_ENGINE_URING;
+	else if (!strcmp(name, "pread"))
+		engine = READ_ENGINE_PREAD;
+	else
+		return false;
+	return true;
+}
+
+const char* readEngineName(ReadEngine engine) {
+	switch (engine) {
+	case READ_ENGINE_URING:
+		return "io_uring";
+	case READ_ENGINE_PREAD:
+		return "pread";
+	default:
+		return "workers";
+	}
+}
+
+/* One file being read by an engine */
+struct EngineFile {
+	int fd;
+	/* The offset of the next read */
+	long long offset;
+	std::vector<Digest*> digests;
+	FileDigests result;
+
+	EngineFile() : fd(-1), offset(0) {}
+};
+
+/**
+ * Opens a file and creates its digests
+ * @return false if the file could not be opened (the error is recorded)
+ */
+static bool openEngineFile(EngineFile& file, const string& path, const vector<int>& algs) {
+	file.offset = 0;
+	file.result.ok = true;
+	file.result.bytes = 0;
+	file.fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (file.fd < 0) {
+		file.result.ok = false;
+		file.result.error = strerror(errno);
+		return false;
+	}
+	/* Tell the kernel to read ahead aggressively; failure is harmless */
+	posix_fadvise(file.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	for (size_t a = 0; a < algs.size(); ++a)
+		file.digests.push_back(createDigest(algs[a]));
+	return true;
+}
+
+/**
+ * Closes a file and finalizes its digests, or records a read error
+ * @param error - an errno value, or 0 if the file was read to the end
+ */
+static void finishEngineFile(EngineFile& file, int error) {
+	if (error) {
+		file.result.ok = false;
+		file.result.error = strerror(error);
+	}
+	for (size_t a = 0; a < file.digests.size(); ++a) {
+		if (file.result.ok)
+			file.result.hexDigests.push_back(file.digests[a]->hexDigest());
+		delete file.digests[a];
+	}
+	file.digests.clear();
+	if (file.fd >= 0)
+		close(file.fd);
+	file.fd = -1;
+}
+
+/* ---------------
+   pread engine
+   --------------- */
+
+/* The state shared by the threads of the pread engine */
+struct PreadJob {
+	const vector<string>* paths;
+	const vector<int>* algs;
+	/* The next file to claim */
+	atomic<size_t> next;
+	/* Serializes the calls to onFile */
+	mutex resultLock;
+	FileDigestHandler onFile;
+	void* context;
+};
+
+/**
+ * The body of a pread engine thread: claims whole files until none are left
+ */
+static void preadWorker(PreadJob* job) {
+	vector<unsigned char> buffer(READ_ENGINE_BLOCK_SIZE);
+	for (;;) {
+		size_t index = job->next++;
+		if (index >= job->paths->size())
+			break;
+
+		EngineFile file;
+		int error = 0;
+		if (openEngineFile(file, (*job->paths)[index], *job->algs)) {
+			for (;;) {
+				ssize_t got = pread(file.fd, &buffer[0], buffer.size(), file.offset);
+				if (got < 0 && errno == EINTR)
+					continue;
+				if (got < 0)
+					error = errno;
+				if (got <= 0)
+					break;
+				for (size_t a = 0; a < file.digests.size(); ++a)
+					file.digests[a]->update(&buffer[0], got);
+				file.offset += got;
+				file.result.bytes += got;
+			}
+		}
+		finishEngineFile(file, error);
+
+		lock_guard<mutex> lock(job->resultLock);
+		job->onFile(index, file.result, job->context);
+	}
+}
+
+static void hashWithPread(const vector<string>& paths, const vector<int>& algs, size_t threads,
+                          FileDigestHandler onFile, void* context) {
+	PreadJob job;
+	job.paths = &paths;
+	job.algs = &algs;
+	job.next = 0;
+	job.onFile = onFile;
+	job.context = context;
+
+	vector<thread> pool;
+	for (size_t i = 0; i < threads; ++i)
+		pool.push_back(thread(preadWorker, &job));
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+}
+
+/* ---------------
+   io_uring engine
+   --------------- */
+
+/* The user_data of the read that waits on the digest threads' eventfd */
+#define WAKE_TOKEN (~0ULL)
+
+/* An io_uring instance set up with raw system calls, and its shared ring mappings */
+struct Ring {
+	int fd;
+	unsigned sqEntries;
+	unsigned* sqHead;
+	unsigned* sqTail;
+	unsigned sqMask;
+	unsigned* sqArray;
+	struct io_uring_sqe* sqes;
+	unsigned* cqHead;
+	unsigned* cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe* cqes;
+	/* The entries queued since the last io_uring_enter() */
+	unsigned toSubmit;
+
+	void* sqMapping;
+	size_t sqMappingLength;
+	void* cqMapping;
+	size_t cqMappingLength;
+	size_t sqesLength;
+};
+
+/**
+ * Creates the ring and maps its queues
+ * @return false if io_uring is not available
+ */
+static bool setupRing(Ring& ring, unsigned entries) {
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(&ring, 0, sizeof(ring));
+	ring.fd = syscall(__NR_io_uring_setup, entries, &params);
+	if (ring.fd < 0)
+		return false;
+
+	ring.sqMappingLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring.cqMappingLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	/* Newer kernels serve both rings from one mapping */
+	bool singleMapping = params.features & IORING_FEAT_SINGLE_MMAP;
+	if (singleMapping)
+		ring.sqMappingLength = ring.cqMappingLength = max(ring.sqMappingLength, ring.cqMappingLength);
+
+	ring.sqMapping = mmap(NULL, ring.sqMappingLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+	                      IORING_OFF_SQ_RING);
+	ring.cqMapping = singleMapping ? ring.sqMapping
+	                               : mmap(NULL, ring.cqMappingLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                                      ring.fd, IORING_OFF_CQ_RING);
+	ring.sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, ring.sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd,
+	                  IORING_OFF_SQES);
+	if (ring.sqMapping == MAP_FAILED || ring.cqMapping == MAP_FAILED || sqes == MAP_FAILED) {
+		close(ring.fd);
+		return false;
+	}
+
+	char* sq = (char*)ring.sqMapping;
+	char* cq = (char*)ring.cqMapping;
+	ring.sqEntries = params.sq_entries;
+	ring.sqHead = (unsigned*)(sq + params.sq_off.head);
+	ring.sqTail = (unsigned*)(sq + params.sq_off.tail);
+	ring.sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+	ring.sqArray = (unsigned*)(sq + params.sq_off.array);
+	ring.sqes = (struct io_uring_sqe*)sqes;
+	ring.cqHead = (unsigned*)(cq + params.cq_off.head);
+	ring.cqTail = (unsigned*)(cq + params.cq_off.tail);
+	ring.cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+	return true;
+}
+
+/**
+ * Unmaps the queues and closes the ring, which cancels whatever is still queued
+ */
+static void teardownRing(Ring& ring) {
+	munmap(ring.sqes, ring.sqesLength);
+	if (ring.cqMapping != ring.sqMapping)
+		munmap(ring.cqMapping, ring.cqMappingLength);
+	munmap(ring.sqMapping, ring.sqMappingLength);
+	close(ring.fd);
+}
+
+/**
+ * Copies a prepared entry into the submission queue; the kernel sees it at the next enterRing()
+ */
+static void queueSqe(Ring& ring, const struct io_uring_sqe& sqe) {
+	unsigned tail = *ring.sqTail;
+	unsigned index = tail & ring.sqMask;
+	ring.sqes[index] = sqe;
+	ring.sqArray[index] = index;
+	/* The entry must be visible before the tail that publishes it */
+	__atomic_store_n(ring.sqTail, tail + 1, __ATOMIC_RELEASE);
+	++ring.toSubmit;
+}
+
+/**
+ * Submits the queued entries and waits for at least one completion
+ */
+static void enterRing(Ring& ring) {
+	for (;;) {
+		int submitted = syscall(__NR_io_uring_enter, ring.fd, ring.toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (submitted >= 0) {
+			ring.toSubmit -= submitted;
+			return;
+		}
+		if (errno != EINTR) {
+			perror("io_uring_enter");
+			exit(-1);
+		}
+	}
+}
+
+/* A block read for a file, on its way to a digest thread and back */
+struct DigestTask {
+	size_t file;
+	unsigned buffer;
+	size_t length;
+};
+
+/* The state shared by the submitting thread and the digest threads */
+struct UringJob {
+	vector<EngineFile>* files;
+	unsigned char* buffers;
+
+	mutex lock;
+	condition_variable taskReady;
+	/* Blocks waiting for a digest thread */
+	deque<DigestTask> tasks;
+	/* Blocks hashed, whose buffers can be reused */
+	deque<DigestTask> returned;
+	bool stopping;
+	/* Written by the digest threads to wake the submitting thread out of io_uring_enter() */
+	int wakeFd;
+};
+
+/**
+ * The body of a digest thread: hashes blocks and hands their buffers back
+ */
+static void uringDigestWorker(UringJob* job) {
+	for (;;) {
+		DigestTask task;
+		{
+			unique_lock<mutex> lock(job->lock);
+			while (job->tasks.empty() && !job->stopping)
+				job->taskReady.wait(lock);
+			if (job->tasks.empty())
+				return;
+			task = job->tasks.front();
+			job->tasks.pop_front();
+		}
+
+		/* Only one block of a file is ever out, so nothing else touches its digests */
+		EngineFile& file = (*job->files)[task.file];
+		const unsigned char* block = job->buffers + (size_t)task.buffer * READ_ENGINE_BLOCK_SIZE;
+		for (size_t a = 0; a < file.digests.size(); ++a)
+			file.digests[a]->update(block, task.length);
+
+		{
+			lock_guard<mutex> lock(job->lock);
+			job->returned.push_back(task);
+		}
+		uint64_t one = 1;
+		while (write(job->wakeFd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+	}
+}
+
+/**
+ * Runs the io_uring engine
+ * @return false if io_uring is not available (nothing was read)
+ */
+static bool hashWithUring(const vector<string>& paths, const vector<int>& algs, size_t threads,
+                          FileDigestHandler onFile, void* context) {
+	Ring ring;
+	if (!setupRing(ring, READ_ENGINE_BUFFER_COUNT + 1))
+		return false;
+
+	UringJob job;
+	job.wakeFd = eventfd(0, EFD_CLOEXEC);
+	size_t poolLength = (size_t)READ_ENGINE_BUFFER_COUNT * READ_ENGINE_BLOCK_SIZE;
+	job.buffers = (unsigned char*)mmap(NULL, poolLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (job.wakeFd < 0 || job.buffers == MAP_FAILED) {
+		if (job.wakeFd >= 0)
+			close(job.wakeFd);
+		if (job.buffers != MAP_FAILED)
+			munmap(job.buffers, poolLength);
+		teardownRing(ring);
+		return false;
+	}
+
+	/* Registered buffers spare the kernel from pinning the pages on every read; plain reads work too */
+	struct iovec iovecs[READ_ENGINE_BUFFER_COUNT];
+	for (unsigned i = 0; i < READ_ENGINE_BUFFER_COUNT; ++i) {
+		iovecs[i].iov_base = job.buffers + (size_t)i * READ_ENGINE_BLOCK_SIZE;
+		iovecs[i].iov_len = READ_ENGINE_BLOCK_SIZE;
+	}
+	bool fixedBuffers = syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_BUFFERS, iovecs,
+	                            READ_ENGINE_BUFFER_COUNT) == 0;
+
+	vector<EngineFile> files(paths.size());
+	job.files = &files;
+	job.stopping = false;
+	vector<thread> pool;
+	for (size_t i = 0; i < threads; ++i)
+		pool.push_back(thread(uringDigestWorker, &job));
+
+	/* The read that waits on the eventfd; it is queued again every time it completes */
+	uint64_t wakeCount;
+	struct io_uring_sqe wakeSqe;
+	memset(&wakeSqe, 0, sizeof(wakeSqe));
+	wakeSqe.opcode = IORING_OP_READ;
+	wakeSqe.fd = job.wakeFd;
+	wakeSqe.addr = (uint64_t)(uintptr_t)&wakeCount;
+	wakeSqe.len = sizeof(wakeCount);
+	wakeSqe.user_data = WAKE_TOKEN;
+	queueSqe(ring, wakeSqe);
+
+	vector<unsigned> freeBuffers;
+	for (unsigned i = READ_ENGINE_BUFFER_COUNT; i-- > 0;)
+		freeBuffers.push_back(i);
+	/* The file each buffer is being read for */
+	vector<size_t> bufferFile(READ_ENGINE_BUFFER_COUNT);
+	/* Open files with no read in flight and no block out */
+	deque<size_t> readyFiles;
+	size_t nextToOpen = 0, finished = 0;
+
+	while (finished < files.size()) {
+		/* Queue one read per ready file while buffers last; open new files only when none is ready */
+		while (!freeBuffers.empty()) {
+			if (readyFiles.empty()) {
+				if (nextToOpen >= files.size())
+					break;
+				size_t index = nextToOpen++;
+				if (!openEngineFile(files[index], paths[index], algs)) {
+					finishEngineFile(files[index], 0);
+					onFile(index, files[index].result, context);
+					++finished;
+					continue;
+				}
+				readyFiles.push_back(index);
+			}
+			size_t index = readyFiles.front();
+			readyFiles.pop_front();
+			unsigned buffer = freeBuffers.back();
+			freeBuffers.pop_back();
+			bufferFile[buffer] = index;
+
+			struct io_uring_sqe sqe;
+			memset(&sqe, 0, sizeof(sqe));
+			sqe.opcode = fixedBuffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+			sqe.fd = files[index].fd;
+			sqe.addr = (uint64_t)(uintptr_t)iovecs[buffer].iov_base;
+			sqe.len = READ_ENGINE_BLOCK_SIZE;
+			sqe.off = files[index].offset;
+			sqe.buf_index = buffer;
+			sqe.user_data = buffer;
+			queueSqe(ring, sqe);
+		}
+		if (finished == files.size())
+			break;
+
+		enterRing(ring);
+
+		unsigned head = *ring.cqHead;
+		unsigned tail = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+		for (; head != tail; ++head) {
+			struct io_uring_cqe cqe = ring.cqes[head & ring.cqMask];
+
+			if (cqe.user_data == WAKE_TOKEN) {
+				/* Hashed blocks free their buffer, and their file is ready for its next read */
+				lock_guard<mutex> lock(job.lock);
+				while (!job.returned.empty()) {
+					freeBuffers.push_back(job.returned.front().buffer);
+					readyFiles.push_back(job.returned.front().file);
+					job.returned.pop_front();
+				}
+				queueSqe(ring, wakeSqe);
+				continue;
+			}
+
+			unsigned buffer = cqe.user_data;
+			size_t index = bufferFile[buffer];
+			if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+				/* Try the same read again */
+				freeBuffers.push_back(buffer);
+				readyFiles.push_front(index);
+			} else if (cqe.res <= 0) {
+				/* The end of the file, or a read error */
+				freeBuffers.push_back(buffer);
+				finishEngineFile(files[index], -cqe.res);
+				onFile(index, files[index].result, context);
+				++finished;
+			} else {
+				files[index].offset += cqe.res;
+				files[index].result.bytes += cqe.res;
+				DigestTask task = {index, buffer, (size_t)cqe.res};
+				lock_guard<mutex> lock(job.lock);
+				job.tasks.push_back(task);
+				job.taskReady.notify_one();
+			}
+		}
+		__atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	{
+		lock_guard<mutex> lock(job.lock);
+		job.stopping = true;
+		job.taskReady.notify_all();
+	}
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	teardownRing(ring);
+	munmap(job.buffers, poolLength);
+	close(job.wakeFd);
+	return true;
+}
+
+ReadEngine hashWithReadEngine(ReadEngine engine, const vector<string>& paths, const vector<int>& algs,
+                              size_t threads, FileDigestHandler onFile, void* context) {
+	if (threads < 1)
+		threads = 1;
+	if (engine == READ_ENGINE_URING && hashWithUring(paths, algs, threads, onFile, context))
+		return READ_ENGINE_URING;
+	hashWithPread(paths, algs, threads, onFile, context);
+	return READ_ENGINE_PREAD;
+}
@@ -0,0 +1,88 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef READENGINE_H
+#define READENGINE_H
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * In-process ingestion engines for batch mode. Both read many files at once
+ * in READ_ENGINE_BLOCK_SIZE blocks and hand the blocks to a pool of digest
+ * threads; they differ in how the reads are issued.
+ *
+ * The io_uring engine keeps one read queued per open file, into buffers
+ * taken from a fixed pool registered with the kernel, all from a single
+ * submitting thread. Each completed block goes to a digest thread, which
+ * gives the buffer back, and the file's next read is queued. With one read
+ * in flight per file, the blocks of a file are hashed in order without any
+ * reordering.
+ *
+ * The pread engine is the fallback: every digest thread claims whole files
+ * and reads them with blocking pread() calls.
+ */
+
+/* How batch mode gets the file contents to the digests */
+enum ReadEngine {
+	/* Pre-forked worker processes fed over pipes (batch.cpp) */
+	READ_ENGINE_WORKERS = 0,
+	READ_ENGINE_URING,
+	READ_ENGINE_PREAD
+};
+
+/* The size of the reads issued by the engines */
+#define READ_ENGINE_BLOCK_SIZE (256u << 10)
+
+/* The number of buffers in the io_uring engine's pool, i.e. the reads in flight */
+#define READ_ENGINE_BUFFER_COUNT 64
+
+/* The outcome of reading and hashing one file */
+struct FileDigests {
+	/* False if the file could not be opened or read */
+	bool ok;
+	/* The reason, when not ok */
+	std::string error;
+	/* The hex digests, in the order of the algorithms passed in */
+	std::vector<std::string> hexDigests;
+	/* The number of bytes read */
+	long long bytes;
+};
+
+/**
+ * Called once per file, in completion order and never concurrently
+ * @param fileIndex - the index into the paths passed to hashWithReadEngine()
+ * @param result - the digests or the error
+ * @param context - the pointer given to hashWithReadEngine()
+ */
+typedef void (*FileDigestHandler)(size_t fileIndex, const FileDigests& result, void* context);
+
+/**
+ * Parses an --io-engine argument (workers, uring or pread)
+ * @return false if the name is unknown
+ */
+bool parseReadEngine(const char* name, ReadEngine& engine);
+
+/**
+ * @return a printable name of an engine
+ */
+const char* readEngineName(ReadEngine engine);
+
+/**
+ * Reads and hashes every file with an in-process engine
+ * @param engine - READ_ENGINE_URING or READ_ENGINE_PREAD; io_uring falls
+ *                 back to pread when the kernel does not offer it
+ * @param paths - the files
+ * @param algs - the algorithms to compute
+ * @param threads - the number of digest threads
+ * @param onFile - receives every file's result
+ * @param context - passed through to onFile
+ * @return the engine that actually ran
+ */
+ReadEngine hashWithReadEngine(ReadEngine engine, const std::vector<std::string>& paths, const std::vector<int>& algs,
+                              size_t threads, FileDigestHandler onFile, void* context);
+
+#endif
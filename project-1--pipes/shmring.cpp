@@ -0,0 +1,247 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "shmring.h"
+#include "frame.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+/* How often a blocked side polls the ring before it sleeps, if there is another CPU */
+#define SHM_SPIN_LIMIT 4000
+
+/* How long a sleeper waits before it checks that its peer still runs */
+#define SHM_WAIT_TIMEOUT_MS 100
+
+int shmSpinLimit() {
+	/* On a single CPU the peer cannot run while we spin */
+	static const int limit = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SHM_SPIN_LIMIT : 0;
+	return limit;
+}
+
+void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/* The word is shared between processes, so the futex calls must not be FUTEX_PRIVATE */
+static long futex(uint32_t* word, int op, uint32_t value, const struct timespec* timeout) {
+	return syscall(SYS_futex, word, op, value, timeout, NULL, 0);
+}
+
+ShmEvent* ShmEvent::create() {
+	void* memory = mmap(NULL, sizeof(ShmEvent), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return NULL;
+	/* Anonymous memory starts zeroed, which is the initial state */
+	return (ShmEvent*)memory;
+}
+
+void ShmEvent::destroy(ShmEvent* event) {
+	if (event)
+		munmap(event, sizeof(ShmEvent));
+}
+
+uint32_t ShmEvent::prepareWait() {
+	__atomic_add_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&sequence, __ATOMIC_SEQ_CST);
+}
+
+void ShmEvent::wait(uint32_t key, int timeoutMs) {
+	struct timespec timeout;
+	timeout.tv_sec = timeoutMs / 1000;
+	timeout.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	/* Returns at once if a notification already changed the sequence */
+	futex(&sequence, FUTEX_WAIT, key, &timeout);
+	__atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+void ShmEvent::cancelWait() {
+	__atomic_sub_fetch(&waiters, 1, __ATOMIC_SEQ_CST);
+}
+
+void ShmEvent::notify() {
+	/* Orders the caller's publication before the check for waiters */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&waiters, __ATOMIC_RELAXED) == 0)
+		return;
+	__atomic_add_fetch(&sequence, 1, __ATOMIC_SEQ_CST);
+	futex(&sequence, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+ShmRing* ShmRing::create(size_t capacity, ShmEvent* dataEvent) {
+	size_t size = 4096;
+	while (size < capacity)
+		size <<= 1;
+	void* memory = mmap(NULL, sizeof(RingHeader) + size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return NULL;
+	return new ShmRing((RingHeader*)memory, size, dataEvent);
+}
+
+ShmRing::ShmRing(RingHeader* header, size_t capacity, ShmEvent* dataEvent)
+    : header(header), data((char*)(header + 1)), capacity(capacity),
+      dataEvent(dataEvent ? dataEvent : &header->dataEvent), peer(0) {
+}
+
+ShmRing::~ShmRing() {
+	munmap(header, sizeof(RingHeader) + capacity);
+}
+
+bool ShmRing::peerAlive() const {
+	if (peer <= 0)
+		return true;
+	/* A child that exited stays a zombie until it is reaped; WNOWAIT leaves it for the owner to reap */
+	siginfo_t info;
+	info.si_pid = 0;
+	if (waitid(P_PID, peer, &info, WEXITED | WNOHANG | WNOWAIT) == 0)
+		return info.si_pid == 0;
+	/* Not our child: the worker checking on its parent */
+	return kill(peer, 0) == 0 || errno != ESRCH;
+}
+
+bool ShmRing::readable() const {
+	return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != header->tail ||
+	       __atomic_load_n(&header->closed, __ATOMIC_ACQUIRE);
+}
+
+bool ShmRing::writable() const {
+	return header->head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE) < capacity;
+}
+
+bool ShmRing::hasData() const {
+	return __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) != __atomic_load_n(&header->tail, __ATOMIC_RELAXED);
+}
+
+bool ShmRing::waitUntil(ShmEvent* event, bool (ShmRing::*ready)() const) {
+	/* A short spin avoids two system calls when the peer is about to act */
+	for (int i = shmSpinLimit(); i > 0; --i) {
+		if ((this->*ready)())
+			return true;
+		cpuRelax();
+	}
+	for (;;) {
+		uint32_t key = event->prepareWait();
+		if ((this->*ready)()) {
+			event->cancelWait();
+			return true;
+		}
+		event->wait(key, SHM_WAIT_TIMEOUT_MS);
+		if ((this->*ready)())
+			return true;
+		if (!peerAlive()) {
+			errno = EPIPE;
+			return false;
+		}
+	}
+}
+
+void ShmRing::copyIn(uint64_t pos, const char* in, size_t len) {
+	size_t offset = pos & (capacity - 1);
+	size_t first = min(len, capacity - offset);
+	memcpy(data + offset, in, first);
+	memcpy(data, in + first, len - first);
+}
+
+void ShmRing::copyOut(uint64_t pos, char* out, size_t len) const {
+	size_t offset = pos & (capacity - 1);
+	size_t first = min(len, capacity - offset);
+	memcpy(out, data + offset, first);
+	memcpy(out + first, data, len - first);
+}
+
+bool ShmRing::write(const char* in, size_t len) {
+	while (len > 0) {
+		uint64_t head = header->head;
+		size_t space = capacity - (head - __atomic_load_n(&header->tail, __ATOMIC_ACQUIRE));
+		if (space == 0) {
+			if (!waitUntil(&header->spaceEvent, &ShmRing::writable))
+				return false;
+			continue;
+		}
+		size_t n = min(space, len);
+		copyIn(head, in, n);
+		__atomic_store_n(&header->head, head + n, __ATOMIC_RELEASE);
+		dataEvent->notify();
+		in += n;
+		len -= n;
+	}
+	return true;
+}
+
+ssize_t ShmRing::read(char* out, size_t len) {
+	size_t done = 0;
+	while (done < len) {
+		uint64_t tail = header->tail;
+		size_t available = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - tail;
+		if (available == 0) {
+			/* The producer sets closed after its last write, so an empty ring is final */
+			if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) && !hasData())
+				break;
+			if (!waitUntil(dataEvent, &ShmRing::readable))
+				return -1;
+			continue;
+		}
+		size_t n = min(available, len - done);
+		copyOut(tail, out + done, n);
+		__atomic_store_n(&header->tail, tail + n, __ATOMIC_RELEASE);
+		header->spaceEvent.notify();
+		done += n;
+	}
+	return done;
+}
+
+bool ShmRing::writeMessage(const string& payload) {
+	if (payload.size() > MAX_FRAME_LENGTH) {
+		errno = EMSGSIZE;
+		return false;
+	}
+	uint32_t length = payload.size();
+	return write((const char*)&length, FRAME_HEADER_LENGTH) && write(payload.data(), payload.size());
+}
+
+void ShmRing::close() {
+	__atomic_store_n(&header->closed, 1, __ATOMIC_RELEASE);
+	dataEvent->notify();
+}
+
+int ShmRing::readMessage(string& payload) {
+	uint32_t length;
+	ssize_t got = read((char*)&length, FRAME_HEADER_LENGTH);
+	if (got == 0)
+		return 0;
+	if (got != FRAME_HEADER_LENGTH || length > MAX_FRAME_LENGTH)
+		return -1;
+
+	payload.resize(length);
+	if (length && read(&payload[0], length) != (ssize_t)length)
+		return -1;
+	return 1;
+}
+
+size_t ShmRing::readAvailable(string& buffer) {
+	uint64_t tail = header->tail;
+	size_t available = __atomic_load_n(&header->head, __ATOMIC_ACQUIRE) - tail;
+	if (available == 0)
+		return 0;
+	size_t oldSize = buffer.size();
+	buffer.resize(oldSize + available);
+	copyOut(tail, &buffer[oldSize], available);
+	__atomic_store_n(&header->tail, tail + available, __ATOMIC_RELEASE);
+	header->spaceEvent.notify();
+	return available;
+}
@@ -0,0 +1,198 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+
+/*
+ * A single-producer/single-consumer byte ring in anonymous MAP_SHARED
+ * memory, created before fork() so that parent and child share it:
+ *
+ *   RingHeader | data[capacity]
+ *
+ * head and tail count the bytes ever written and read; the producer owns
+ * head and the consumer owns tail, so neither needs a lock. A side that
+ * finds the ring empty (or full) spins briefly and then sleeps on a futex
+ * word; the other side only makes the wake-up system call when someone is
+ * actually asleep. Messages use the same length-prefixed framing as the
+ * pipes (frame.h) and may be larger than the ring: they stream through it.
+ */
+
+/* The data bytes of a ring created by WorkerPool */
+#define SHM_RING_CAPACITY (1u << 20)
+
+/**
+ * @return how many times to poll before sleeping: 0 on a single CPU, where
+ *         the peer cannot make progress while we spin
+ */
+int shmSpinLimit();
+
+/**
+ * Tells the CPU that the caller is in a spin-wait loop
+ */
+void cpuRelax();
+
+/*
+ * An event count in shared memory: a waiter takes a key, re-checks its
+ * condition and only then sleeps, so a notification in between is not lost
+ */
+struct ShmEvent {
+	/* The futex word; bumped by every notification that has waiters */
+	uint32_t sequence;
+	/* The number of processes between prepareWait() and the end of wait() */
+	uint32_t waiters;
+
+	/**
+	 * @return a new event in its own shared mapping, or NULL (errno is set)
+	 */
+	static ShmEvent* create();
+
+	/**
+	 * Unmaps an event made by create()
+	 */
+	static void destroy(ShmEvent* event);
+
+	/**
+	 * Registers the caller as a waiter; re-check the condition afterwards
+	 * @return the key for wait()
+	 */
+	uint32_t prepareWait();
+
+	/**
+	 * Sleeps until a notification after prepareWait(), or the timeout
+	 * @param key - from prepareWait()
+	 * @param timeoutMs - the longest sleep
+	 */
+	void wait(uint32_t key, int timeoutMs);
+
+	/**
+	 * Withdraws a prepareWait() whose condition turned out to hold
+	 */
+	void cancelWait();
+
+	/**
+	 * Wakes every waiter, if there is any; call after publishing the change
+	 */
+	void notify();
+};
+
+/* The shared state at the start of a ring's mapping */
+struct RingHeader {
+	/* Written by the producer; each group sits on its own cache line */
+	uint64_t head;
+	uint32_t closed;
+	char producerPad[52];
+	/* Written by the consumer */
+	uint64_t tail;
+	char consumerPad[56];
+	/* Signalled when data arrives or the ring is closed */
+	ShmEvent dataEvent;
+	/* Signalled when the consumer frees space */
+	ShmEvent spaceEvent;
+};
+
+class ShmRing {
+public:
+	/**
+	 * Maps a new ring
+	 * @param capacity - the data bytes, rounded up to a power of two
+	 * @param dataEvent - signalled instead of the ring's own event when data
+	 *                    arrives, so one consumer can wait on many rings; or NULL
+	 * @return the ring, or NULL (errno is set)
+	 */
+	static ShmRing* create(size_t capacity, ShmEvent* dataEvent = NULL);
+
+	/**
+	 * Unmaps the ring in this process
+	 */
+	~ShmRing();
+
+	/**
+	 * Sets the process on the other end; a blocked call gives up once it is gone
+	 */
+	void setPeer(pid_t pid) { peer = pid; }
+
+	/**
+	 * @return whether the peer set with setPeer() is still running
+	 */
+	bool peerAlive() const;
+
+	/**
+	 * Producer: sends one framed message, blocking while the ring is full
+	 * @return false if the peer is gone (errno is EPIPE) or the message too large
+	 */
+	bool writeMessage(const std::string& payload);
+
+	/**
+	 * Producer: tells the consumer that no more messages follow
+	 */
+	void close();
+
+	/**
+	 * Consumer: receives one framed message, blocking until it is complete
+	 * @return 1 on success, 0 once the ring is closed and empty, -1 on an error
+	 */
+	int readMessage(std::string& payload);
+
+	/**
+	 * Consumer: appends whatever bytes are available without blocking (for
+	 * extractFrame() loops over several rings)
+	 * @return the number of bytes appended
+	 */
+	size_t readAvailable(std::string& buffer);
+
+	/**
+	 * @return whether bytes are waiting to be read
+	 */
+	bool hasData() const;
+
+private:
+	ShmRing(RingHeader* header, size_t capacity, ShmEvent* dataEvent);
+
+	/* Whether the consumer or the producer can make progress */
+	bool readable() const;
+	bool writable() const;
+
+	/**
+	 * Spins, then sleeps on event until ready() holds
+	 * @return false if the peer is gone first (errno is EPIPE)
+	 */
+	bool waitUntil(ShmEvent* event, bool (ShmRing::*ready)() const);
+
+	/**
+	 * Copies len bytes in, blocking while the ring is full
+	 */
+	bool write(const char* data, size_t len);
+
+	/**
+	 * Copies len bytes out, blocking while the ring is empty
+	 * @return the number of bytes read (short only at a close), or -1 if the peer is gone
+	 */
+	ssize_t read(char* data, size_t len);
+
+	/**
+	 * Copies between the ring at position pos and a flat buffer, wrapping around
+	 */
+	void copyIn(uint64_t pos, const char* data, size_t len);
+	void copyOut(uint64_t pos, char* data, size_t len) const;
+
+	RingHeader* header;
+	char* data;
+	size_t capacity;
+	/* Where data notifications go: the ring's own event or a shared one */
+	ShmEvent* dataEvent;
+	pid_t peer;
+
+	/* Not copyable: the destructor owns the mapping */
+	ShmRing(const ShmRing&);
+	ShmRing& operator=(const ShmRing&);
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "treehash.h"
+#include "digest.h"
+
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+/* The domain separation prefixes of the tree format */
+static const unsigned char LEAF_PREFIX = 0x00;
+static const unsigned char NODE_PREFIX = 0x01;
+
+size_t treeChunkCount(long long fileSize, size_t chunkSize) {
+	if (fileSize <= 0)
+		return 1;
+	return (fileSize + chunkSize - 1) / chunkSize;
+}
+
+/* The state shared by the threads of hashTreeChunks() */
+struct TreeJob {
+	int fd;
+	long long fileSize;
+	size_t chunkSize;
+	const vector<int>* algs;
+	/* The chunk indices to hash */
+	vector<size_t> chunks;
+	/* The next position in chunks to claim */
+	atomic<size_t> next;
+	/* Set by the first thread that fails */
+	atomic<int> error;
+	vector< vector<string> >* leaves;
+};
+
+/**
+ * The body of a tree hashing thread: claims chunks until none are left
+ */
+static void treeWorker(TreeJob* job) {
+	vector<Digest*> digests;
+	for (size_t a = 0; a < job->algs->size(); ++a)
+		digests.push_back(createDigest((*job->algs)[a]));
+	unsigned char* buffer = (unsigned char*)malloc(HASH_READ_BLOCK_SIZE);
+
+	size_t slot;
+	while (buffer && !job->error && (slot = job->next.fetch_add(1)) < job->chunks.size()) {
+		size_t chunk = job->chunks[slot];
+		long long offset = (long long)chunk * job->chunkSize;
+		long long end = min(offset + (long long)job->chunkSize, job->fileSize);
+
+		for (size_t a = 0; a < digests.size(); ++a) {
+			digests[a]->reset();
+			digests[a]->update(&LEAF_PREFIX, 1);
+		}
+		while (offset < end) {
+			size_t want = min((long long)HASH_READ_BLOCK_SIZE, end - offset);
+			ssize_t got = pread(job->fd, buffer, want, offset);
+			if (got < 0 && errno == EINTR)
+				continue;
+			if (got <= 0) {
+				/* A file that shrank under us reads as end of file */
+				job->error = got < 0 ? errno : EIO;
+				break;
+			}
+			for (size_t a = 0; a < digests.size(); ++a)
+				digests[a]->update(buffer, got);
+			offset += got;
+		}
+		for (size_t a = 0; a < digests.size(); ++a) {
+			unsigned char out[MAX_DIGEST_LENGTH];
+			digests[a]->final(out);
+			(*job->leaves)[a][chunk].assign((const char*)out, digests[a]->digestLength());
+		}
+	}
+
+	if (!buffer)
+		job->error = ENOMEM;
+	free(buffer);
+	for (size_t a = 0; a < digests.size(); ++a)
+		delete digests[a];
+}
+
+bool hashTreeChunks(int fd, long long fileSize, size_t chunkSize, const vector<int>& algs, size_t threads,
+                    const vector<size_t>* chunks, vector< vector<string> >& leaves) {
+	size_t chunkCount = treeChunkCount(fileSize, chunkSize);
+
+	TreeJob job;
+	job.fd = fd;
+	job.fileSize = fileSize;
+	job.chunkSize = chunkSize;
+	job.algs = &algs;
+	if (chunks) {
+		job.chunks = *chunks;
+	} else {
+		for (size_t i = 0; i < chunkCount; ++i)
+			job.chunks.push_back(i);
+	}
+	job.next = 0;
+	job.error = 0;
+	job.leaves = &leaves;
+	leaves.assign(algs.size(), vector<string>(chunkCount));
+
+	if (threads < 1)
+		threads = 1;
+	if (threads > job.chunks.size())
+		threads = job.chunks.size();
+	vector<thread> pool;
+	for (size_t i = 1; i < threads; ++i)
+		pool.push_back(thread(treeWorker, &job));
+	/* The calling thread works too */
+	treeWorker(&job);
+	for (size_t i = 0; i < pool.size(); ++i)
+		pool[i].join();
+
+	if (job.error) {
+		errno = job.error;
+		return false;
+	}
+	return true;
+}
+
+string merkleRoot(int alg, const vector<string>& leaves) {
+	vector<string> level = leaves;
+	Digest* digest = createDigest(alg);
+	unsigned char out[MAX_DIGEST_LENGTH];
+
+	while (level.size() > 1) {
+		vector<string> next;
+		for (size_t i = 0; i + 1 < level.size(); i += 2) {
+			digest->reset();
+			digest->update(&NODE_PREFIX, 1);
+			digest->update((const unsigned char*)level[i].data(), level[i].size());
+			digest->update((const unsigned char*)level[i + 1].data(), level[i + 1].size());
+			digest->final(out);
+			next.push_back(string((const char*)out, digest->digestLength()));
+		}
+		/* An odd node is promoted unchanged */
+		if (level.size() % 2)
+			next.push_back(level.back());
+		level.swap(next);
+	}
+
+	delete digest;
+	return level.empty() ? string() : level[0];
+}
+
+bool writeTreeManifest(FILE* out, const TreeManifest& manifest) {
+	fprintf(out, "# computeHashValue tree manifest v1\n");
+	fprintf(out, "tree %s %zu %lld %s\n", hashAlgs[manifest.alg].name, manifest.chunkSize, manifest.fileSize,
+	        manifest.root.c_str());
+	for (size_t i = 0; i < manifest.leaves.size(); ++i)
+		fprintf(out, "%zu %s\n", i, manifest.leaves[i].c_str());
+	return fflush(out) == 0 && !ferror(out);
+}
+
+bool readTreeManifest(const string& path, TreeManifest& manifest) {
+	FILE* in = fopen(path.c_str(), "r");
+	if (!in) {
+		fprintf(stderr, "%s: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	bool ok = false, headerSeen = false;
+	char line[1024];
+	size_t lineNumber = 0;
+	manifest.leaves.clear();
+	while (fgets(line, sizeof(line), in)) {
+		++lineNumber;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		char algName[32], hex[2 * MAX_DIGEST_LENGTH + 2];
+		size_t chunkSize, index;
+		long long fileSize;
+		if (!headerSeen) {
+			if (sscanf(line, "tree %31s %zu %lld %129s", algName, &chunkSize, &fileSize, hex) != 4 ||
+			    (manifest.alg = findHashAlg(algName)) < 0 || chunkSize == 0)
+				break;
+			manifest.chunkSize = chunkSize;
+			manifest.fileSize = fileSize;
+			manifest.root = hex;
+			headerSeen = true;
+			ok = true;
+			continue;
+		}
+		if (sscanf(line, "%zu %129s", &index, hex) != 2 || index != manifest.leaves.size()) {
+			ok = false;
+			break;
+		}
+		manifest.leaves.push_back(hex);
+	}
+	fclose(in);
+
+	if (ok && manifest.leaves.size() != treeChunkCount(manifest.fileSize, manifest.chunkSize))
+		ok = false;
+	if (!ok)
+		fprintf(stderr, "%s:%zu: malformed tree manifest\n", path.c_str(), lineNumber);
+	return ok;
+}
+
+bool parseChunkList(const string& list, size_t chunkCount, vector<size_t>& chunks) {
+	size_t start = 0;
+	while (start < list.size()) {
+		size_t comma = list.find(',', start);
+		if (comma == string::npos)
+			comma = list.size();
+		string item = list.substr(start, comma - start);
+		start = comma + 1;
+
+		char* end;
+		unsigned long first = strtoul(item.c_str(), &end, 10), last = first;
+		if (end == item.c_str())
+			return false;
+		if (*end == '-') {
+			const char* rest = end + 1;
+			last = strtoul(rest, &end, 10);
+			if (end == rest)
+				return false;
+		}
+		if (*end || first > last || last >= chunkCount)
+			return false;
+		for (unsigned long i = first; i <= last; ++i)
+			chunks.push_back(i);
+	}
+	sort(chunks.begin(), chunks.end());
+	chunks.erase(unique(chunks.begin(), chunks.end()), chunks.end());
+	return !chunks.empty();
+}
@@ -0,0 +1,102 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef TREEHASH_H
+#define TREEHASH_H
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+
+/*
+ * Tree hash format (version 1)
+ *
+ * The file is split into chunks of chunkSize bytes; the last chunk may be
+ * shorter and an empty file has exactly one empty chunk. With H the
+ * selected algorithm and || concatenation:
+ *
+ *   leaf[i] = H(0x00 || chunk[i])
+ *   node    = H(0x01 || left || right)
+ *
+ * Each level pairs neighbours left to right; an odd node at the end of a
+ * level is promoted to the next level unchanged. The root is the single
+ * node left at the top. The 0x00/0x01 prefixes keep a leaf from ever
+ * being mistaken for an interior node.
+ *
+ * A manifest records everything needed to re-check single chunks:
+ *
+ *   # computeHashValue tree manifest v1
+ *   tree <algorithm> <chunk size> <file size> <root hex>
+ *   <chunk index> <leaf hex>
+ *   ...
+ */
+
+/* The default chunk size of the tree mode */
+#define DEFAULT_TREE_CHUNK_SIZE (4u << 20)
+
+/* The contents of a tree manifest */
+struct TreeManifest {
+	int alg;
+	size_t chunkSize;
+	long long fileSize;
+	/* The root as lowercase hex */
+	std::string root;
+	/* The leaf digests as lowercase hex, indexed by chunk */
+	std::vector<std::string> leaves;
+};
+
+/**
+ * @param fileSize - the size of the file
+ * @param chunkSize - the size of a chunk
+ * @return the number of chunks the file is split into
+ */
+size_t treeChunkCount(long long fileSize, size_t chunkSize);
+
+/**
+ * Computes leaf digests on several threads; each thread reads its chunk once
+ * and feeds every algorithm
+ * @param fd - the file, read with pread() so threads do not share an offset
+ * @param fileSize - the size of the file
+ * @param chunkSize - the size of a chunk
+ * @param algs - the algorithms
+ * @param threads - the number of threads
+ * @param chunks - the chunk indices to hash, or NULL for all of them
+ * @param leaves - receives leaves[a][chunk] for algs[a] as binary digests;
+ *                 entries of chunks not hashed are left empty
+ * @return false on a read error (errno is set)
+ */
+bool hashTreeChunks(int fd, long long fileSize, size_t chunkSize, const std::vector<int>& algs, size_t threads,
+                    const std::vector<size_t>* chunks, std::vector< std::vector<std::string> >& leaves);
+
+/**
+ * Combines binary leaf digests into the root
+ * @param alg - the algorithm
+ * @param leaves - the binary leaf digests in chunk order
+ * @return the binary root digest
+ */
+std::string merkleRoot(int alg, const std::vector<std::string>& leaves);
+
+/**
+ * Writes a manifest (see above)
+ * @return false on a write error
+ */
+bool writeTreeManifest(FILE* out, const TreeManifest& manifest);
+
+/**
+ * Parses a manifest (see above)
+ * @return false if the file is missing or malformed (a message was printed)
+ */
+bool readTreeManifest(const std::string& path, TreeManifest& manifest);
+
+/**
+ * Parses a chunk selection such as "0,5,10-12"
+ * @param list - the selection
+ * @param chunkCount - the number of chunks in the file
+ * @param chunks - receives the indices in ascending order
+ * @return false if the list is malformed or out of range
+ */
+bool parseChunkList(const std::string& list, size_t chunkCount, std::vector<size_t>& chunks);
+
+#endif
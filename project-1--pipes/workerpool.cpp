@@ -0,0 +1,340 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#include "workerpool.h"
+#include "clock.h"
+#include "frame.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace std;
+
+/* The read end of the pipe */
+#define READ_END 0
+
+/* The write end of the pipe */
+#define WRITE_END 1
+
+/* The transport of the pools created from now on */
+static WorkerTransport defaultTransport = TRANSPORT_PIPE;
+
+void setWorkerTransport(WorkerTransport transport) {
+	defaultTransport = transport;
+}
+
+WorkerTransport workerTransport() {
+	return defaultTransport;
+}
+
+const char* workerTransportName(WorkerTransport transport) {
+	return transport == TRANSPORT_SHM ? "shm" : "pipe";
+}
+
+bool parseWorkerTransport(const char* name, WorkerTransport& transport) {
+	if (strcmp(name, "pipe") == 0)
+		transport = TRANSPORT_PIPE;
+	else if (strcmp(name, "shm") == 0)
+		transport = TRANSPORT_SHM;
+	else
+		return false;
+	return true;
+}
+
+WorkerPool::WorkerPool(size_t workerCount, WorkerHandler handler, size_t depth)
+    : depth(depth ? depth : 1), transport(defaultTransport), responseEvent(NULL), stopRequested(false) {
+	/* A worker that dies must not kill the parent while it writes a request;
+	   the caller's disposition comes back when the pool is destroyed */
+	struct sigaction ignore;
+	memset(&ignore, 0, sizeof(ignore));
+	ignore.sa_handler = SIG_IGN;
+	sigaction(SIGPIPE, &ignore, &previousSigpipe);
+	/* Buffered output would otherwise be flushed once more by every worker */
+	fflush(stdout);
+
+	if (transport == TRANSPORT_SHM && !(responseEvent = ShmEvent::create())) {
+		perror("Failed to map shared memory.");
+		exit(-1);
+	}
+
+	for (size_t i = 0; i < workerCount; ++i) {
+		Worker worker;
+		worker.requestFd = worker.responseFd = -1;
+		worker.requestRing = worker.responseRing = NULL;
+		int parentToChildPipe[2], childToParentPipe[2];
+		if (transport == TRANSPORT_SHM) {
+			worker.requestRing = ShmRing::create(SHM_RING_CAPACITY);
+			worker.responseRing = ShmRing::create(SHM_RING_CAPACITY, responseEvent);
+			if (!worker.requestRing || !worker.responseRing) {
+				perror("Failed to map shared memory.");
+				exit(-1);
+			}
+		} else if (pipe(parentToChildPipe) < 0 || pipe(childToParentPipe) < 0) {
+			perror("Failed to create pipe.");
+			exit(-1);
+		}
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("Failed to fork process.");
+			exit(-1);
+		} else if (pid == 0) {
+			/* Child */
+			/* Holding a sibling's request pipe open would keep it from seeing end of file */
+			for (size_t j = 0; j < workers.size(); ++j) {
+				if (transport == TRANSPORT_SHM) {
+					delete workers[j].requestRing;
+					delete workers[j].responseRing;
+				} else {
+					close(workers[j].requestFd);
+					close(workers[j].responseFd);
+				}
+			}
+			if (transport == TRANSPORT_SHM) {
+				/* A worker whose parent died stops waiting for requests */
+				worker.requestRing->setPeer(getppid());
+				worker.responseRing->setPeer(getppid());
+			} else {
+				close(parentToChildPipe[WRITE_END]);
+				close(childToParentPipe[READ_END]);
+				worker.requestFd = parentToChildPipe[READ_END];
+				worker.responseFd = childToParentPipe[WRITE_END];
+			}
+			serve(worker, handler);
+		}
+
+		/* Parent */
+		worker.pid = pid;
+		if (transport == TRANSPORT_SHM) {
+			worker.requestRing->setPeer(pid);
+			worker.responseRing->setPeer(pid);
+		} else {
+			if (close(parentToChildPipe[READ_END]) < 0 || close(childToParentPipe[WRITE_END]) < 0) {
+				perror("Unable to close pipe end.");
+				exit(-1);
+			}
+			worker.requestFd = parentToChildPipe[WRITE_END];
+			worker.responseFd = childToParentPipe[READ_END];
+		}
+		workers.push_back(worker);
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	/* End of file on the request pipe (or a closed ring) tells a worker to exit */
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (workers[i].requestRing)
+			workers[i].requestRing->close();
+		else
+			close(workers[i].requestFd);
+	}
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (workers[i].responseFd >= 0)
+			close(workers[i].responseFd);
+		if (waitpid(workers[i].pid, NULL, 0) < 0)
+			perror("Error occurred while waiting for a worker to terminate.");
+		delete workers[i].requestRing;
+		delete workers[i].responseRing;
+	}
+	ShmEvent::destroy(responseEvent);
+	sigaction(SIGPIPE, &previousSigpipe, NULL);
+}
+
+void WorkerPool::serve(const Worker& worker, WorkerHandler handler) {
+	string request;
+	for (;;) {
+		int status = worker.requestRing ? worker.requestRing->readMessage(request) : readFrame(worker.requestFd, request);
+		if (status == 0)
+			exit(0);
+		if (status < 0) {
+			perror("Worker failed to read a request.");
+			exit(-1);
+		}
+		string response = handler(request);
+		if (!(worker.responseRing ? worker.responseRing->writeMessage(response) : writeFrame(worker.responseFd, response))) {
+			perror("Worker failed to write a response.");
+			exit(-1);
+		}
+	}
+}
+
+void WorkerPool::run(const vector<string>& requests, ResultHandler onResult, void* context) {
+	size_t nextToSend = 0, completed = 0;
+
+	stopRequested = false;
+
+	while (completed < nextToSend || (!stopRequested && nextToSend < requests.size())) {
+		/* Top up every worker's queue, least busy worker first */
+		while (!stopRequested && nextToSend < requests.size()) {
+			Worker* idlest = NULL;
+			for (size_t i = 0; i < workers.size(); ++i) {
+				if (workers[i].outstanding.size() < depth &&
+				    (!idlest || workers[i].outstanding.size() < idlest->outstanding.size()))
+					idlest = &workers[i];
+			}
+			if (!idlest)
+				break;
+			bool sent = idlest->requestRing ? idlest->requestRing->writeMessage(requests[nextToSend])
+			                                : writeFrame(idlest->requestFd, requests[nextToSend]);
+			if (!sent) {
+				perror("Parent failed to send a request.");
+				exit(-1);
+			}
+			idlest->outstanding.push_back(nextToSend++);
+		}
+
+		if (transport == TRANSPORT_SHM)
+			receiveRings(completed, onResult, context);
+		else
+			receivePipes(completed, onResult, context);
+	}
+}
+
+void WorkerPool::deliver(Worker& worker, size_t& completed, ResultHandler onResult, void* context) {
+	/* Responses come back in the order the requests were queued */
+	string response;
+	while (!worker.outstanding.empty() && extractFrame(worker.received, response)) {
+		size_t requestId = worker.outstanding.front();
+		worker.outstanding.pop_front();
+		++completed;
+		onResult(requestId, response, context);
+	}
+}
+
+void WorkerPool::receivePipes(size_t& completed, ResultHandler onResult, void* context) {
+	vector<struct pollfd> pollFds;
+	vector<size_t> pollOwners;
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (!workers[i].outstanding.empty()) {
+			struct pollfd pfd = {workers[i].responseFd, POLLIN, 0};
+			pollFds.push_back(pfd);
+			pollOwners.push_back(i);
+		}
+	}
+	if (poll(&pollFds[0], pollFds.size(), -1) < 0) {
+		if (errno == EINTR)
+			return;
+		perror("Failed to poll pipes.");
+		exit(-1);
+	}
+
+	for (size_t k = 0; k < pollFds.size(); ++k) {
+		if (!(pollFds[k].revents & (POLLIN | POLLHUP | POLLERR)))
+			continue;
+		Worker& worker = workers[pollOwners[k]];
+		char buffer[65536];
+		ssize_t got = read(worker.responseFd, buffer, sizeof(buffer));
+		if (got < 0 && errno == EINTR)
+			continue;
+		if (got <= 0) {
+			fprintf(stderr, "Worker %d exited with %zu request(s) pending.\n", (int)worker.pid,
+			        worker.outstanding.size());
+			exit(-1);
+		}
+		worker.received.append(buffer, got);
+		deliver(worker, completed, onResult, context);
+	}
+}
+
+void WorkerPool::receiveRings(size_t& completed, ResultHandler onResult, void* context) {
+	/* Spin a little first: a response is often only microseconds away */
+	for (int spin = shmSpinLimit();; --spin) {
+		bool received = false;
+		for (size_t i = 0; i < workers.size(); ++i) {
+			Worker& worker = workers[i];
+			if (!worker.outstanding.empty() && worker.responseRing->readAvailable(worker.received)) {
+				deliver(worker, completed, onResult, context);
+				received = true;
+			}
+		}
+		if (received)
+			return;
+		if (spin <= 0)
+			break;
+		cpuRelax();
+	}
+
+	/* Then sleep on the event every response ring signals */
+	uint32_t key = responseEvent->prepareWait();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		if (!workers[i].outstanding.empty() && workers[i].responseRing->hasData()) {
+			responseEvent->cancelWait();
+			return;
+		}
+	}
+	responseEvent->wait(key, 100);
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		Worker& worker = workers[i];
+		if (!worker.outstanding.empty() && !worker.responseRing->hasData() && !worker.responseRing->peerAlive()) {
+			fprintf(stderr, "Worker %d exited with %zu request(s) pending.\n", (int)worker.pid,
+			        worker.outstanding.size());
+			exit(-1);
+		}
+	}
+}
+
+/**
+ * The benchmark worker: acknowledges every message with an empty response
+ */
+static string acknowledge(const string&) {
+	return string();
+}
+
+/**
+ * Counts the benchmark's responses
+ */
+static void countResponse(size_t, const string&, void* context) {
+	++*(size_t*)context;
+}
+
+/**
+ * Sends batches of equal messages to one worker for about a quarter second
+ * @param depth - the requests in flight; 1 measures the round trip
+ * @return the seconds per message
+ */
+static double timeTransport(WorkerTransport transport, size_t messageSize, size_t depth) {
+	WorkerTransport saved = workerTransport();
+	setWorkerTransport(transport);
+	WorkerPool pool(1, acknowledge, depth);
+	setWorkerTransport(saved);
+
+	/* About 16 MB per batch, so 1 MB messages do not need 1 GB of copies */
+	size_t batch = max((size_t)16, min((size_t)4096, (size_t)(16u << 20) / messageSize));
+	vector<string> requests(batch, string(messageSize, 'x'));
+	size_t responses = 0;
+	/* One untimed batch faults in the rings and the buffers */
+	pool.run(requests, countResponse, &responses);
+
+	responses = 0;
+	double startTime = monotonicNow(), elapsed = 0;
+	while (elapsed < 0.25) {
+		pool.run(requests, countResponse, &responses);
+		elapsed = monotonicNow() - startTime;
+	}
+	return elapsed / responses;
+}
+
+int benchTransports() {
+	fprintf(stdout, "%10s %12s %12s %14s %14s\n", "size", "pipe MB/s", "shm MB/s", "pipe rtt us", "shm rtt us");
+	for (size_t size = 64; size <= (1u << 20); size *= 4) {
+		double pipeStreaming = timeTransport(TRANSPORT_PIPE, size, 16);
+		double shmStreaming = timeTransport(TRANSPORT_SHM, size, 16);
+		double pipeRoundTrip = timeTransport(TRANSPORT_PIPE, size, 1);
+		double shmRoundTrip = timeTransport(TRANSPORT_SHM, size, 1);
+		fprintf(stdout, "%10zu %12.1f %12.1f %14.2f %14.2f\n", size, size / pipeStreaming / 1e6,
+		        size / shmStreaming / 1e6, pipeRoundTrip * 1e6, shmRoundTrip * 1e6);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,158 @@
+/*
+Author: Gaubert Santiago
+Email: gaubert.santiago@csu.fullerton.edu
+*/
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <deque>
+#include <string>
+#include <vector>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "shmring.h"
+
+/* How requests and responses travel between the parent and its workers */
+enum WorkerTransport {
+	/* A pipe each way, read and written with system calls */
+	TRANSPORT_PIPE = 0,
+	/* A shared-memory ring each way, with futex wake-ups (shmring.h) */
+	TRANSPORT_SHM
+};
+
+/**
+ * Selects the transport of the pools created from now on (default: pipe)
+ */
+void setWorkerTransport(WorkerTransport transport);
+
+/**
+ * @return the transport new pools use
+ */
+WorkerTransport workerTransport();
+
+/**
+ * @return "pipe" or "shm"
+ */
+const char* workerTransportName(WorkerTransport transport);
+
+/**
+ * Parses a --transport argument
+ * @return false if the name is unknown
+ */
+bool parseWorkerTransport(const char* name, WorkerTransport& transport);
+
+/**
+ * Sends messages of 64 B to 1 MB to a worker over each transport and
+ * prints the throughput (with requests pipelined) and the round-trip time
+ * @return the exit status
+ */
+int benchTransports();
+
+/**
+ * The function a worker runs for every request it receives
+ * @param request - the request payload
+ * @return the response payload
+ */
+typedef std::string (*WorkerHandler)(const std::string& request);
+
+/**
+ * Called in the parent for every response, in completion order
+ * @param requestId - the index of the request passed to WorkerPool::run()
+ * @param response - the worker's response
+ * @param context - the pointer given to WorkerPool::run()
+ */
+typedef void (*ResultHandler)(size_t requestId, const std::string& response, void* context);
+
+/**
+ * A fixed set of worker processes forked once and fed many requests as
+ * framed messages over one parent-to-child and one child-to-parent pipe
+ * (or shared-memory ring) each. Every worker may have several requests
+ * queued so it can start the next one as soon as it sends a response.
+ */
+class WorkerPool {
+public:
+	/**
+	 * Forks the workers; they inherit the parent's state at this point
+	 * @param workerCount - the number of worker processes
+	 * @param handler - what each worker runs per request
+	 * @param depth - the number of requests queued per worker
+	 */
+	WorkerPool(size_t workerCount, WorkerHandler handler, size_t depth = 2);
+
+	/**
+	 * Closes the request pipes, waits for every worker to exit and
+	 * restores the SIGPIPE disposition the constructor replaced
+	 */
+	~WorkerPool();
+
+	/**
+	 * Sends every request to the least busy worker and collects the responses
+	 * @param requests - the request payloads
+	 * @param onResult - called once per request
+	 * @param context - passed through to onResult
+	 */
+	void run(const std::vector<std::string>& requests, ResultHandler onResult, void* context);
+
+	/**
+	 * Called from a result handler: run() sends no further requests and
+	 * returns once the requests already queued are answered
+	 */
+	void stop() { stopRequested = true; }
+
+	/**
+	 * @return the number of worker processes
+	 */
+	size_t size() const { return workers.size(); }
+
+private:
+	/* The parent's view of one worker */
+	struct Worker {
+		pid_t pid;
+		/* The write end of the parent-to-child pipe, or -1 */
+		int requestFd;
+		/* The read end of the child-to-parent pipe, or -1 */
+		int responseFd;
+		/* The rings used instead of the pipes by TRANSPORT_SHM, or NULL */
+		ShmRing* requestRing;
+		ShmRing* responseRing;
+		/* The ids of the requests sent but not answered yet, oldest first */
+		std::deque<size_t> outstanding;
+		/* Bytes received that do not form a whole frame yet */
+		std::string received;
+	};
+
+	/**
+	 * The body of a worker process; never returns
+	 * @param worker - its pipes or rings, seen from the parent
+	 */
+	static void serve(const Worker& worker, WorkerHandler handler);
+
+	/**
+	 * Hands every complete response of a worker to onResult
+	 */
+	void deliver(Worker& worker, size_t& completed, ResultHandler onResult, void* context);
+
+	/**
+	 * Waits for responses on the pipes or the rings and delivers them
+	 */
+	void receivePipes(size_t& completed, ResultHandler onResult, void* context);
+	void receiveRings(size_t& completed, ResultHandler onResult, void* context);
+
+	std::vector<Worker> workers;
+	size_t depth;
+	WorkerTransport transport;
+	/* Signalled by every response ring, so the parent sleeps on one futex */
+	ShmEvent* responseEvent;
+	/* Set by stop() */
+	bool stopRequested;
+	/* The SIGPIPE disposition to restore once the workers are gone */
+	struct sigaction previousSigpipe;
+
+	/* Not copyable: the destructor owns the processes */
+	WorkerPool(const WorkerPool&);
+	WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif
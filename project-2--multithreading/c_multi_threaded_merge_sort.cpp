@@ -3,74 +3,100 @@
 #include <vector>
 #include <algorithm>
 #include <utility>
-#include <cmath>
+#include <chrono>
+#include <cstdio>
 #include <pthread.h>
+#include <unistd.h>
+#include "external_sort.h"
+#include "parallel_merge_sort.h"
+#include "radix_sort.h"
+#include "simd_sort.h"
+#include "work_stealing_pool.h"
 
 #define LOWER_BOUND 1
 #define USAGE_ERROR 1
+#define IO_ERROR 2
 
-// Struct type to hold arguments for sorting operations
+// Struct type to hold the options given before the positional arguments
 typedef struct {
-	std::pair<size_t, size_t> idx_pair;
-	size_t i;
-} sorting_op_args_t;
-
-// Struct type to hold arguments for merging operations
+	// threads: number of worker threads (0 = one per online CPU)
+	size_t threads;
+	// sort: "merge" sorts the partitions and merges them, "radix" sorts the whole list by the
+	//       digits of its keys (a counting sort when <MAX_VALUE> is small), "external" sorts a
+	//       file of the list that need not fit in memory
+	std::string sort;
+	// merge: "kway" merges up to KWAY_MAX_WAYS partitions at once with a loser tree,
+	//        "pairwise" merges them two at a time
+	std::string merge;
+	// simd: vector instructions of the partition sort and two-way merge kernels (SIMD_SCALAR: std::sort
+	//       and std::merge), already lowered to what the CPU supports
+	simd_level_t simd;
+	// memory_mb: memory budget of the external sort, in MiB
+	size_t memory_mb;
+	// temp_dir: directory of the external sort's list files and run files
+	std::string temp_dir;
+	// quiet: print one line of timings instead of the lists
+	bool quiet;
+} options_t;
+
+options_t options = {0, "merge", "kway", SIMD_SCALAR, 256, "/var/tmp", false};
+
+// Struct type that shows each stage of parallel_merge_sort() through the lists it leaves behind
+// (nothing with -q)
 typedef struct {
-	std::vector<int> in_part_a;
-	std::vector<int> in_part_b;
-	std::vector<int> out_part;
-	size_t i;
-} merging_op_args_t;
+	void partitions_sorted(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions);
+	void pass_merged(size_t pass, std::vector<int>::iterator src, std::vector<int>::iterator dst,
+									 const merge_sort_partitions_t& in_pairs, size_t ways, const merge_sort_partitions_t& out_pairs);
+} display_observer_t;
 
 // rand_int_list: generated list of random integers (original list)
 std::vector<int> rand_int_list;
 
-// pairs: tuple to hold both starting and ending indices of each partition
-std::vector< std::pair<size_t, size_t> > pairs;
-
-// Temporary vectors for merging operations 
-// input_partitions: partitions before merging operations
-// output_partitions: partitions after merting operations
-// pass_last_partitions: last partition of the list of partitions at each pass (when p_before_merge is odd)
-std::vector< std::vector<int> > input_partitions, 
-																output_partitions, 
-																pass_last_partitions;
-
-// last_partitions_merge_output: result of the merging of two pass_last_partitions
-std::vector<int> last_partitions_merge_output;
+// pairs: tuple to hold both starting and ending indices of each partition (as parallel_merge_sort() cuts them)
+merge_sort_partitions_t pairs;
 
 void print_usage();
+void parse_options(int &argc, char **&argv);
 void validate_argv(int &argc, char *argv[]);
 std::string dump_partition(std::vector<int> &partition); // Overloaded
 void generate_list(const size_t &n, const size_t &upper_bound);
 void print_list();
-void set_partition_delimiters(const size_t &n, const size_t &p);
-std::string dump_partition(std::pair<size_t, size_t> &pair); // Overloaded 
-void print_partitions(); // Overloaded 
-void display_sort_msg(std::pair<size_t, size_t>& idx_pair, size_t& part_id);
-void* cpp_sort(void *args_ptr);
-void sort_partitions_multithreaded(std::vector<pthread_t>& threads, const size_t& p);
-void print_partitions(std::vector< std::vector<int> >& partitions); // Overloaded
-void display_merge_msg(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part, size_t& part_id);
-void* cpp_merge(void* args_ptr);
-void merge_partitions_multithreaded(std::vector<pthread_t>& threads, const size_t& p);
+std::string dump_partition(const std::pair<size_t, size_t> &pair); // Overloaded
+std::string dump_partition(std::vector<int>::iterator list, const std::pair<size_t, size_t> &pair); // Overloaded
+void print_partitions(); // Overloaded
+void display_sort_msg(std::vector<int>::iterator list, const std::pair<size_t, size_t>& idx_pair, size_t part_id);
+void print_partitions(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions); // Overloaded
+void display_merge_msg(std::vector<int>::iterator src, std::vector<int>::iterator dst, const std::pair<size_t, size_t>* in_pairs,
+											 size_t ways, size_t i, const std::pair<size_t, size_t>& out_pair);
+double seconds_since(const std::chrono::steady_clock::time_point& start);
+void print_timings(work_stealing_pool& pool, const size_t& p, size_t passes, double sort_seconds, double merge_seconds);
+int external_main(const size_t &n, const size_t &upper_bound, const size_t &p);
+bool generate_file(const std::string &path, const size_t &n, const size_t &upper_bound);
+bool file_is_sorted(const std::string &path, const size_t &n);
 
 int main(int argc, char *argv[]) {
+	parse_options(argc, argv);
+
 	// Validate arguments that are passed in upon running executable
 	validate_argv(argc, argv);
 
 	// n: number of elements to be generated
-	const size_t n = std::stoi(argv[1]);
+	const size_t n = std::stoull(argv[1]);
 	// upper_bound: max. possible value of an integer element of the original list
 	const size_t upper_bound = std::stoi(argv[2]);
 	// p: number of partitions to be created
 	const size_t p = std::stoi(argv[3]);
 
+	// The list may not fit in memory: it never goes into rand_int_list
+	if (options.sort == "external")
+		return external_main(n, upper_bound, p);
+
 	// Generate list of random integers
 	generate_list(n, upper_bound);
-	std::cout << "Generated list of random integers:\n\n  ";
-	print_list();
+	if (!options.quiet) {
+		std::cout << "Generated list of random integers:\n\n  ";
+		print_list();
+	}
 
 	// No need for partitioning, sorting, and merging if list has only 1 element
 	if (rand_int_list.size() == 1) {
@@ -79,8 +105,25 @@ int main(int argc, char *argv[]) {
 		return 0;
 	}
 
-	// No need for partitioning and merging
-	if (p == 1) {
+	// The keys lie in [LOWER_BOUND, LOWER_BOUND + upper_bound]: sort them by their digits, no partitions needed
+	if (options.sort == "radix") {
+		work_stealing_pool pool(options.threads);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		std::vector<int> scratch_list(n);
+		const int max_value = LOWER_BOUND + (int) std::min<size_t>(upper_bound, RAND_MAX - LOWER_BOUND);
+		size_t passes = parallel_radix_sort(pool, &rand_int_list[0], &scratch_list[0], n, LOWER_BOUND, max_value);
+		double sort_seconds = seconds_since(start);
+		if (options.quiet) {
+			print_timings(pool, p, passes, sort_seconds, 0);
+		} else {
+			std::cout << "\nList after multithreaded radix sort (" << passes << " passes):\n\n  ";
+			std::cout << dump_partition(rand_int_list) << std::endl;
+		}
+		return 0;
+	}
+
+	// No need for partitioning and merging (with -q the pipeline still runs, for its line of timings)
+	if (p == 1 && !options.quiet) {
 		std::cout << "\nNo need for partitioning and merging. Result of sorting:\n\n  ";
 		std::sort(rand_int_list.begin(), rand_int_list.end());
 		std::cout << dump_partition(rand_int_list) << std::endl;
@@ -88,22 +131,37 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Break down list into partitions (within original random int list)
-	set_partition_delimiters(n, p);
-	std::cout << "\nList breakdown into partitions:\n";
-	print_partitions();
+	merge_sort_partition(n, p, pairs);
+	if (!options.quiet) {
+		std::cout << "\nList breakdown into partitions:\n";
+		print_partitions();
+	}
 
-	// Sort partitions in a multithreaded and sorted way
-	std::cout << "\nPartitions after multithreaded sorting:\n\n";
-	std::vector<pthread_t> threads(p);
-	sort_partitions_multithreaded(threads, p);
+	// Sort partitions in a multithreaded and sorted way, then merge them, building back one single list
+	// pool: worker threads shared by every sorting and merging task, however many partitions there are
+	work_stealing_pool pool(options.threads);
+	merge_sort_options_t sort_options = {p, options.merge == "pairwise", false};
+	display_observer_t observer;
+	merge_sort_stats_t stats;
+	if (options.simd == SIMD_SCALAR) {
+		merge_sort_std_kernels kernels = {false};
+		stats = parallel_merge_sort(pool, rand_int_list.begin(), rand_int_list.end(), std::less<int>(), sort_options,
+																kernels, observer);
+	} else {
+		simd_sort_kernels kernels = {options.simd};
+		stats = parallel_merge_sort(pool, rand_int_list.begin(), rand_int_list.end(), std::less<int>(), sort_options,
+																kernels, observer);
+	}
+	size_t passes = stats.passes;
+	double sort_seconds = stats.sort_seconds, merge_seconds = stats.merge_seconds;
 
-	// Merge partitions in a multithreaded and sorted way, building back one single list
-  std::cout << "\nMultithreaded merging of partitions:\n";
-	threads.clear();
-  merge_partitions_multithreaded(threads, p);
+	if (options.quiet) {
+		print_timings(pool, p, passes, sort_seconds, merge_seconds);
+		return 0;
+	}
 
+	// The merged list ends up back in rand_int_list, as the project requires
 	std::cout << "\nResult of list partitioning, followed by partition multithreaded sorting, followed by partition multithreaded merging:\n\n  ";
-	rand_int_list = output_partitions[0]; // This assignment is part of the requirements of the project
 	std::cout << dump_partition(rand_int_list) << std::endl;
 
 	return 0;
@@ -112,19 +170,102 @@ int main(int argc, char *argv[]) {
 void print_usage() {
 	std::cout << "Usage:" << std::endl
 						<< std::endl
-						<< "    multi_threaded_merge_sort <N> <MAX_VALUE> <P>" << std::endl
+						<< "    c_multi_threaded_merge_sort [-t <THREADS>] [-a <SORT>] [-m <MERGE>] [-s <SIMD>] [-M <MEMORY>] [-T <DIR>] [-q] <N> <MAX_VALUE> <P>" << std::endl
 						<< std::endl
 						<< "where" << std::endl
 						<< std::endl
 						<< "    <N> is a positive integer representing the size of your list of elements" << std::endl
 						<< "    <MAX_VALUE> is a positive integer representing the possible max. value of the list elements " << std::endl
 						<< "    <P> is a positive integer (greater than zero) representing the intended number of partitions to break down the list into" << std::endl
+						<< "    <THREADS> is the number of worker threads sorting and merging the partitions (default: one per CPU)" << std::endl
+						<< "    <SORT> is merge (sort <P> partitions, then merge them, default)" << std::endl
+						<< "           or radix (sort the whole list by the digits of its keys, <P> is not used)" << std::endl
+						<< "           or external (write the list to a file in <DIR> and sort it into another one in runs" << std::endl
+						<< "           of <MEMORY>/3, <P> partitions each, merged up to " << KWAY_MAX_WAYS << " runs per pass)" << std::endl
+						<< "    <MERGE> is kway (merge up to " << KWAY_MAX_WAYS << " partitions per pass with a loser tree, default)" << std::endl
+						<< "            or pairwise (merge two partitions at a time, log2(P) passes)" << std::endl
+						<< "    <SIMD> is scalar (std::sort and std::merge, default), avx2, avx512 or auto (the best the CPU has):" << std::endl
+						<< "           the instruction set of the partition sort and of merges of two partitions" << std::endl
+						<< "    <MEMORY> is the memory budget of the external sort in MiB (default: " << options.memory_mb << ")" << std::endl
+						<< "    <DIR> is where the external sort keeps its files (default: " << options.temp_dir << ")" << std::endl
+						<< "    -q prints one line of timings instead of the lists" << std::endl
 						<< std::endl
 						<< "Example:" << std::endl
 						<< "    $ ./multi_threaded_merge_sort 25 100 5" << std::endl
 						<< std::endl;
 }
 
+void parse_options(int &argc, char **&argv) {
+	int opt;
+	while ((opt = getopt(argc, argv, "t:a:m:s:M:T:q")) != -1) {
+		switch (opt) {
+		case 't': {
+			const std::string threads_str(optarg);
+			for (int i = 0; i < threads_str.size(); i++) {
+				if (!isdigit(threads_str[i])) {
+					std::cout << "Invalid number of threads." << std::endl;
+					print_usage();
+					exit(USAGE_ERROR);
+				}
+			}
+			options.threads = std::stoi(threads_str);
+			break;
+		}
+		case 'a':
+			options.sort = optarg;
+			if (options.sort != "merge" && options.sort != "radix" && options.sort != "external") {
+				std::cout << "Invalid sorting algorithm." << std::endl;
+				print_usage();
+				exit(USAGE_ERROR);
+			}
+			break;
+		case 'm':
+			options.merge = optarg;
+			if (options.merge != "kway" && options.merge != "pairwise") {
+				std::cout << "Invalid merging scheme." << std::endl;
+				print_usage();
+				exit(USAGE_ERROR);
+			}
+			break;
+		case 's':
+			if (!simd_parse_level(optarg, options.simd)) {
+				std::cout << "Invalid instruction set." << std::endl;
+				print_usage();
+				exit(USAGE_ERROR);
+			}
+			options.simd = simd_level(options.simd);
+			break;
+		case 'M': {
+			const std::string memory_str(optarg);
+			bool terminate = memory_str.empty();
+			for (int i = 0; i < memory_str.size(); i++)
+				terminate |= !isdigit(memory_str[i]);
+			if (terminate || !std::stoull(memory_str)) {
+				std::cout << "Invalid memory budget." << std::endl;
+				print_usage();
+				exit(USAGE_ERROR);
+			}
+			options.memory_mb = std::stoull(memory_str);
+			break;
+		}
+		case 'T':
+			options.temp_dir = optarg;
+			break;
+		case 'q':
+			options.quiet = true;
+			break;
+		default:
+			print_usage();
+			exit(USAGE_ERROR);
+		}
+	}
+
+	// Drop the options so that the positional arguments are argv[1], argv[2], ...
+	argv[optind - 1] = argv[0];
+	argv += optind - 1;
+	argc -= optind - 1;
+}
+
 void validate_argv(int &argc, char *argv[]) {
 	if (argc != 4) {
 		std::cout << "Invalid number of arguments." << std::endl;
@@ -166,7 +307,7 @@ void validate_argv(int &argc, char *argv[]) {
 	}
 
 	// Stop execution if #partitions > #elements
-	if (std::stoi(argv[3]) > std::stoi(argv[1])) {
+	if (std::stoull(argv[3]) > std::stoull(argv[1])) {
 		std::cout << "The number of elements in the list (1st arg.) has to be bigger the the number of intended partitions (3rd arg.)."
 							<< std::endl;
 		exit(USAGE_ERROR);
@@ -202,26 +343,18 @@ void print_list() {
 						<< std::flush;
 }
 
-void set_partition_delimiters(const size_t &n, const size_t &p) {
-	// pair: holds starting and ending indices of a given partition
-	std::pair<size_t, size_t> pair;
-	for (size_t i = 0; i < p; i++) {
-		pair.first = i * floor(n / p);
-		if (i < p - 1)
-			pair.second = (i + 1) * floor(n / p);
-		else
-			pair.second = n;
-		pairs.push_back(pair);
-	}
+// Overloaded
+std::string dump_partition(const std::pair<size_t, size_t> &pair) {
+	return dump_partition(rand_int_list.begin(), pair);
 }
 
 // Overloaded
-std::string dump_partition(std::pair<size_t, size_t> &pair) {
+std::string dump_partition(std::vector<int>::iterator list, const std::pair<size_t, size_t> &pair) {
 	// Build partition string
 	std::string str("");
 	str += '[';
 	for (size_t i = pair.first; i < pair.second; i++) {
-		str += std::to_string(rand_int_list[i]);
+		str += std::to_string(list[i]);
 		if (i != pair.second - 1)
 			str += ' ';
 	}
@@ -239,168 +372,158 @@ void print_partitions() {
 							<< std::flush;
 }
 
-void display_sort_msg(std::pair<size_t, size_t>& idx_pair, size_t& part_id) {
-  std::string str("  Part. " + std::to_string(part_id) + ": " + dump_partition(idx_pair) 
+void display_sort_msg(std::vector<int>::iterator list, const std::pair<size_t, size_t>& idx_pair, size_t part_id) {
+  std::string str("  Part. " + std::to_string(part_id) + ": " + dump_partition(list, idx_pair)
 														 + " (size=" + std::to_string(idx_pair.second - idx_pair.first ) + ")\n");
   std::cout << str;
 }
 
-void *cpp_sort(void *args_ptr) {
-	sorting_op_args_t* args = (sorting_op_args_t*) args_ptr;
-	std::sort(rand_int_list.begin() + args->idx_pair.first,
-						rand_int_list.begin() + args->idx_pair.second);
-	display_sort_msg(args->idx_pair, args->i);
-	pthread_exit(0);
+void display_observer_t::partitions_sorted(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions) {
+	if (options.quiet)
+		return;
+	std::cout << "\nPartitions after multithreaded sorting:\n\n";
+	for (size_t i = 0; i < partitions.size(); i++)
+		display_sort_msg(list, partitions[i], i);
+	std::cout << "\nMultithreaded merging of partitions:\n";
 }
 
-void sort_partitions_multithreaded(std::vector<pthread_t>& threads, const size_t& p) {
-	std::vector<sorting_op_args_t> sorting_args;
+// Overloaded
+void print_partitions(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions) {
+	std::cout << std::endl;
+	for (int i = 0; i < partitions.size(); i++)
+		std::cout << "  Part. " << i << ": " << dump_partition(list, partitions[i])
+							<< " (size=" << partitions[i].second - partitions[i].first << ")"
+							<< std::endl
+							<< std::flush;
+}
 
-	// Populate sorting struct vector in preparation for sorting
-	for (size_t i = 0; i < p; i++)
-		sorting_args.push_back((sorting_op_args_t) {
-														.idx_pair = pairs[i],
-														.i = i
-													});
+void display_merge_msg(std::vector<int>::iterator src, std::vector<int>::iterator dst, const std::pair<size_t, size_t>* in_pairs,
+											 size_t ways, size_t i, const std::pair<size_t, size_t>& out_pair) {
+	std::string str("\n * Merged ");
+	for (size_t j = 0; j < ways; j++)
+		str += std::string(j ? " and " : "") + "\n    Part. " + std::to_string(ways*i + j) + ":\t "
+					 + dump_partition(src, in_pairs[j])
+					 + " (size=" + std::to_string(in_pairs[j].second - in_pairs[j].first) + ")";
+	str += "\n - Result: \n    New Part. " + std::to_string(i) + ": " + dump_partition(dst, out_pair)
+				 + " (size=" + std::to_string(out_pair.second - out_pair.first) + ")\n";
+	std::cout << str;
+}
 
-	// Sort elements in each partition of the original random int list (same resource) in a multithreaded way
-	for (size_t i = 0; i < p; i++)	
-		pthread_create(&threads[i], NULL, &cpp_sort, (void *) &sorting_args[i]);	
+void display_observer_t::pass_merged(size_t pass, std::vector<int>::iterator src, std::vector<int>::iterator dst,
+																		 const merge_sort_partitions_t& in_pairs, size_t ways, const merge_sort_partitions_t& out_pairs) {
+	if (options.quiet)
+		return;
+	std::cout << "\n-----------------------------   PASS " << pass << "   -----------------------------" << std::endl;
+	for (size_t i = 0; i < out_pairs.size(); i++) {
+		// A partition without partners is only carried over into dst
+		size_t group = std::min(ways, in_pairs.size() - i*ways);
+		if (group > 1)
+			display_merge_msg(src, dst, &in_pairs[i*ways], group, i, out_pairs[i]);
+	}
+	std::cout << "\nPartitions after multithreaded merging - PASS: " << pass << "\n";
+	print_partitions(dst, out_pairs);
+}
 
-	// Synchronize all threads
-	for (size_t i = 0; i < p; i++)
-		pthread_join(threads[i], NULL);
+double seconds_since(const std::chrono::steady_clock::time_point& start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
-// Overloaded
-void print_partitions(std::vector< std::vector<int> >& partitions) {
-  std::cout << std::endl;
-  for (int i = 0; i < partitions.size(); i++) {
-    std::cout << "  Part. " << i << ": " << dump_partition(partitions[i]) << " (size=" << partitions[i].size() << ")"
-              << std::endl << std::flush;
-  }
+// Prints the one line of -q: the settings, the timings (in total and per element), and whether the list came out sorted
+void print_timings(work_stealing_pool& pool, const size_t& p, size_t passes, double sort_seconds, double merge_seconds) {
+	std::cout << "sort=" << options.sort << " merge=" << (options.sort == "merge" ? options.merge : "none")
+						<< " simd=" << simd_level_name(options.simd)
+						<< " threads=" << pool.size() << " n=" << rand_int_list.size() << " p=" << p << " passes=" << passes
+						<< " sort_s=" << sort_seconds << " merge_s=" << merge_seconds
+						<< " sort_ns=" << sort_seconds*1e9/rand_int_list.size() << " merge_ns=" << merge_seconds*1e9/rand_int_list.size()
+						<< " sorted=" << (std::is_sorted(rand_int_list.begin(), rand_int_list.end()) ? "yes" : "no") << std::endl;
 }
 
-void display_merge_msg(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part, size_t& part_id) {
-  std::string str("\n * Merged \n    Part. " + std::to_string(2*part_id) + ":\t " + dump_partition(in_part_a) + " (size=" + std::to_string(in_part_a.size()) + ")" + " and " 
-                            + "\n    Part. " + std::to_string(2*part_id + 1) + ":\t " + dump_partition(in_part_b) + " (size=" + std::to_string(in_part_b.size()) + ")" 
-                + "\n - Result: \n    New Part. " + std::to_string(part_id) + ": " + dump_partition(out_part) + " (size=" + std::to_string(out_part.size()) + ")\n");
-  std::cout << str;
+// Sorts a list too large for memory: it is generated into a file in options.temp_dir, sorted by
+// external_sort() into another one, and read back to check it
+int external_main(const size_t &n, const size_t &upper_bound, const size_t &p) {
+	const std::string path = options.temp_dir + "/c_multi_threaded_merge_sort." + std::to_string(getpid());
+	if (!generate_file(path + ".in", n, upper_bound)) {
+		std::cout << "Cannot write the list to " << path << ".in" << std::endl;
+		unlink((path + ".in").c_str());
+		return IO_ERROR;
+	}
+
+	// pool: worker threads sorting the runs and merging them
+	work_stealing_pool pool(options.threads);
+	external_sort_options_t sort_options = {options.memory_mb << 20, options.temp_dir,
+																					{p, options.merge == "pairwise", false}};
+	external_sort_stats_t stats;
+	std::string error;
+	bool ok;
+	if (options.simd == SIMD_SCALAR) {
+		ok = external_sort<int>(pool, path + ".in", path + ".out", std::less<int>(), sort_options, stats, error);
+	} else {
+		simd_sort_kernels kernels = {options.simd};
+		ok = external_sort<int>(pool, path + ".in", path + ".out", std::less<int>(), sort_options, kernels, stats, error);
+	}
+	unlink((path + ".in").c_str());
+	if (!ok) {
+		std::cout << "External sort failed: " << error << std::endl;
+		unlink((path + ".out").c_str());
+		return IO_ERROR;
+	}
+	bool sorted = file_is_sorted(path + ".out", n);
+	unlink((path + ".out").c_str());
+
+	const double mib = 1 << 20;
+	if (options.quiet) {
+		std::cout << "sort=external merge=kway simd=" << simd_level_name(options.simd)
+							<< " threads=" << pool.size() << " n=" << n << " p=" << p << " memory_mb=" << options.memory_mb
+							<< " runs=" << stats.runs << " passes=" << stats.passes << " spill_mb=" << stats.spilled_bytes/mib
+							<< " io_mb=" << (stats.read_bytes + stats.written_bytes)/mib
+							<< " sort_s=" << stats.run_seconds << " merge_s=" << stats.merge_seconds
+							<< " sort_ns=" << stats.run_seconds*1e9/n << " merge_ns=" << stats.merge_seconds*1e9/n
+							<< " sorted=" << (sorted ? "yes" : "no") << std::endl;
+		return 0;
+	}
+	std::cout << "\nResult of external sorting of " << n << " elements (" << n*sizeof(int)/mib << " MiB) in "
+						<< options.memory_mb << " MiB of memory:\n\n"
+						<< "  Runs generated:   " << stats.runs << " (" << stats.run_seconds << " s)\n"
+						<< "  Merge passes:     " << stats.passes << " (" << stats.merge_seconds << " s)\n"
+						<< "  Spilled to runs:  " << stats.spilled_bytes/mib << " MiB\n"
+						<< "  Read / written:   " << stats.read_bytes/mib << " / " << stats.written_bytes/mib << " MiB\n"
+						<< "  Sorted:           " << (sorted ? "yes" : "no") << std::endl;
+	return 0;
 }
 
-void* cpp_merge(void* args_ptr) {
-	merging_op_args_t* args = (merging_op_args_t*) args_ptr;
+// Writes n random elements to path as raw ints, a block at a time
+bool generate_file(const std::string &path, const size_t &n, const size_t &upper_bound) {
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
 
-	// Output partition has the size of the sum of the two input partitions
-	args->out_part.resize(args->in_part_a.size() + args->in_part_b.size());
+	// Initialize random seed
+	srand(time(NULL));
 
-  std::merge(args->in_part_a.begin(), args->in_part_a.end(), 
-						 args->in_part_b.begin(), args->in_part_b.end(), 
-						 args->out_part.begin());
-  display_merge_msg(args->in_part_a, args->in_part_b, args->out_part, args->i);
-  pthread_exit(0);
+	std::vector<int> block(1 << 20);
+	bool ok = true;
+	for (size_t i = 0; i < n && ok; i += block.size()) {
+		size_t count = std::min(block.size(), n - i);
+		for (size_t j = 0; j < count; j++)
+			block[j] = rand() % (!upper_bound ? 1 : upper_bound + 1) + LOWER_BOUND;
+		ok = fwrite(&block[0], sizeof(int), count, file) == count;
+	}
+	return fclose(file) == 0 && ok;
 }
 
-void merge_partitions_multithreaded(std::vector<pthread_t>& threads, const size_t& p) {
-  // p_before_merge: number of partitions before merging operations
-  size_t p_before_merge = p;
-  // p_after_merge: number of partitions after merging operations
-  size_t p_after_merge = p/2;
-  // counter: pass counter
-  size_t counter = 0;
-
-	// Prepare for multithreaded merging by creating temporary vectors 
-	for (size_t i = 0; i < p; i++) 
-		input_partitions.push_back(std::vector<int> (rand_int_list.begin() + pairs[i].first,
-																								 rand_int_list.begin() + pairs[i].second));
-
-	// pass_last_partition_m_args: holds the arguments for the last partition (Part. <p_before_merge-1>)
-	//														 at a given pass while merging partitions
-	merging_op_args_t pass_last_partition_m_args;
-
-  while (p_after_merge > 0) {
-    std::cout << "\n-----------------------------   PASS " << ++counter << "   -----------------------------" << std::endl;
-
-    threads.clear();
-    output_partitions.clear();
-
-		std::vector<merging_op_args_t> merging_args;
-
-		// Populate merting struct vector in preparation for merging
-		for (size_t i = 0; i < p_after_merge; i++) 
-			merging_args.push_back((merging_op_args_t) {
-															.in_part_a = input_partitions[2*i],
-															.in_part_b = input_partitions[2*i + 1],
-															.i = i
-														});
-
-    // Do multithreaded merging operations
-		threads.resize(p_after_merge);
-		for (size_t i = 0; i < p_after_merge; i++)
-			pthread_create(&threads[i], NULL, &cpp_merge, (void *) &merging_args[i]);	
-
-    // Is the number of partitions before the merging operations odd?
-    if (p_before_merge%2) {
-      // Append last partition of the list of partitions
-      pass_last_partitions.push_back(input_partitions[p_before_merge-1]);
-			if (pass_last_partitions.size() == 1) {
-				pass_last_partition_m_args.in_part_a = input_partitions[p_before_merge-1];
-			}
-      // Carry out multithreaded merging operation if the vector's size is 2
-      if (pass_last_partitions.size() == 2) {
-				pass_last_partition_m_args.in_part_b = input_partitions[p_before_merge-1];
-				pass_last_partition_m_args.i = p_after_merge;
-				threads.push_back(0);
-				pthread_create(&threads[threads.size() - 1], NULL, &cpp_merge, (void *) &pass_last_partition_m_args);
-      }
-    }
-
-		// Synchronize all threads
-		for (size_t i = 0; i < threads.size(); i++) 
-			pthread_join(threads[i], NULL);
-
-    // Is the number of partitions before the merging operations odd, and is pass_last_partitions' size 2?
-    if (p_before_merge%2 && pass_last_partitions.size() == 2) {
-      // Clear pass_last_partitions
-      pass_last_partitions.clear();
-      // Print out the result of the merging operation
-      dump_partition(pass_last_partition_m_args.out_part);
-      // Append the resulting partition to pass_last_partitions
-      pass_last_partitions.push_back(pass_last_partition_m_args.out_part);
-    }
-
-		std::cout << "\nPartitions after multithreaded merging - PASS: " << counter << "\n";
-		for (size_t i = 0; i < p_after_merge; i++) 
-			output_partitions.push_back(merging_args[i].out_part);
-    if (pass_last_partitions.size())
-      output_partitions.push_back(pass_last_partitions[0]);
-    print_partitions(output_partitions);
-
-    // Update variables for the next pass
-    input_partitions = output_partitions;
-    p_before_merge = p_after_merge;
-    p_after_merge /= 2;
-  }
-
-  // Is there one partition left in pass_last_partitions (occurs when p_before_merge is odd at any pass)?
-  if (pass_last_partitions.size()) {
-    std::cout << "\n-----------------------------   PASS " << ++counter << "   -----------------------------" << std::endl;
-
-    // Do the multithreaded merging operation of two remaining partitions (input_partitions[0] and output_partitions[0])
-    threads.resize(1);
-    output_partitions.clear();
-		merging_op_args_t final_merging_args = (merging_op_args_t) {
-																							.in_part_a = input_partitions[0],
-																							.in_part_b = pass_last_partitions[0],
-																							.out_part = output_partitions[0],
-																							.i = 0
-																					 };
-    pthread_create(&threads[0], NULL, &cpp_merge, (void *) &final_merging_args);
-		pthread_join(threads[0], NULL);
-		output_partitions.push_back(final_merging_args.out_part);
-
-    std::cout << "\nPartitions after multithreaded merging - PASS: " << counter << "\n";
-    print_partitions(output_partitions);
-  }
-	std::cout << "\n----------------------------------------------------------------------" << std::endl;
-}
\ No newline at end of file
+// Whether path holds n ints in ascending order
+bool file_is_sorted(const std::string &path, const size_t &n) {
+	FILE *file = fopen(path.c_str(), "rb");
+	if (!file)
+		return false;
+	std::vector<int> block(1 << 20);
+	size_t total = 0;
+	bool sorted = true;
+	int previous = 0;
+	for (size_t count; sorted && (count = fread(&block[0], sizeof(int), block.size(), file)) > 0; total += count) {
+		sorted = (!total || previous <= block[0]) && std::is_sorted(block.begin(), block.begin() + count);
+		previous = block[count - 1];
+	}
+	fclose(file);
+	return sorted && total == n;
+}
@@ -0,0 +1,510 @@
+#ifndef EXTERNAL_SORT_H
+#define EXTERNAL_SORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "loser_tree.h"
+#include "merge_path.h"
+#include "parallel_merge_sort.h"
+#include "work_stealing_pool.h"
+
+// Sorts a file of fixed-size records that need not fit in memory. Run
+// generation reads the input in chunks of a third of the memory budget, sorts
+// each with parallel_merge_sort() while the next chunk is being read, and
+// appends it to a run file while the one after is sorted. Merge passes then
+// merge up to KWAY_MAX_WAYS runs at a time into the next run file (the last
+// pass into the output) until one run is left. Each run is read through a
+// window plus one block of read-ahead; every round merges, on the pool, the
+// prefixes of the windows that are no larger than the smallest window end (so
+// nothing still on disk can belong before them), while the previous round's
+// output is being written. Equal records keep the order of the runs, so the
+// sort is stable when the in-memory sorts are. All reads and writes are large
+// and sequential within a run, and a single background thread issues them in
+// the order they were queued.
+
+// Smallest block worth reading from a run: below this the disk spends its time seeking between runs
+#define EXTERNAL_MIN_BLOCK (1 << 20)
+
+struct external_sort_options_t {
+  // memory_budget: bytes of records the sort holds in memory at once (its buffers, not counting the pool)
+  size_t memory_budget;
+  // temp_dir: where the run files go (they hold up to twice the input at a time)
+  std::string temp_dir;
+  // sort: how each chunk is sorted in memory
+  merge_sort_options_t sort;
+};
+
+struct external_sort_stats_t {
+  uint64_t records;
+  // runs: sorted runs written by run generation; passes: merge passes over them
+  size_t runs, passes;
+  // spilled_bytes: written to run files; read_bytes, written_bytes: all file I/O, input and output included
+  uint64_t spilled_bytes, read_bytes, written_bytes;
+  double run_seconds, merge_seconds;
+};
+
+// A background thread running the pread()/pwrite() requests queued to it, in order. A
+// request for a buffer queued after another one for the same buffer therefore never
+// overtakes it.
+class external_io_thread {
+ public:
+  struct request_t {
+    int fd;
+    bool write;
+    char* buffer;
+    size_t bytes;
+    off_t offset;
+    // Set once done: the bytes transferred (fewer only at the end of a file), or errno
+    size_t transferred;
+    int error;
+    bool finished;
+  };
+
+  external_io_thread() : stopping(false) {
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&queued, NULL);
+    pthread_cond_init(&finished, NULL);
+    pthread_create(&thread, NULL, &run, (void*) this);
+  }
+
+  ~external_io_thread() {
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&queued);
+    pthread_mutex_destroy(&lock);
+  }
+
+  void submit(request_t& request) {
+    pthread_mutex_lock(&lock);
+    request.finished = false;
+    requests.push_back(&request);
+    pthread_cond_signal(&queued);
+    pthread_mutex_unlock(&lock);
+  }
+
+  // Returns once request is done; false if it failed
+  bool wait(request_t& request) {
+    pthread_mutex_lock(&lock);
+    while (!request.finished)
+      pthread_cond_wait(&finished, &lock);
+    pthread_mutex_unlock(&lock);
+    return !request.error;
+  }
+
+  // Runs request on the calling thread
+  static void transfer(request_t& request) {
+    request.transferred = 0;
+    request.error = 0;
+    while (request.transferred < request.bytes) {
+      char* at = request.buffer + request.transferred;
+      size_t left = request.bytes - request.transferred;
+      off_t offset = request.offset + request.transferred;
+      ssize_t done = request.write ? pwrite(request.fd, at, left, offset) : pread(request.fd, at, left, offset);
+      if (done < 0 && errno == EINTR)
+        continue;
+      if (done < 0) {
+        request.error = errno;
+        break;
+      }
+      if (!done)
+        break;
+      request.transferred += done;
+    }
+    // A write that stops short is an error (a full disk), a read one is the end of the file
+    if (request.write && !request.error && request.transferred < request.bytes)
+      request.error = ENOSPC;
+  }
+
+ private:
+  static void* run(void* args_ptr) {
+    external_io_thread* io = (external_io_thread*) args_ptr;
+    pthread_mutex_lock(&io->lock);
+    while (true) {
+      while (!io->stopping && io->requests.empty())
+        pthread_cond_wait(&io->queued, &io->lock);
+      if (io->requests.empty())
+        break;
+      request_t* request = io->requests.front();
+      io->requests.pop_front();
+      pthread_mutex_unlock(&io->lock);
+      transfer(*request);
+      pthread_mutex_lock(&io->lock);
+      request->finished = true;
+      pthread_cond_broadcast(&io->finished);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+  }
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  // queued: signaled on new requests; finished: broadcast when one is done
+  pthread_cond_t queued, finished;
+  std::deque<request_t*> requests;
+  bool stopping;
+
+  // Not copyable: the thread points back at it
+  external_io_thread(const external_io_thread&);
+  external_io_thread& operator=(const external_io_thread&);
+};
+
+// Queues a read or write of count records of buffer at record offset `at` of fd
+template <class T>
+void external_queue(external_io_thread& io, external_io_thread::request_t& request, int fd, bool write, T* buffer,
+                    size_t count, uint64_t at) {
+  request.fd = fd;
+  request.write = write;
+  request.buffer = (char*) buffer;
+  request.bytes = count*sizeof(T);
+  request.offset = (off_t) (at*sizeof(T));
+  io.submit(request);
+}
+
+// Sets error from a failed request and returns false
+inline bool external_failed(const external_io_thread::request_t& request, const std::string& what, std::string& error) {
+  error = what + ": " + strerror(request.error);
+  return false;
+}
+
+// One run being merged: records [next, end) of a file, read into window in blocks,
+// with the following block already on its way into ahead
+template <class T>
+class external_run_reader {
+ public:
+  external_run_reader() : io(NULL), pending(false) {}
+
+  // Loads the first block and queues the second; false on a read error
+  bool open(external_io_thread& io, int fd, uint64_t begin, uint64_t end, size_t block, std::string& error) {
+    this->io = &io;
+    this->fd = fd;
+    next = begin;
+    this->end = end;
+    window.resize(block);
+    ahead.resize(block);
+    first = last = 0;
+    queue_ahead();
+    return refill(error);
+  }
+
+  // The records loaded and not merged yet
+  const T* data() const { return window.data() + first; }
+  size_t size() const { return last - first; }
+  // Whether the window holds the last records of the run
+  bool holds_end() const { return !pending; }
+  bool done() const { return first == last && !pending; }
+
+  void consume(size_t count) { first += count; }
+
+  // Once the window is empty, swaps in the read-ahead block and queues the one after
+  bool refill(std::string& error) {
+    if (first < last || !pending)
+      return true;
+    if (!io->wait(request))
+      return external_failed(request, "reading a run", error);
+    window.swap(ahead);
+    first = 0;
+    last = request.transferred/sizeof(T);
+    pending = false;
+    queue_ahead();
+    return true;
+  }
+
+  // Waits for the read-ahead still in flight, so the buffers can go
+  void close() {
+    if (pending)
+      io->wait(request);
+    pending = false;
+  }
+
+ private:
+  void queue_ahead() {
+    if (next == end)
+      return;
+    size_t count = std::min<uint64_t>(ahead.size(), end - next);
+    external_queue(*io, request, fd, false, &ahead[0], count, next);
+    next += count;
+    pending = true;
+  }
+
+  external_io_thread* io;
+  int fd;
+  // next: the first record not queued yet; end: the end of the run
+  uint64_t next, end;
+  std::vector<T> window, ahead;
+  // window[first, last): the loaded records not merged yet
+  size_t first, last;
+  // pending: a read into ahead is queued
+  bool pending;
+  external_io_thread::request_t request;
+};
+
+// Merges the runs [runs[i].first, runs[i].second) of in_fd into [out_at, ...) of
+// out_fd, `block` records per read, writing from out_buffers (two buffers of
+// runs.size()*block records each)
+template <class T, class Compare>
+bool external_merge_runs(work_stealing_pool& pool, external_io_thread& io, int in_fd,
+                         const std::vector< std::pair<uint64_t, uint64_t> >& runs, size_t block, int out_fd,
+                         uint64_t out_at, std::vector<T>* out_buffers, Compare comp, std::string& error) {
+  const size_t k = runs.size();
+  std::vector< external_run_reader<T> > readers(k);
+  bool ok = true;
+  for (size_t j = 0; j < k && ok; j++)
+    ok = readers[j].open(io, in_fd, runs[j].first, runs[j].second, block, error);
+
+  external_io_thread::request_t writes[2];
+  bool writing[2] = {false, false};
+  std::vector< std::pair<const T*, const T*> > pieces(k);
+  for (size_t current = 0; ok; current ^= 1) {
+    // Whatever is on disk comes after the end of every window not final yet, so the
+    // records up to the smallest of those ends can be merged now. The bound's run is
+    // the first with that end: the others up to it hold nothing more equal to it
+    const T* bound = NULL;
+    size_t bound_run = 0;
+    bool any = false;
+    for (size_t j = 0; j < k; j++) {
+      any |= !readers[j].done();
+      if (readers[j].size() && !readers[j].holds_end() && (!bound || comp(readers[j].data()[readers[j].size() - 1], *bound))) {
+        bound = &readers[j].data()[readers[j].size() - 1];
+        bound_run = j;
+      }
+    }
+    if (!any)
+      break;
+    // The bound may live in a window that is consumed below: keep a copy
+    T bound_value = bound ? *bound : T();
+    size_t total = 0;
+    for (size_t j = 0; j < k; j++) {
+      const T* data = readers[j].data();
+      const T* end = data + readers[j].size();
+      // Ties go to the smaller run: records of later runs equal to the bound wait for
+      // those of the bound's run still on disk
+      size_t count = !bound ? end - data
+                     : j <= bound_run ? std::upper_bound(data, end, bound_value, comp) - data
+                     : std::lower_bound(data, end, bound_value, comp) - data;
+      pieces[j] = std::make_pair(data, data + count);
+      total += count;
+    }
+
+    // The buffer merged into must be done being written from
+    if (writing[current] && !io.wait(writes[current])) {
+      ok = external_failed(writes[current], "writing a run", error);
+      break;
+    }
+    writing[current] = false;
+    if (total) {
+      T* out = &out_buffers[current][0];
+      parallel_multiway_merge(pool, &pieces[0], k, out, merge_path_parts(total, 1, pool.size()), comp);
+      external_queue(io, writes[current], out_fd, true, out, total, out_at);
+      writing[current] = true;
+      out_at += total;
+    }
+    for (size_t j = 0; j < k && ok; j++) {
+      readers[j].consume(pieces[j].second - pieces[j].first);
+      ok = readers[j].refill(error);
+    }
+  }
+
+  for (size_t j = 0; j < k; j++)
+    readers[j].close();
+  for (size_t b = 0; b < 2; b++) {
+    if (writing[b] && !io.wait(writes[b]) && ok)
+      ok = external_failed(writes[b], "writing a run", error);
+  }
+  return ok;
+}
+
+// Returns the ways per merge pass that merge `runs` runs in the fewest passes of at
+// most max_ways ways, spread evenly over the passes; passes receives their number
+inline size_t external_ways(size_t runs, size_t max_ways, size_t& passes) {
+  max_ways = std::max<size_t>(2, max_ways);
+  passes = 0;
+  for (uint64_t reach = 1; reach < runs; reach *= max_ways)
+    passes++;
+  size_t ways = 2;
+  while (true) {
+    uint64_t reach = 1;
+    for (size_t i = 0; i < passes && reach < runs; i++)
+      reach *= ways;
+    if (reach >= runs)
+      return ways;
+    ways++;
+  }
+}
+
+// Sorts the records of type T in input_path by comp into output_path (T must be
+// trivially copyable: records are read and written as raw bytes), with kernels
+// for the leaves of the in-memory sorts. Returns false with a message in error
+// if a file cannot be opened, read or written.
+template <class T, class Compare, class Kernels>
+bool external_sort(work_stealing_pool& pool, const std::string& input_path, const std::string& output_path,
+                   Compare comp, const external_sort_options_t& options, const Kernels& kernels,
+                   external_sort_stats_t& stats, std::string& error) {
+  stats = external_sort_stats_t();
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  int in_fd = open(input_path.c_str(), O_RDONLY);
+  if (in_fd < 0) {
+    error = input_path + ": " + strerror(errno);
+    return false;
+  }
+  struct stat info;
+  fstat(in_fd, &info);
+  stats.records = info.st_size/sizeof(T);
+  int out_fd = open(output_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    error = output_path + ": " + strerror(errno);
+    close(in_fd);
+    return false;
+  }
+
+  // Run generation: one chunk sorted, one being read, and the sort's scratch buffer
+  external_io_thread io;
+  const uint64_t n = stats.records;
+  const size_t chunk = std::max<size_t>(1, options.memory_budget/(3*sizeof(T)));
+  // runs: [first, last) records of each run in the current run file
+  std::vector< std::pair<uint64_t, uint64_t> > runs;
+  for (uint64_t at = 0; at < n; at += chunk)
+    runs.push_back(std::make_pair(at, std::min<uint64_t>(at + chunk, n)));
+  stats.runs = runs.size();
+  // A single run is sorted straight into the output
+  std::string run_paths[2];
+  int run_fds[2] = {-1, -1};
+  for (int i = 0; i < 2; i++)
+    run_paths[i] = options.temp_dir + "/external_sort." + std::to_string(getpid()) + "." + std::to_string(i) + ".runs";
+  bool ok = true;
+  if (runs.size() > 1) {
+    run_fds[0] = open(run_paths[0].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (run_fds[0] < 0) {
+      error = run_paths[0] + ": " + strerror(errno);
+      ok = false;
+    }
+  }
+  int run_fd = runs.size() > 1 ? run_fds[0] : out_fd;
+
+  std::vector<T> buffers[2];
+  external_io_thread::request_t reads[2], writes[2];
+  // reading, writing: the slot's request is queued and not waited for yet
+  bool reading[2] = {false, false}, writing[2] = {false, false};
+  const std::string& run_path = runs.size() > 1 ? run_paths[0] : output_path;
+  for (size_t i = 0; i < 2 && i < runs.size() && ok; i++) {
+    buffers[i].resize(runs[i].second - runs[i].first);
+    external_queue(io, reads[i], in_fd, false, &buffers[i][0], buffers[i].size(), runs[i].first);
+    reading[i] = true;
+  }
+  for (size_t i = 0; i < runs.size() && ok; i++) {
+    const size_t slot = i % 2;
+    std::vector<T>& buffer = buffers[slot];
+    reading[slot] = false;
+    if (!io.wait(reads[slot])) {
+      ok = external_failed(reads[slot], input_path, error);
+      break;
+    }
+    // The run written from this buffer two chunks ago went out before the read above
+    writing[slot] = false;
+    if (i >= 2 && !io.wait(writes[slot])) {
+      ok = external_failed(writes[slot], run_path, error);
+      break;
+    }
+    merge_sort_no_observer observer;
+    parallel_merge_sort(pool, buffer.begin(), buffer.begin() + (runs[i].second - runs[i].first), comp, options.sort,
+                        kernels, observer);
+    external_queue(io, writes[slot], run_fd, true, &buffer[0], runs[i].second - runs[i].first, runs[i].first);
+    writing[slot] = true;
+    // The I/O thread writes this buffer out before it reads the chunk after next into it
+    if (i + 2 < runs.size()) {
+      external_queue(io, reads[slot], in_fd, false, &buffer[0], runs[i + 2].second - runs[i + 2].first, runs[i + 2].first);
+      reading[slot] = true;
+    }
+  }
+  for (size_t slot = 0; slot < 2; slot++) {
+    if (writing[slot] && !io.wait(writes[slot]) && ok)
+      ok = external_failed(writes[slot], run_path, error);
+    if (reading[slot])
+      io.wait(reads[slot]);
+  }
+  std::vector<T>().swap(buffers[0]);
+  std::vector<T>().swap(buffers[1]);
+  stats.read_bytes = n*sizeof(T);
+  stats.written_bytes = n*sizeof(T);
+  if (runs.size() > 1)
+    stats.spilled_bytes = n*sizeof(T);
+  stats.run_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  // Merge passes: k runs take k windows and k read-ahead blocks, plus two output buffers of k blocks
+  start = std::chrono::steady_clock::now();
+  size_t ways = external_ways(runs.size(), std::min<size_t>(KWAY_MAX_WAYS, options.memory_budget/(4*EXTERNAL_MIN_BLOCK)),
+                              stats.passes);
+  const size_t block = std::max<size_t>(1, options.memory_budget/(4*ways*sizeof(T)));
+  std::vector<T> out_buffers[2];
+  for (size_t pass = 0; ok && runs.size() > 1; pass++) {
+    bool last_pass = runs.size() <= ways;
+    int in_fd_pass = run_fds[pass % 2];
+    int out_fd_pass = out_fd;
+    if (!last_pass) {
+      run_fds[(pass + 1) % 2] = open(run_paths[(pass + 1) % 2].c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+      out_fd_pass = run_fds[(pass + 1) % 2];
+      if (out_fd_pass < 0) {
+        error = run_paths[(pass + 1) % 2] + ": " + strerror(errno);
+        ok = false;
+        break;
+      }
+    }
+    out_buffers[0].resize(ways*block);
+    out_buffers[1].resize(ways*block);
+    std::vector< std::pair<uint64_t, uint64_t> > merged;
+    for (size_t i = 0; i < runs.size() && ok; i += ways) {
+      std::vector< std::pair<uint64_t, uint64_t> > group(runs.begin() + i, runs.begin() + std::min(i + ways, runs.size()));
+      ok = external_merge_runs(pool, io, in_fd_pass, group, block, out_fd_pass, group.front().first, out_buffers,
+                               comp, error);
+      merged.push_back(std::make_pair(group.front().first, group.back().second));
+    }
+    stats.read_bytes += n*sizeof(T);
+    stats.written_bytes += n*sizeof(T);
+    if (!last_pass)
+      stats.spilled_bytes += n*sizeof(T);
+    // The input runs of this pass are not needed any more
+    close(in_fd_pass);
+    unlink(run_paths[pass % 2].c_str());
+    run_fds[pass % 2] = -1;
+    runs.swap(merged);
+  }
+  stats.merge_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  for (int i = 0; i < 2; i++) {
+    if (run_fds[i] >= 0) {
+      close(run_fds[i]);
+      unlink(run_paths[i].c_str());
+    }
+  }
+  close(in_fd);
+  if (close(out_fd) && ok) {
+    error = output_path + ": " + strerror(errno);
+    ok = false;
+  }
+  return ok;
+}
+
+template <class T, class Compare>
+bool external_sort(work_stealing_pool& pool, const std::string& input_path, const std::string& output_path,
+                   Compare comp, const external_sort_options_t& options, external_sort_stats_t& stats,
+                   std::string& error) {
+  merge_sort_std_kernels kernels = {options.sort.stable};
+  return external_sort<T>(pool, input_path, output_path, comp, options, kernels, stats, error);
+}
+
+#endif
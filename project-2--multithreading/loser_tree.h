@@ -0,0 +1,276 @@
+#ifndef LOSER_TREE_H
+#define LOSER_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "merge_path.h"
+#include "work_stealing_pool.h"
+
+// A k-way merge reads and writes every element once, where pairwise passes do
+// so log2(k) times. The next output comes from a tournament tree whose inner
+// nodes remember the loser of each match: after the winner is written, only
+// the matches on its leaf-to-root path are replayed, log2(k) comparisons that
+// touch one run head each. Ties go to the run with the smaller index, so the
+// merge is stable like std::merge.
+
+// Most runs merged by one pass: the run heads (a cache line each) and the
+// tree then stay in L1, so passes with more ways cost more than they save
+#define KWAY_MAX_WAYS 256
+
+// Samples taken from each run per piece when one merge is split across threads
+#define KWAY_SAMPLES_PER_PART 4
+
+// Returns c ? a : b without a branch the CPU could mispredict: with masks for
+// integers (a compiler turns plain ?: back into a jump), by indexing otherwise
+template <class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value, T>::type
+loser_tree_select(bool c, T a, T b) {
+  typedef typename std::make_unsigned<T>::type unsigned_t;
+  unsigned_t mask = -(unsigned_t) c;
+  return (T) (((unsigned_t) a & mask) | ((unsigned_t) b & ~mask));
+}
+
+template <class T>
+typename std::enable_if<!std::is_integral<T>::value || std::is_same<T, bool>::value, T>::type
+loser_tree_select(bool c, const T& a, const T& b) {
+  const T* choices[2] = {&b, &a};
+  return *choices[c];
+}
+
+template <class RandomIt, class Compare>
+class loser_tree {
+ public:
+  typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+
+  // runs: the k sorted input ranges, consumed from the front
+  loser_tree(std::pair<RandomIt, RandomIt>* runs, size_t k, Compare comp) : runs(runs), comp(comp) {
+    leaves = 1;
+    while (leaves < k)
+      leaves *= 2;
+    tree.resize(leaves);
+    // winners: the winner of every subtree while the tree is built
+    std::vector<node_t> winners(2*leaves);
+    for (size_t i = 0; i < leaves; i++) {
+      node_t& leaf = winners[leaves + i];
+      leaf.run = i;
+      leaf.done = i >= k || runs[i].first == runs[i].second;
+      // An empty run still needs a valid key to compare
+      leaf.key = leaf.done ? *runs[winner_seed(k)].first : *runs[i].first;
+    }
+    for (size_t node = leaves - 1; node >= 1; node--) {
+      const node_t& left = winners[2*node];
+      const node_t& right = winners[2*node + 1];
+      bool left_wins = beats(left, right);
+      winners[node] = left_wins ? left : right;
+      tree[node] = left_wins ? right : left;
+    }
+    winner = winners[1];
+  }
+
+  // Writes the next count elements in merged order to out
+  template <class OutputIt>
+  OutputIt pop(size_t count, OutputIt out) {
+    // The winner lives in locals: writes through out could alias the members
+    node_t* nodes = &tree[0];
+    node_t w = winner;
+    for (; count; count--) {
+      *out++ = w.key;
+      // The winner's run moves on to its next element, or drops out
+      std::pair<RandomIt, RandomIt>& run = runs[w.run];
+      if (++run.first != run.second)
+        w.key = *run.first;
+      else
+        w.done = 1;
+      // Replay the matches on the path of the winner's leaf; on random data each match
+      // is a coin toss, so the outcome selects the fields instead of branching
+      for (size_t node = (leaves + w.run)/2; node >= 1; node /= 2) {
+        node_t match = nodes[node];
+        bool swap = beats(match, w);
+        nodes[node].key = loser_tree_select(swap, w.key, match.key);
+        nodes[node].run = loser_tree_select(swap, w.run, match.run);
+        nodes[node].done = loser_tree_select(swap, w.done, match.done);
+        w.key = loser_tree_select(swap, match.key, w.key);
+        w.run = loser_tree_select(swap, match.run, w.run);
+        w.done = loser_tree_select(swap, match.done, w.done);
+      }
+    }
+    winner = w;
+    return out;
+  }
+
+ private:
+  // A run's head as seen by the tree: a copy of the key saves a dereference per match
+  struct node_t {
+    value_type key;
+    uint32_t run;
+    // done: the run is exhausted and key is its last element
+    uint32_t done;
+  };
+
+  // Whether a comes before b: finished runs lose, ties go to the smaller run (evaluated
+  // without short-circuits so that it compiles to flag arithmetic)
+  bool beats(const node_t& a, const node_t& b) const {
+    bool before = comp(a.key, b.key) | (!comp(b.key, a.key) & (a.run < b.run));
+    return (!a.done) & (b.done | before);
+  }
+
+  // Returns a run that has elements (merges of only empty runs write nothing)
+  size_t winner_seed(size_t k) const {
+    size_t j = 0;
+    while (j + 1 < k && runs[j].first == runs[j].second)
+      j++;
+    return j;
+  }
+
+  std::pair<RandomIt, RandomIt>* runs;
+  Compare comp;
+  // leaves: k rounded up to a power of two; the missing runs never win
+  size_t leaves;
+  // tree[node]: the loser of the match at node (tree[0] is unused)
+  std::vector<node_t> tree;
+  node_t winner;
+};
+
+// Merges the k sorted ranges runs[0 .. k) into out, stably
+template <class RandomIt, class OutputIt, class Compare>
+OutputIt multiway_merge(std::pair<RandomIt, RandomIt>* runs, size_t k, OutputIt out, Compare comp) {
+  if (k == 1)
+    return std::copy(runs[0].first, runs[0].second, out);
+  if (k == 2)
+    return std::merge(runs[0].first, runs[0].second, runs[1].first, runs[1].second, out, comp);
+  size_t count = 0;
+  for (size_t j = 0; j < k; j++)
+    count += runs[j].second - runs[j].first;
+  if (!count)
+    return out;
+  loser_tree<RandomIt, Compare> tree(runs, k, comp);
+  return tree.pop(count, out);
+}
+
+// Cuts the merge of runs[0 .. k) into `parts` pieces of about the same size.
+// cuts[t*k + j] receives where piece t starts in run j (t = 0 .. parts, so
+// the last row holds the run lengths). Every cut is consistent: whatever is
+// left of it in any run comes before whatever is right of it in the merged
+// order, so the pieces can be merged independently and simply concatenated.
+template <class RandomIt, class Compare>
+void multiway_split(const std::pair<RandomIt, RandomIt>* runs, size_t k, size_t parts, Compare comp,
+                    std::vector<size_t>& cuts) {
+  cuts.assign((parts + 1)*k, 0);
+  size_t total = 0;
+  for (size_t j = 0; j < k; j++) {
+    cuts[parts*k + j] = runs[j].second - runs[j].first;
+    total += cuts[parts*k + j];
+  }
+  if (parts <= 1)
+    return;
+
+  // Evenly spaced samples of every run, each standing for len/samples elements
+  struct sample_t {
+    size_t run, pos;
+    double weight;
+  };
+  std::vector<sample_t> samples;
+  for (size_t j = 0; j < k; j++) {
+    size_t len = runs[j].second - runs[j].first;
+    size_t count = std::min(len, parts*KWAY_SAMPLES_PER_PART);
+    for (size_t s = 0; s < count; s++) {
+      sample_t sample = {j, (2*s + 1)*len/(2*count), (double) len/count};
+      samples.push_back(sample);
+    }
+  }
+  // The merged order: by value, then by run, then by position
+  std::sort(samples.begin(), samples.end(), [&](const sample_t& a, const sample_t& b) {
+    if (comp(runs[a.run].first[a.pos], runs[b.run].first[b.pos]))
+      return true;
+    if (comp(runs[b.run].first[b.pos], runs[a.run].first[a.pos]))
+      return false;
+    return a.run < b.run || (a.run == b.run && a.pos < b.pos);
+  });
+
+  // Each cut goes just before the sample whose estimated rank reaches the target
+  double rank = 0;
+  size_t next = 0;
+  for (size_t t = 1; t < parts; t++) {
+    double target = (double) total*t/parts;
+    while (next < samples.size() && rank + samples[next].weight/2 < target)
+      rank += samples[next++].weight;
+    if (next == samples.size()) {
+      std::copy(cuts.begin() + parts*k, cuts.end(), cuts.begin() + t*k);
+      continue;
+    }
+    const sample_t& pivot = samples[next];
+    const typename std::iterator_traits<RandomIt>::value_type& value = runs[pivot.run].first[pivot.pos];
+    for (size_t j = 0; j < k; j++) {
+      // Equal elements of earlier runs come before the pivot, those of later runs after it
+      if (j < pivot.run)
+        cuts[t*k + j] = std::upper_bound(runs[j].first, runs[j].second, value, comp) - runs[j].first;
+      else if (j > pivot.run)
+        cuts[t*k + j] = std::lower_bound(runs[j].first, runs[j].second, value, comp) - runs[j].first;
+      else
+        cuts[t*k + j] = pivot.pos;
+    }
+  }
+}
+
+// Merges runs[0 .. k) into out as `parts` tasks on pool, returning when all
+// of them are done; the result is the one multiway_merge() produces
+template <class RandomIt, class OutputIt, class Compare>
+void parallel_multiway_merge(work_stealing_pool& pool, const std::pair<RandomIt, RandomIt>* runs, size_t k,
+                             OutputIt out, size_t parts, Compare comp) {
+  std::vector< std::pair<RandomIt, RandomIt> > pieces(runs, runs + k);
+  if (parts <= 1 || k == 1) {
+    multiway_merge(&pieces[0], k, out, comp);
+    return;
+  }
+
+  std::vector<size_t> cuts;
+  multiway_split(runs, k, parts, comp, cuts);
+  // pieces[t*k + j]: the share of run j in piece t, filled in by task t
+  pieces.resize(parts*k);
+  struct {
+    const std::pair<RandomIt, RandomIt>* runs;
+    size_t k;
+    const size_t* cuts;
+    std::pair<RandomIt, RandomIt>* pieces;
+    OutputIt out;
+    Compare comp;
+  } merge = {runs, k, &cuts[0], &pieces[0], out, comp};
+  task_group merging;
+  for (size_t t = 0; t < parts; t++) {
+    pool.submit(merging, [&merge, t] {
+      const size_t* lo = merge.cuts + t*merge.k;
+      const size_t* hi = lo + merge.k;
+      std::pair<RandomIt, RandomIt>* piece = merge.pieces + t*merge.k;
+      size_t offset = 0;
+      for (size_t j = 0; j < merge.k; j++) {
+        piece[j] = std::make_pair(merge.runs[j].first + lo[j], merge.runs[j].first + hi[j]);
+        offset += lo[j];
+      }
+      multiway_merge(piece, merge.k, merge.out + offset, merge.comp);
+    });
+  }
+  pool.wait(merging);
+}
+
+// Returns the ways per pass that merge `runs` runs in the fewest passes of at
+// most KWAY_MAX_WAYS ways, spread evenly over the passes (4096 runs: 2 passes
+// of 64 ways rather than 256 then 16); passes receives the number of passes
+inline size_t kway_ways(size_t runs, size_t& passes) {
+  passes = 0;
+  for (size_t reach = 1; reach < runs; reach *= KWAY_MAX_WAYS)
+    passes++;
+  size_t ways = 2;
+  for (bool enough = false; !enough; ways++) {
+    size_t reach = 1;
+    for (size_t i = 0; i < passes && reach < runs; i++)
+      reach *= ways;
+    enough = reach >= runs;
+  }
+  return std::max<size_t>(ways - 1, 2);
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef MERGE_PATH_H
+#define MERGE_PATH_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include "work_stealing_pool.h"
+
+// Merging two sorted inputs a and b walks a path through the grid of
+// (elements taken from a, elements taken from b). Every cross diagonal
+// i + j = d meets the path exactly once, and the crossing point (the co-rank
+// of d) is found by a binary search along the diagonal. Cutting the output
+// at K evenly spaced diagonals therefore splits one merge into K independent
+// merges of equal size, whatever the distribution of the values.
+
+// Smallest piece worth a task of its own
+#define MERGE_MIN_GRAIN 4096
+
+// Returns i, the number of elements of a among the first d outputs of
+// std::merge(a, a+na, b, b+nb, ...): ties go to a, as in std::merge
+template <class RandomIt1, class RandomIt2, class Compare>
+size_t merge_path_co_rank(RandomIt1 a, size_t na, RandomIt2 b, size_t nb, size_t d, Compare comp) {
+  size_t lo = d > nb ? d - nb : 0;
+  size_t hi = std::min(d, na);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo)/2;
+    // a[mid] is among the first d outputs unless b[d-1-mid] sorts strictly before it
+    if (!comp(b[d - 1 - mid], a[mid]))
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Number of pieces to cut each of `merges` concurrent merges of `length`
+// elements into, so that a pass keeps all `threads` workers busy
+inline size_t merge_path_parts(size_t length, size_t merges, size_t threads) {
+  size_t parts = (threads + merges - 1)/std::max<size_t>(merges, 1);
+  return std::max<size_t>(1, std::min(parts, length/MERGE_MIN_GRAIN));
+}
+
+// The kernel parallel_merge() runs on each piece unless told otherwise
+template <class Compare>
+struct merge_path_std_merge {
+  Compare comp;
+
+  template <class RandomIt1, class RandomIt2, class RandomIt3>
+  void operator()(RandomIt1 a, RandomIt1 a_end, RandomIt2 b, RandomIt2 b_end, RandomIt3 out) const {
+    std::merge(a, a_end, b, b_end, out, comp);
+  }
+};
+
+// Merges a[0, na) and b[0, nb) into out[0, na+nb) as `parts` tasks of equal
+// size on pool, returning when all of them are done. Each piece is merged by
+// kernel(a_begin, a_end, b_begin, b_end, out), which must produce what
+// std::merge with comp would
+template <class RandomIt1, class RandomIt2, class RandomIt3, class Compare, class Kernel>
+void parallel_merge(work_stealing_pool& pool, RandomIt1 a, size_t na, RandomIt2 b, size_t nb, RandomIt3 out,
+                    size_t parts, Compare comp, Kernel kernel) {
+  const size_t n = na + nb;
+  if (parts <= 1 || n < 2) {
+    kernel(a, a + na, b, b + nb, out);
+    return;
+  }
+
+  struct {
+    RandomIt1 a;
+    RandomIt2 b;
+    RandomIt3 out;
+    size_t na, nb, n, parts;
+    Compare comp;
+    Kernel kernel;
+  } merge = {a, b, out, na, nb, n, parts, comp, kernel};
+  task_group merging;
+  for (size_t k = 0; k < parts; k++) {
+    // The co-ranks are computed by the tasks, so the binary searches run in parallel too
+    pool.submit(merging, [&merge, k] {
+      size_t d_begin = merge.n*k/merge.parts, d_end = merge.n*(k + 1)/merge.parts;
+      size_t i_begin = merge_path_co_rank(merge.a, merge.na, merge.b, merge.nb, d_begin, merge.comp);
+      size_t i_end = merge_path_co_rank(merge.a, merge.na, merge.b, merge.nb, d_end, merge.comp);
+      merge.kernel(merge.a + i_begin, merge.a + i_end, merge.b + (d_begin - i_begin), merge.b + (d_end - i_end),
+                   merge.out + d_begin);
+    });
+  }
+  pool.wait(merging);
+}
+
+// Same, merging every piece with std::merge: the result is the one std::merge produces
+template <class RandomIt1, class RandomIt2, class RandomIt3, class Compare>
+void parallel_merge(work_stealing_pool& pool, RandomIt1 a, size_t na, RandomIt2 b, size_t nb, RandomIt3 out,
+                    size_t parts, Compare comp) {
+  merge_path_std_merge<Compare> kernel = {comp};
+  parallel_merge(pool, a, na, b, nb, out, parts, comp, kernel);
+}
+
+template <class RandomIt1, class RandomIt2, class RandomIt3>
+void parallel_merge(work_stealing_pool& pool, RandomIt1 a, size_t na, RandomIt2 b, size_t nb, RandomIt3 out,
+                    size_t parts) {
+  parallel_merge(pool, a, na, b, nb, out, parts, std::less<typename std::iterator_traits<RandomIt1>::value_type>());
+}
+
+#endif
@@ -4,40 +4,91 @@
 #include <cstdlib>
 #include <vector>
 #include <algorithm>
-#include <thread>
+#include <utility>
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include "external_sort.h"
+#include "parallel_merge_sort.h"
+#include "radix_sort.h"
+#include "simd_sort.h"
+#include "work_stealing_pool.h"
 
 #define LOWER_BOUND 0
 #define USAGE_ERROR 1
+#define IO_ERROR 2
+
+// Options given before the positional arguments
+struct options_t {
+  // threads: number of worker threads (0 = one per online CPU)
+  size_t threads;
+  // sort: "merge" sorts the partitions and merges them, "radix" sorts the whole list by the
+  //       digits of its keys (a counting sort when <MAX_VALUE> is small), "external" sorts a
+  //       file of the list that need not fit in memory
+  std::string sort;
+  // merge: "kway" merges up to KWAY_MAX_WAYS partitions at once with a loser tree,
+  //        "pairwise" merges them two at a time
+  std::string merge;
+  // simd: vector instructions of the partition sort and two-way merge kernels (SIMD_SCALAR: std::sort
+  //       and std::merge), already lowered to what the CPU supports
+  simd_level_t simd;
+  // memory_mb: memory budget of the external sort, in MiB
+  size_t memory_mb;
+  // temp_dir: directory of the external sort's list files and run files
+  std::string temp_dir;
+  // quiet: print one line of timings instead of the lists
+  bool quiet;
+};
+
+options_t options = {0, "merge", "kway", SIMD_SCALAR, 256, "/var/tmp", false};
+
+// Shows each stage of parallel_merge_sort() through the lists it leaves behind (nothing with -q)
+struct display_observer_t {
+  void partitions_sorted(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions);
+  void pass_merged(size_t pass, std::vector<int>::iterator src, std::vector<int>::iterator dst,
+                   const merge_sort_partitions_t& in_partitions, size_t ways, const merge_sort_partitions_t& out_partitions);
+};
+
 
 void print_usage();
+void parse_options(int& argc, char**& argv);
 void validate_argv(int& argc, char* argv[]);
 std::string dump_partition(std::vector<int>& partition);
 void generate_list(std::vector<int>& rand_int_list, const size_t& n, const size_t& upper_bound);
 void print_list(std::vector<int>& list);
-void create_partitions(const std::vector<int>& rand_int_list, std::vector< std::vector<int> >& rand_int_partitions,
-                       const size_t& n, const size_t& p);
-void print_partitions(std::vector< std::vector<int> >& partitions);
-void cpp_sort(std::vector<int>& partition);
-void display_merge_msg(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part);
-void cpp_merge(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part);
-void merge_partitions_multithreaded(std::vector< std::vector<int> >& rand_int_partitions, std::vector<std::thread>& threads,
-                                    const size_t& p);
+std::string dump_partition(std::vector<int>::iterator list, const std::pair<size_t, size_t>& partition);
+void print_partitions(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions);
+void display_merge_msg(std::vector<int>::iterator src, std::vector<int>::iterator dst, const std::pair<size_t, size_t>* in_parts,
+                       size_t ways, const std::pair<size_t, size_t>& out_part);
+double seconds_since(const std::chrono::steady_clock::time_point& start);
+void print_timings(std::vector<int>& list, work_stealing_pool& pool, const size_t& p, size_t passes,
+                   double sort_seconds, double merge_seconds);
+int external_main(const size_t& n, const size_t& upper_bound, const size_t& p);
+bool generate_file(const std::string& path, const size_t& n, const size_t& upper_bound);
+bool file_is_sorted(const std::string& path, const size_t& n);
 
 int main(int argc, char* argv[]) {
+  parse_options(argc, argv);
+
   // Validate arguments that are passed in upon running executable
   validate_argv(argc, argv);
 
   // n: Number of elements to be generated
-  const size_t n = std::stoi(argv[1]);
+  const size_t n = std::stoull(argv[1]);
   // upper_bound: Max. possible value of an integer element
   const size_t upper_bound = std::stoi(argv[2]);
   // p: Number of partitions to be created
   const size_t p = std::stoi(argv[3]);
+
+  // The list may not fit in memory: it never goes into a vector
+  if (options.sort == "external")
+    return external_main(n, upper_bound, p);
   
   // Generate list of random integers
   std::vector<int> rand_int_list;
   generate_list(rand_int_list, n, upper_bound);
-  print_list(rand_int_list);
+  if (!options.quiet)
+    print_list(rand_int_list);
 
   // No need for partitioning, sorting, and merging if list has only 1 element
   if (rand_int_list.size() == 1) {
@@ -45,43 +96,153 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
-  // Break down list into partitions
-  std::vector< std::vector<int> > rand_int_partitions(p);
-  create_partitions(rand_int_list, rand_int_partitions, n, p);
-  std::cout << "\nList breakdown into partitions:\n";
-  print_partitions(rand_int_partitions);
+  // The keys lie in [LOWER_BOUND, LOWER_BOUND + upper_bound]: sort them by their digits, no partitions needed
+  if (options.sort == "radix") {
+    work_stealing_pool pool(options.threads);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<int> scratch_list(n);
+    const int max_value = LOWER_BOUND + (int) std::min<size_t>(upper_bound, RAND_MAX - LOWER_BOUND);
+    size_t passes = parallel_radix_sort(pool, &rand_int_list[0], &scratch_list[0], n, LOWER_BOUND, max_value);
+    double sort_seconds = seconds_since(start);
+    if (options.quiet) {
+      print_timings(rand_int_list, pool, p, passes, sort_seconds, 0);
+    } else {
+      std::cout << "\nList after multithreaded radix sort (" << passes << " passes):\n\n  "
+                << dump_partition(rand_int_list) << std::endl;
+    }
+    return 0;
+  }
 
-  // Sort partitions
-  std::vector<std::thread> threads;
-  for (int i = 0; i < p; i++) {
-    threads.push_back(std::thread(cpp_sort, std::ref(rand_int_partitions[i])));
+  // Break down list into partitions (index ranges within the original list), as parallel_merge_sort() does
+  if (!options.quiet) {
+    merge_sort_partitions_t partitions;
+    merge_sort_partition(n, p, partitions);
+    std::cout << "\nList breakdown into partitions:\n";
+    print_partitions(rand_int_list.begin(), partitions);
   }
-  // Synchronize all threads
-  for (auto& th : threads) 
-    th.join(); 
-  std::cout << "\nPartitions after multithreaded sorting:\n";
-  print_partitions(rand_int_partitions);
 
-  // Merge partitions in a multithreaded and sorted way, building back single list
-  std::cout << "\nMultithreaded merging of partitions:\n";
-  merge_partitions_multithreaded(rand_int_partitions, threads, p);
+  // Sort the partitions, one task each, on a pool sized independently of p, then merge them
+  // back into a single list
+  work_stealing_pool pool(options.threads);
+  merge_sort_options_t sort_options = {p, options.merge == "pairwise", false};
+  display_observer_t observer;
+  merge_sort_stats_t stats;
+  if (options.simd == SIMD_SCALAR) {
+    merge_sort_std_kernels kernels = {false};
+    stats = parallel_merge_sort(pool, rand_int_list.begin(), rand_int_list.end(), std::less<int>(), sort_options,
+                                kernels, observer);
+  } else {
+    simd_sort_kernels kernels = {options.simd};
+    stats = parallel_merge_sort(pool, rand_int_list.begin(), rand_int_list.end(), std::less<int>(), sort_options,
+                                kernels, observer);
+  }
+
+  if (options.quiet)
+    print_timings(rand_int_list, pool, p, stats.passes, stats.sort_seconds, stats.merge_seconds);
 
   return 0;
 }
 
 void print_usage() {
   std::cout << "Usage:" << std::endl << std::endl
-	    << "    multi_threaded_merge_sort <N> <MAX_VALUE> <P>" << std::endl << std::endl
+	    << "    multi_threaded_merge_sort [-t <THREADS>] [-a <SORT>] [-m <MERGE>] [-s <SIMD>] [-M <MEMORY>] [-T <DIR>] [-q] <N> <MAX_VALUE> <P>" << std::endl << std::endl
 	    << "where" << std::endl << std::endl
 	    << "    <N> is an positive integer representing the size of your list of elements" << std::endl
 	    << "    <MAX_VALUE> is an positive integer representing the possible max. value of the list elements " << std::endl
       << "    <P> is an positive integer representing the intended number of partitions to break down the list into" << std::endl
+      << "    <THREADS> is the number of worker threads sorting and merging the partitions (default: one per CPU)" << std::endl
+      << "    <SORT> is merge (sort <P> partitions, then merge them, default)" << std::endl
+      << "           or radix (sort the whole list by the digits of its keys, <P> is not used)" << std::endl
+      << "           or external (write the list to a file in <DIR> and sort it into another one in runs" << std::endl
+      << "           of <MEMORY>/3, <P> partitions each, merged up to " << KWAY_MAX_WAYS << " runs per pass)" << std::endl
+      << "    <MERGE> is kway (merge up to " << KWAY_MAX_WAYS << " partitions per pass with a loser tree, default)" << std::endl
+      << "            or pairwise (merge two partitions at a time, log2(P) passes)" << std::endl
+      << "    <SIMD> is scalar (std::sort and std::merge, default), avx2, avx512 or auto (the best the CPU has):" << std::endl
+      << "           the instruction set of the partition sort and of merges of two partitions" << std::endl
+      << "    <MEMORY> is the memory budget of the external sort in MiB (default: " << options.memory_mb << ")" << std::endl
+      << "    <DIR> is where the external sort keeps its files (default: " << options.temp_dir << ")" << std::endl
+      << "    -q prints one line of timings instead of the lists" << std::endl
 	    << std::endl
 	    << "Example:" << std::endl
 	    << "    $ ./multi_threaded_merge_sort 25 100 5" << std::endl
 	    << std::endl;
 }
 
+void parse_options(int& argc, char**& argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "t:a:m:s:M:T:q")) != -1) {
+    switch (opt) {
+    case 't': {
+      const std::string threads_str(optarg);
+      for (int i = 0; i < threads_str.size(); i++) {
+        if (!isdigit(threads_str[i])) {
+          std::cout << "Invalid number of threads." << std::endl;
+          print_usage();
+          exit(USAGE_ERROR);
+        }
+      }
+      options.threads = std::stoi(threads_str);
+      break;
+    }
+    case 'a':
+      options.sort = optarg;
+      if (options.sort != "merge" && options.sort != "radix" && options.sort != "external") {
+        std::cout << "Invalid sorting algorithm." << std::endl;
+        print_usage();
+        exit(USAGE_ERROR);
+      }
+      break;
+    case 'm':
+      options.merge = optarg;
+      if (options.merge != "kway" && options.merge != "pairwise") {
+        std::cout << "Invalid merging scheme." << std::endl;
+        print_usage();
+        exit(USAGE_ERROR);
+      }
+      break;
+    case 's':
+      if (!simd_parse_level(optarg, options.simd)) {
+        std::cout << "Invalid instruction set." << std::endl;
+        print_usage();
+        exit(USAGE_ERROR);
+      }
+      options.simd = simd_level(options.simd);
+      break;
+    case 'M': {
+      const std::string memory_str(optarg);
+      for (int i = 0; i < memory_str.size(); i++) {
+        if (!isdigit(memory_str[i])) {
+          std::cout << "Invalid memory budget." << std::endl;
+          print_usage();
+          exit(USAGE_ERROR);
+        }
+      }
+      options.memory_mb = std::stoull(memory_str);
+      if (!options.memory_mb) {
+        std::cout << "Invalid memory budget." << std::endl;
+        print_usage();
+        exit(USAGE_ERROR);
+      }
+      break;
+    }
+    case 'T':
+      options.temp_dir = optarg;
+      break;
+    case 'q':
+      options.quiet = true;
+      break;
+    default:
+      print_usage();
+      exit(USAGE_ERROR);
+    }
+  }
+
+  // Drop the options so that the positional arguments are argv[1], argv[2], ...
+  argv[optind-1] = argv[0];
+  argv += optind-1;
+  argc -= optind-1;
+}
+
 void validate_argv(int& argc, char* argv[]) {
   if(argc != 4) {
     std::cout << "Invalid number of arguments." << std::endl;
@@ -121,7 +282,7 @@ void validate_argv(int& argc, char* argv[]) {
   }  
 
   // Stop execution if #partitions > #elements
-  if (std::stoi(argv[3]) > std::stoi(argv[1])) {
+  if (std::stoull(argv[3]) > std::stoull(argv[1])) {
     std::cout << "The number of elements in the list (1st arg.) has to be bigger the the number of intended partitions (3rd arg.)." 
               << std::endl;
     exit(USAGE_ERROR);
@@ -141,6 +302,19 @@ std::string dump_partition(std::vector<int>& partition) {
   return str;
 }
 
+std::string dump_partition(std::vector<int>::iterator list, const std::pair<size_t, size_t>& partition) {
+  // Build partition string
+  std::string str("");
+  str += '[';
+  for (size_t i = partition.first; i < partition.second; i++) {
+    str += std::to_string(list[i]);
+    if (i != partition.second-1)
+      str += ' ';
+  }
+  str += ']';
+  return str;
+}
+
 void generate_list(std::vector<int>& rand_int_list, const size_t& n, const size_t& upper_bound) {
   // Initialize random seed
   srand (time(NULL));
@@ -156,130 +330,147 @@ void print_list(std::vector<int>& list) {
             << dump_partition(list) << std::endl << std::flush;
 }
 
-void create_partitions(const std::vector<int>& rand_int_list, std::vector< std::vector<int> >& rand_int_partitions,
-                       const size_t& n, const size_t& p) {
-  // quotient: Partition size
-  size_t quotient = n/p; 
-  // remainder: Extra elements to be distributed into a required # of partitions
-  size_t remainder = n%p;
-  // offset: Number of extra elements added individually to different partitions
-  size_t offset = 0;
-
-  for (int i = 0, j = 0; i < n; i++) {
-    // Whenever a partition reaches its indended, even size and it's not the first iteration
-    if ((i-offset)%(quotient) == 0 && i != 0) {
-      // If there is any remainder, add the next element in the list to the current partition 
-      if (remainder) {
-        rand_int_partitions[j].push_back(rand_int_list[i]);
-        remainder--;
-        i++;
-        offset++;
-      }
-      j++;
-    }
-    rand_int_partitions[j].push_back(rand_int_list[i]);
-  }
-}
-
-void print_partitions(std::vector< std::vector<int> >& partitions) {
+void print_partitions(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions) {
   std::cout << std::endl;
   for (int i = 0; i < partitions.size(); i++) {
-    std::cout << "  Part. " << i << ": " << dump_partition(partitions[i]) << " (size=" << partitions[i].size() << ")"
+    std::cout << "  Part. " << i << ": " << dump_partition(list, partitions[i])
+              << " (size=" << partitions[i].second - partitions[i].first << ")"
               << std::endl << std::flush;
   }
 }
 
-void cpp_sort(std::vector<int>& partition) {
-  std::sort(partition.begin(), partition.end());
-}
-
-void display_merge_msg(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part) {
-  std::string str("\n * Merged \n\t" + dump_partition(in_part_a) + " (size=" + std::to_string(in_part_a.size()) + ")" + " and " 
-                            + "\n\t" + dump_partition(in_part_b) + " (size=" + std::to_string(in_part_b.size()) + ")" 
-                + "\n    - Result: \n\t" + dump_partition(out_part) + " (size=" + std::to_string(out_part.size()) + ")\n");
+void display_merge_msg(std::vector<int>::iterator src, std::vector<int>::iterator dst, const std::pair<size_t, size_t>* in_parts,
+                       size_t ways, const std::pair<size_t, size_t>& out_part) {
+  std::string str("\n * Merged ");
+  for (size_t i = 0; i < ways; i++)
+    str += std::string(i ? " and " : "") + "\n\t" + dump_partition(src, in_parts[i])
+           + " (size=" + std::to_string(in_parts[i].second - in_parts[i].first) + ")";
+  str += "\n    - Result: \n\t" + dump_partition(dst, out_part)
+         + " (size=" + std::to_string(out_part.second - out_part.first) + ")\n";
   std::cout << str;
 }
 
-void cpp_merge(std::vector<int>& in_part_a, std::vector<int>& in_part_b, std::vector<int>& out_part) {
-  out_part.resize(in_part_a.size() + in_part_b.size());
-  std::merge(in_part_a.begin(), in_part_a.end(), in_part_b.begin(), in_part_b.end(), out_part.begin());
-  display_merge_msg(in_part_a, in_part_b, out_part);
+void display_observer_t::partitions_sorted(std::vector<int>::iterator list, const merge_sort_partitions_t& partitions) {
+  if (options.quiet)
+    return;
+  std::cout << "\nPartitions after multithreaded sorting:\n";
+  print_partitions(list, partitions);
+  std::cout << "\nMultithreaded merging of partitions:\n";
 }
 
-void merge_partitions_multithreaded(std::vector< std::vector<int> >& rand_int_partitions, std::vector<std::thread>& threads,
-                                    const size_t& p) {
-  // input_partitions: partitions before merging operations
-  // output_partitions: partitions after merting operations
-  // pass_last_partitions: last partition of the list of partitions at each pass (when p_before_merge is odd)
-  std::vector< std::vector<int> > input_partitions, output_partitions, pass_last_partitions;
-  // last_partitions_merge_output: result of the merging of two pass_last_partitions
-  std::vector<int> last_partitions_merge_output;
-  // p_before_merge: number of partitions before merging operations
-  size_t p_before_merge = p;
-  // p_after_merge: number of partitions after merging operations
-  size_t p_after_merge = p/2;
-  // counter: pass counter
-  size_t counter = 0;
-
-  input_partitions = rand_int_partitions;
-
-  while (p_after_merge > 0) {
-    std::cout << "\n-----------------------------   PASS " << ++counter << "   -----------------------------" << std::endl;
-
-    threads.clear();
-    output_partitions.resize(p_after_merge);
-
-    // Do multithreaded merging operations
-    for (int i = 0, j = 0; i < p_before_merge-1; i += 2, j++) {
-      threads.push_back(std::thread(cpp_merge, std::ref(input_partitions[i]), std::ref(input_partitions[i+1]), std::ref(output_partitions[j])));
-    }
-
-    // Is the number of partitions before the merging operations odd?
-    if (p_before_merge%2) {
-      // Append last partition of the list of partitions
-      pass_last_partitions.push_back(input_partitions[p_before_merge-1]);
-      // Carry out multithreaded merging operation if the vector's size is 2
-      if (pass_last_partitions.size() == 2) {
-        threads.push_back(std::thread(cpp_merge, std::ref(pass_last_partitions[0]), std::ref(pass_last_partitions[1]), std::ref(last_partitions_merge_output)));
-      }
-    }
+void display_observer_t::pass_merged(size_t pass, std::vector<int>::iterator src, std::vector<int>::iterator dst,
+                                     const merge_sort_partitions_t& in_partitions, size_t ways,
+                                     const merge_sort_partitions_t& out_partitions) {
+  if (options.quiet)
+    return;
+  std::cout << "\n-----------------------------   PASS " << pass << "   -----------------------------" << std::endl;
+  for (size_t i = 0; i < out_partitions.size(); i++) {
+    // A partition without partners is only carried over into dst
+    size_t group = std::min(ways, in_partitions.size() - i*ways);
+    if (group > 1)
+      display_merge_msg(src, dst, &in_partitions[i*ways], group, out_partitions[i]);
+  }
+  std::cout << "\nPartitions after multithreaded merging - PASS: " << pass << "\n";
+  print_partitions(dst, out_partitions);
+}
 
-    // Synchronize all threads
-    for (auto& th : threads) 
-      th.join();
-
-    // Is the number of partitions before the merging operations odd, and is pass_last_partitions' size 2?
-    if (p_before_merge%2 && pass_last_partitions.size() == 2) {
-      // Clear pass_last_partitions
-      pass_last_partitions.clear();
-      // Print out the result of the merging operation
-      dump_partition(last_partitions_merge_output);
-      // Append the resulting partition to pass_last_partitions
-      pass_last_partitions.push_back(last_partitions_merge_output);
-    }
+double seconds_since(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-    std::cout << "\nPartitions after multithreaded merging - PASS: " << counter << "\n";
-    if (pass_last_partitions.size())
-      output_partitions.push_back(pass_last_partitions[0]);
-    print_partitions(output_partitions);
+// Prints the one line of -q: the settings, the timings (in total and per element), and whether the list came out sorted
+void print_timings(std::vector<int>& list, work_stealing_pool& pool, const size_t& p, size_t passes,
+                   double sort_seconds, double merge_seconds) {
+  std::cout << "sort=" << options.sort << " merge=" << (options.sort == "merge" ? options.merge : "none")
+            << " simd=" << simd_level_name(options.simd)
+            << " threads=" << pool.size() << " n=" << list.size() << " p=" << p << " passes=" << passes
+            << " sort_s=" << sort_seconds << " merge_s=" << merge_seconds
+            << " sort_ns=" << sort_seconds*1e9/list.size() << " merge_ns=" << merge_seconds*1e9/list.size()
+            << " sorted=" << (std::is_sorted(list.begin(), list.end()) ? "yes" : "no") << std::endl;
+}
 
-    // Update variables for the next pass
-    input_partitions = output_partitions;
-    p_before_merge = p_after_merge;
-    p_after_merge /= 2;
+// Sorts a list too large for memory: it is generated into a file in options.temp_dir, sorted by
+// external_sort() into another one, and read back to check it
+int external_main(const size_t& n, const size_t& upper_bound, const size_t& p) {
+  const std::string path = options.temp_dir + "/multi_threaded_merge_sort." + std::to_string(getpid());
+  if (!generate_file(path + ".in", n, upper_bound)) {
+    std::cout << "Cannot write the list to " << path << ".in" << std::endl;
+    unlink((path + ".in").c_str());
+    return IO_ERROR;
   }
 
-  // Is there one partition left in pass_last_partitions (occurs when p_before_merge is odd at any pass)?
-  if (pass_last_partitions.size()) {
-    std::cout << "\n-----------------------------   PASS " << ++counter << "   -----------------------------" << std::endl;
+  work_stealing_pool pool(options.threads);
+  external_sort_options_t sort_options = {options.memory_mb << 20, options.temp_dir,
+                                          {p, options.merge == "pairwise", false}};
+  external_sort_stats_t stats;
+  std::string error;
+  bool ok;
+  if (options.simd == SIMD_SCALAR) {
+    ok = external_sort<int>(pool, path + ".in", path + ".out", std::less<int>(), sort_options, stats, error);
+  } else {
+    simd_sort_kernels kernels = {options.simd};
+    ok = external_sort<int>(pool, path + ".in", path + ".out", std::less<int>(), sort_options, kernels, stats, error);
+  }
+  unlink((path + ".in").c_str());
+  if (!ok) {
+    std::cout << "External sort failed: " << error << std::endl;
+    unlink((path + ".out").c_str());
+    return IO_ERROR;
+  }
+  bool sorted = file_is_sorted(path + ".out", n);
+  unlink((path + ".out").c_str());
+
+  const double mib = 1 << 20;
+  if (options.quiet) {
+    std::cout << "sort=external merge=kway simd=" << simd_level_name(options.simd)
+              << " threads=" << pool.size() << " n=" << n << " p=" << p << " memory_mb=" << options.memory_mb
+              << " runs=" << stats.runs << " passes=" << stats.passes << " spill_mb=" << stats.spilled_bytes/mib
+              << " io_mb=" << (stats.read_bytes + stats.written_bytes)/mib
+              << " sort_s=" << stats.run_seconds << " merge_s=" << stats.merge_seconds
+              << " sort_ns=" << stats.run_seconds*1e9/n << " merge_ns=" << stats.merge_seconds*1e9/n
+              << " sorted=" << (sorted ? "yes" : "no") << std::endl;
+  } else {
+    std::cout << "\nExternal sort of " << n << " elements (" << n*sizeof(int)/mib << " MiB) in "
+              << options.memory_mb << " MiB of memory:\n\n"
+              << "  Runs generated:   " << stats.runs << " (" << stats.run_seconds << " s)\n"
+              << "  Merge passes:     " << stats.passes << " (" << stats.merge_seconds << " s)\n"
+              << "  Spilled to runs:  " << stats.spilled_bytes/mib << " MiB\n"
+              << "  Read / written:   " << stats.read_bytes/mib << " / " << stats.written_bytes/mib << " MiB\n"
+              << "  Sorted:           " << (sorted ? "yes" : "no") << std::endl;
+  }
+  return 0;
+}
 
-    // Do the multithreaded merging operation of two remaining partitions (input_partitions[0] and output_partitions[0])
-    threads.clear();
-    output_partitions.resize(1);
-    threads.push_back(std::thread(cpp_merge, std::ref(input_partitions[0]), std::ref(pass_last_partitions[0]), std::ref(output_partitions[0])));
-    threads[0].join();
+// Writes n random elements to path as raw ints, a block at a time
+bool generate_file(const std::string& path, const size_t& n, const size_t& upper_bound) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  srand (time(NULL));
+  std::vector<int> block(1 << 20);
+  bool ok = true;
+  for (size_t i = 0; i < n && ok; i += block.size()) {
+    size_t count = std::min(block.size(), n - i);
+    for (size_t j = 0; j < count; j++)
+      block[j] = rand()%(!upper_bound ? 1 : upper_bound+1) + LOWER_BOUND;
+    ok = fwrite(&block[0], sizeof(int), count, file) == count;
+  }
+  return fclose(file) == 0 && ok;
+}
 
-    std::cout << "\nPartitions after multithreaded merging - PASS: " << counter << "\n";
-    print_partitions(output_partitions);
+// Whether path holds n ints in ascending order
+bool file_is_sorted(const std::string& path, const size_t& n) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  std::vector<int> block(1 << 20);
+  size_t total = 0;
+  bool sorted = true;
+  int previous = 0;
+  for (size_t count; sorted && (count = fread(&block[0], sizeof(int), block.size(), file)) > 0; total += count) {
+    sorted = (!total || previous <= block[0]) && std::is_sorted(block.begin(), block.begin() + count);
+    previous = block[count - 1];
   }
-}
\ No newline at end of file
+  fclose(file);
+  return sorted && total == n;
+}
@@ -0,0 +1,332 @@
+#ifndef PARALLEL_MERGE_SORT_H
+#define PARALLEL_MERGE_SORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "loser_tree.h"
+#include "merge_path.h"
+#include "work_stealing_pool.h"
+
+// The partition/sort/merge pipeline of the two programs, for any random
+// access range and ordering. The range is cut into P partitions, which are
+// sorted as tasks on a work-stealing pool and then merged pass after pass (up
+// to KWAY_MAX_WAYS at a time with a loser tree, or two at a time) until one is
+// left. Every merge is itself cut into pieces for the pool, so even the last
+// pass keeps all workers busy. The passes alternate between the range and a
+// single scratch buffer; when their number is odd the partitions are sorted
+// in the scratch buffer, so that the last pass writes back into the range.
+
+// partition i of a range: [first + partitions[i].first, first + partitions[i].second)
+typedef std::vector< std::pair<size_t, size_t> > merge_sort_partitions_t;
+
+struct merge_sort_options_t {
+  // partitions: number of partitions sorted on their own (0 = one per worker)
+  size_t partitions;
+  // pairwise: merge two partitions at a time (log2(P) passes) instead of up to KWAY_MAX_WAYS
+  bool pairwise;
+  // stable: equal elements keep their order (both merging schemes already do; this makes the
+  // partition sort stable too)
+  bool stable;
+};
+
+// Where the time went, and how many merging passes there were
+struct merge_sort_stats_t {
+  size_t passes;
+  double sort_seconds, merge_seconds;
+};
+
+// The sequential leaves of the pipeline: how one partition is sorted, and how
+// each piece of a merge of two partitions is merged. sort() may use the range
+// at scratch, as long as [first, last), for anything: it is the partition's
+// slot in the other buffer, idle until the first pass. Kernels that need it
+// even when there are no passes (one partition) set uses_scratch.
+struct merge_sort_std_kernels {
+  static const bool uses_scratch = false;
+  bool stable;
+
+  template <class RandomIt, class ScratchIt, class Compare>
+  void sort(RandomIt first, RandomIt last, ScratchIt, Compare comp) const {
+    if (stable)
+      std::stable_sort(first, last, comp);
+    else
+      std::sort(first, last, comp);
+  }
+
+  template <class RandomIt1, class RandomIt2, class RandomIt3, class Compare>
+  void merge(RandomIt1 a, RandomIt1 a_end, RandomIt2 b, RandomIt2 b_end, RandomIt3 out, Compare comp) const {
+    std::merge(a, a_end, b, b_end, out, comp);
+  }
+};
+
+// Watches the stages of parallel_merge_sort(), which calls it from the calling
+// thread once each stage is done:
+//   partitions_sorted(buffer, partitions): the partitions of buffer are sorted
+//   pass_merged(pass, src, dst, in_partitions, ways, out_partitions): every group of
+//     `ways` consecutive in_partitions of src (the last one possibly smaller) was merged
+//     into one of out_partitions of dst
+// Drivers that show the intermediate lists pass their own; this one ignores everything.
+struct merge_sort_no_observer {
+  template <class RandomIt>
+  void partitions_sorted(RandomIt, const merge_sort_partitions_t&) {}
+
+  template <class RandomIt1, class RandomIt2>
+  void pass_merged(size_t, RandomIt1, RandomIt2, const merge_sort_partitions_t&, size_t,
+                   const merge_sort_partitions_t&) {}
+};
+
+// Cuts [0, n) into p partitions of about the same size (the first n%p get one element more)
+inline void merge_sort_partition(size_t n, size_t p, merge_sort_partitions_t& partitions) {
+  partitions.clear();
+  for (size_t i = 0, first = 0; i < p; i++) {
+    size_t size = n/p + (i < n%p);
+    partitions.push_back(std::make_pair(first, first + size));
+    first += size;
+  }
+}
+
+// Number of passes that merge `partitions` partitions, `ways` at a time
+inline size_t merge_sort_passes(size_t partitions, size_t ways) {
+  size_t passes = 0;
+  for (; partitions > 1; passes++)
+    partitions = (partitions + ways - 1)/ways;
+  return passes;
+}
+
+// Runs fn(begin, end) over [0, n) cut into one chunk per worker, and returns when all are done
+template <class Fn>
+void merge_sort_for_chunks(work_stealing_pool& pool, size_t n, const Fn& fn) {
+  const size_t chunks = std::max<size_t>(1, std::min(pool.size(), n/MERGE_MIN_GRAIN));
+  struct {
+    const Fn* fn;
+    size_t n, chunks;
+  } loop = {&fn, n, chunks};
+  task_group looping;
+  for (size_t c = 0; c < chunks; c++)
+    pool.submit(looping, [&loop, c] { (*loop.fn)(loop.n*c/loop.chunks, loop.n*(c + 1)/loop.chunks); });
+  pool.wait(looping);
+}
+
+// Sorts every partition of dst with kernels, one task each, after moving it there from src (if move);
+// the same range of idle is the kernels' scratch space
+template <class SrcIt, class DstIt, class IdleIt, class Compare, class Kernels>
+void merge_sort_sort_partitions(work_stealing_pool& pool, SrcIt src, DstIt dst, bool move, IdleIt idle,
+                                const merge_sort_partitions_t& partitions, Compare comp, const Kernels& kernels) {
+  struct {
+    SrcIt src;
+    DstIt dst;
+    bool move;
+    IdleIt idle;
+    const merge_sort_partitions_t* partitions;
+    Compare comp;
+    const Kernels* kernels;
+  } sort = {src, dst, move, idle, &partitions, comp, &kernels};
+  task_group sorting;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    pool.submit(sorting, [&sort, i] {
+      const std::pair<size_t, size_t>& partition = (*sort.partitions)[i];
+      if (sort.move)
+        std::move(sort.src + partition.first, sort.src + partition.second, sort.dst + partition.first);
+      sort.kernels->sort(sort.dst + partition.first, sort.dst + partition.second, sort.idle + partition.first,
+                         sort.comp);
+    });
+  }
+  pool.wait(sorting);
+}
+
+// kernels.merge() with comp bound, as the piece kernel of parallel_merge()
+template <class Kernels, class Compare>
+struct merge_sort_piece_kernel {
+  const Kernels* kernels;
+  Compare comp;
+
+  template <class RandomIt1, class RandomIt2, class RandomIt3>
+  void operator()(RandomIt1 a, RandomIt1 a_end, RandomIt2 b, RandomIt2 b_end, RandomIt3 out) const {
+    kernels->merge(a, a_end, b, b_end, out, comp);
+  }
+};
+
+// One merging pass: every group of `ways` consecutive in_partitions of src is merged into
+// the same range of dst, which becomes one of out_partitions
+template <class SrcIt, class DstIt, class Compare, class Kernels>
+void merge_sort_pass(work_stealing_pool& pool, SrcIt src, DstIt dst, size_t n, const merge_sort_partitions_t& in_partitions,
+                     size_t ways, merge_sort_partitions_t& out_partitions, Compare comp, const Kernels& kernels) {
+  // merges: merging operations in this pass; parts: pieces each of them is split into
+  const size_t merges = (in_partitions.size() + ways - 1)/ways;
+  const size_t parts = merge_path_parts(n/merges, merges, pool.size());
+  out_partitions.clear();
+  for (size_t i = 0; i < in_partitions.size(); i += ways) {
+    size_t group = std::min(ways, in_partitions.size() - i);
+    out_partitions.push_back(std::make_pair(in_partitions[i].first, in_partitions[i + group - 1].second));
+  }
+  // runs[i]: in_partitions[i] of src, as the loser-tree merges take them
+  std::vector< std::pair<SrcIt, SrcIt> > runs(in_partitions.size());
+  for (size_t i = 0; i < in_partitions.size(); i++)
+    runs[i] = std::make_pair(src + in_partitions[i].first, src + in_partitions[i].second);
+
+  struct {
+    SrcIt src;
+    DstIt dst;
+    const merge_sort_partitions_t* in_partitions;
+    const std::pair<SrcIt, SrcIt>* runs;
+    size_t ways, parts;
+    work_stealing_pool* pool;
+    Compare comp;
+    const Kernels* kernels;
+  } pass = {src, dst, &in_partitions, &runs[0], ways, parts, &pool, comp, &kernels};
+  task_group merging;
+  for (size_t i = 0; i < in_partitions.size(); i += ways) {
+    pool.submit(merging, [&pass, i] {
+      const std::pair<size_t, size_t>* in = &(*pass.in_partitions)[i];
+      size_t group = std::min(pass.ways, pass.in_partitions->size() - i);
+      if (group == 2) {
+        // Split along the merge path so that even a single merge uses every worker
+        merge_sort_piece_kernel<Kernels, Compare> kernel = {pass.kernels, pass.comp};
+        parallel_merge(*pass.pool, pass.src + in[0].first, in[0].second - in[0].first, pass.src + in[1].first,
+                       in[1].second - in[1].first, pass.dst + in[0].first, pass.parts, pass.comp, kernel);
+        return;
+      }
+      // One loser-tree merge of the group, cut into pieces at consistent positions (a group of one is copied)
+      parallel_multiway_merge(*pass.pool, pass.runs + i, group, pass.dst + in[0].first, pass.parts, pass.comp);
+    });
+  }
+  pool.wait(merging);
+}
+
+// Sorts [first, last) by comp on pool, with kernels for the leaves, reporting
+// each stage to observer
+template <class RandomIt, class Compare, class Kernels, class Observer>
+merge_sort_stats_t parallel_merge_sort(work_stealing_pool& pool, RandomIt first, RandomIt last, Compare comp,
+                                       const merge_sort_options_t& options, const Kernels& kernels,
+                                       Observer& observer) {
+  typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+  merge_sort_stats_t stats = {0, 0, 0};
+  const size_t n = last - first;
+  if (n < 2)
+    return stats;
+  const size_t p = std::min(n, options.partitions ? options.partitions : pool.size());
+  size_t kway_passes;
+  const size_t ways = options.pairwise ? 2 : kway_ways(p, kway_passes);
+  stats.passes = merge_sort_passes(p, ways);
+  merge_sort_partitions_t partitions, merged;
+  merge_sort_partition(n, p, partitions);
+  merged.reserve(p);
+
+  // After an odd number of passes the output would be in scratch: start there instead
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  std::vector<value_type> scratch(stats.passes || Kernels::uses_scratch ? n : 0);
+  bool in_scratch = stats.passes % 2;
+  if (in_scratch) {
+    // A partition moved into scratch leaves its range of the input idle
+    merge_sort_sort_partitions(pool, first, scratch.begin(), true, first, partitions, comp, kernels);
+    observer.partitions_sorted(scratch.begin(), partitions);
+  } else {
+    merge_sort_sort_partitions(pool, first, first, false, scratch.begin(), partitions, comp, kernels);
+    observer.partitions_sorted(first, partitions);
+  }
+  stats.sort_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  start = std::chrono::steady_clock::now();
+  for (size_t pass = 1; partitions.size() > 1; pass++) {
+    if (in_scratch) {
+      merge_sort_pass(pool, scratch.begin(), first, n, partitions, ways, merged, comp, kernels);
+      observer.pass_merged(pass, scratch.begin(), first, partitions, ways, merged);
+    } else {
+      merge_sort_pass(pool, first, scratch.begin(), n, partitions, ways, merged, comp, kernels);
+      observer.pass_merged(pass, first, scratch.begin(), partitions, ways, merged);
+    }
+    // The output of this pass is the input of the next one
+    in_scratch = !in_scratch;
+    partitions.swap(merged);
+  }
+  stats.merge_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+template <class RandomIt, class Compare>
+merge_sort_stats_t parallel_merge_sort(work_stealing_pool& pool, RandomIt first, RandomIt last, Compare comp,
+                                       const merge_sort_options_t& options) {
+  merge_sort_std_kernels kernels = {options.stable};
+  merge_sort_no_observer observer;
+  return parallel_merge_sort(pool, first, last, comp, options, kernels, observer);
+}
+
+template <class RandomIt>
+merge_sort_stats_t parallel_merge_sort(work_stealing_pool& pool, RandomIt first, RandomIt last,
+                                       const merge_sort_options_t& options) {
+  return parallel_merge_sort(pool, first, last, std::less<typename std::iterator_traits<RandomIt>::value_type>(),
+                             options);
+}
+
+// Orders (key, index) pairs by comp on their keys
+template <class Compare>
+struct merge_sort_key_compare {
+  Compare comp;
+
+  template <class Pair>
+  bool operator()(const Pair& a, const Pair& b) const { return comp(a.first, b.first); }
+};
+
+// Fills order with the permutation that sorts the records [first, last) by
+// comp(key(a), key(b)): the sorted range would hold first[order[0]],
+// first[order[1]], ... The records are not touched; the sort moves (key, index)
+// pairs, which keeps the pipeline's element moves small however large the
+// records are.
+template <class RandomIt, class KeyFn, class Compare>
+merge_sort_stats_t parallel_sort_order(work_stealing_pool& pool, RandomIt first, RandomIt last, KeyFn key,
+                                       Compare comp, const merge_sort_options_t& options, std::vector<size_t>& order) {
+  typedef typename std::decay<decltype(key(*first))>::type key_type;
+  const size_t n = last - first;
+  std::vector< std::pair<key_type, size_t> > keyed(n);
+  merge_sort_for_chunks(pool, n, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      keyed[i] = std::make_pair(key(first[i]), i);
+  });
+  merge_sort_key_compare<Compare> key_comp = {comp};
+  merge_sort_stats_t stats = parallel_merge_sort(pool, keyed.begin(), keyed.end(), key_comp, options);
+  order.resize(n);
+  merge_sort_for_chunks(pool, n, [&](size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++)
+      order[i] = keyed[i].second;
+  });
+  return stats;
+}
+
+// Sorts the records [first, last) by comp(key(a), key(b)): the sort itself moves
+// only (key, index) pairs (see parallel_sort_order()), then the permutation is
+// applied in place by following its cycles, which moves every record once
+// (plus one per cycle into a temporary) without a buffer of records
+template <class RandomIt, class KeyFn, class Compare>
+merge_sort_stats_t parallel_merge_sort_by_key(work_stealing_pool& pool, RandomIt first, RandomIt last, KeyFn key,
+                                              Compare comp, const merge_sort_options_t& options) {
+  typedef typename std::iterator_traits<RandomIt>::value_type value_type;
+  std::vector<size_t> order;
+  merge_sort_stats_t stats = parallel_sort_order(pool, first, last, key, comp, options, order);
+
+  // Slot i takes the record at order[i]; a slot that is filled points at itself
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  const size_t n = last - first;
+  for (size_t i = 0; i < n; i++) {
+    if (order[i] == i)
+      continue;
+    value_type record = std::move(first[i]);
+    size_t j = i;
+    while (order[j] != i) {
+      size_t next = order[j];
+      first[j] = std::move(first[next]);
+      order[j] = j;
+      j = next;
+    }
+    first[j] = std::move(record);
+    order[j] = j;
+  }
+  stats.merge_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return stats;
+}
+
+#endif
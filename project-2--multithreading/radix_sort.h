@@ -0,0 +1,176 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include "work_stealing_pool.h"
+
+// Integer keys known to lie in [min_value, max_value] need no comparisons.
+// A least-significant-digit radix sort makes one stable pass per digit of
+// (key - min_value): every chunk of the input counts its digits into a
+// histogram of its own, a prefix sum over (digit, chunk) gives each chunk its
+// private output slots per digit, and the chunks then scatter in parallel
+// without sharing a single counter. The digit width comes from the key range,
+// so a range of 2^20 takes two passes where 32 bits would take three or four.
+// Ranges small enough for one histogram are counting sorted instead: the
+// counts alone describe the output, which is written without a scatter.
+
+// Widest digit of a radix pass: the 2^11 counters of a chunk stay in L1 and
+// the 2^11 output streams of the scatter are still few enough for the TLB
+#define RADIX_MAX_DIGIT_BITS 11
+
+// Key ranges with fewer values than this are counting sorted
+#define RADIX_COUNTING_MAX_RANGE (1 << 16)
+
+// Smallest chunk worth a task (and a histogram) of its own
+#define RADIX_MIN_GRAIN 16384
+
+// Number of chunks the n keys are split into so that every worker gets one
+inline size_t radix_sort_chunks(size_t n, size_t threads) {
+  return std::max<size_t>(1, std::min(threads, n/RADIX_MIN_GRAIN));
+}
+
+// Sorts data[0, n), whose keys all lie in [min_value, max_value], by counting
+// the occurrences of each value; returns the number of passes writing data (1)
+template <class T>
+size_t parallel_counting_sort(work_stealing_pool& pool, T* data, size_t n, T min_value, T max_value) {
+  typedef typename std::make_unsigned<T>::type key_t;
+  const size_t values = (size_t) ((key_t) max_value - (key_t) min_value) + 1;
+  const size_t chunks = radix_sort_chunks(n, pool.size());
+  // counts[c*values + v]: occurrences of min_value + v in chunk c
+  std::vector<size_t> counts(chunks*values);
+  // starts[v]: where the run of min_value + v begins in the output (starts[values] = n)
+  std::vector<size_t> starts(values + 1);
+
+  struct {
+    T* data;
+    size_t n, chunks, values;
+    T min_value;
+    size_t* counts;
+    const size_t* starts;
+  } sort = {data, n, chunks, values, min_value, &counts[0], &starts[0]};
+
+  task_group counting;
+  for (size_t c = 0; c < chunks; c++) {
+    pool.submit(counting, [&sort, c] {
+      size_t* count = sort.counts + c*sort.values;
+      for (size_t i = sort.n*c/sort.chunks; i < sort.n*(c + 1)/sort.chunks; i++)
+        count[(key_t) sort.data[i] - (key_t) sort.min_value]++;
+    });
+  }
+  pool.wait(counting);
+
+  for (size_t v = 0, total = 0; v < values; v++) {
+    starts[v] = total;
+    for (size_t c = 0; c < chunks; c++)
+      total += counts[c*values + v];
+  }
+  starts[values] = n;
+
+  // Each task writes an equal share of the output, whatever values it holds
+  task_group filling;
+  for (size_t c = 0; c < chunks; c++) {
+    pool.submit(filling, [&sort, c] {
+      size_t pos = sort.n*c/sort.chunks, end = sort.n*(c + 1)/sort.chunks;
+      size_t v = std::upper_bound(sort.starts, sort.starts + sort.values + 1, pos) - sort.starts - 1;
+      for (; pos < end; v++) {
+        size_t run_end = std::min(end, sort.starts[v + 1]);
+        std::fill(sort.data + pos, sort.data + run_end, (T) ((key_t) sort.min_value + (key_t) v));
+        pos = run_end;
+      }
+    });
+  }
+  pool.wait(filling);
+  return 1;
+}
+
+// Sorts data[0, n), whose keys all lie in [min_value, max_value], using
+// scratch[0, n) as the other buffer of the passes; returns the number of
+// passes writing data or scratch (the sorted keys always end up in data)
+template <class T>
+size_t parallel_radix_sort(work_stealing_pool& pool, T* data, T* scratch, size_t n, T min_value, T max_value) {
+  typedef typename std::make_unsigned<T>::type key_t;
+  const key_t range = (key_t) max_value - (key_t) min_value;
+  if (range < RADIX_COUNTING_MAX_RANGE)
+    return parallel_counting_sort(pool, data, n, min_value, max_value);
+
+  // Spread the significant bits of the range evenly over the fewest digits
+  size_t bits = 0;
+  while (bits < 8*sizeof(key_t) && (range >> bits))
+    bits++;
+  const size_t digits = (bits + RADIX_MAX_DIGIT_BITS - 1)/RADIX_MAX_DIGIT_BITS;
+  const size_t digit_bits = (bits + digits - 1)/digits;
+  const size_t radix = (size_t) 1 << digit_bits;
+  const size_t chunks = radix_sort_chunks(n, pool.size());
+  // offsets[c*radix + d]: next output slot of chunk c for digit d
+  std::vector<size_t> offsets(chunks*radix);
+
+  struct {
+    T* src;
+    T* dst;
+    size_t n, chunks, radix, shift;
+    T min_value;
+    size_t* offsets;
+  } sort = {data, scratch, n, chunks, radix, 0, min_value, &offsets[0]};
+
+  size_t passes = 0;
+  for (size_t digit = 0; digit < digits; digit++) {
+    sort.shift = digit*digit_bits;
+    std::fill(offsets.begin(), offsets.end(), 0);
+    task_group counting;
+    for (size_t c = 0; c < chunks; c++) {
+      pool.submit(counting, [&sort, c] {
+        size_t* count = sort.offsets + c*sort.radix;
+        for (size_t i = sort.n*c/sort.chunks; i < sort.n*(c + 1)/sort.chunks; i++)
+          count[((key_t) sort.src[i] - (key_t) sort.min_value) >> sort.shift & (sort.radix - 1)]++;
+      });
+    }
+    pool.wait(counting);
+
+    // Digits in order, and within a digit the chunks in order, keep every pass stable
+    bool trivial = false;
+    for (size_t d = 0, total = 0; d < radix; d++) {
+      size_t digit_start = total;
+      for (size_t c = 0; c < chunks; c++) {
+        size_t count = offsets[c*radix + d];
+        offsets[c*radix + d] = total;
+        total += count;
+      }
+      // All keys share this digit: the pass would only copy them
+      trivial |= total - digit_start == n;
+    }
+    if (trivial)
+      continue;
+
+    task_group scattering;
+    for (size_t c = 0; c < chunks; c++) {
+      pool.submit(scattering, [&sort, c] {
+        size_t* offset = sort.offsets + c*sort.radix;
+        for (size_t i = sort.n*c/sort.chunks; i < sort.n*(c + 1)/sort.chunks; i++) {
+          T key = sort.src[i];
+          sort.dst[offset[((key_t) key - (key_t) sort.min_value) >> sort.shift & (sort.radix - 1)]++] = key;
+        }
+      });
+    }
+    pool.wait(scattering);
+    std::swap(sort.src, sort.dst);
+    passes++;
+  }
+
+  // After an odd number of passes the keys are in scratch
+  if (sort.src != data) {
+    task_group copying;
+    for (size_t c = 0; c < chunks; c++) {
+      pool.submit(copying, [&sort, c] {
+        std::copy(sort.src + sort.n*c/sort.chunks, sort.src + sort.n*(c + 1)/sort.chunks,
+                  sort.dst + sort.n*c/sort.chunks);
+      });
+    }
+    pool.wait(copying);
+  }
+  return passes;
+}
+
+#endif
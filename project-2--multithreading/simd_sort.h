@@ -0,0 +1,323 @@
+#ifndef SIMD_SORT_H
+#define SIMD_SORT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SIMD_SORT_X86 1
+#endif
+
+// Sorting and merging kernels for int keys built from bitonic networks, whose
+// compare-exchanges are vector min/max instructions: a register of W keys is
+// sorted by log2(W)*(log2(W)+1)/2 rounds of (permute, min, max, blend) without
+// a single branch. Two sorted registers a and b merge the same way: min(a,
+// reversed b) and max(a, reversed b) hold the W smallest and the W largest
+// keys, each a bitonic sequence that log2(W) more rounds put in order. A merge
+// of two sorted lists streams through that network: the larger half stays in
+// a register and is merged with the next W keys of whichever list has the
+// smaller next key, so there is one data-dependent branch per W outputs where
+// std::merge has one per output. A partition is sorted by sorting blocks of
+// 2W keys in registers and merging them bottom-up with the same kernel.
+//
+// The kernels are compiled with target() attributes and picked at run time;
+// without AVX2 (or on other architectures) std::sort and std::merge are used.
+
+// Vector instruction sets, in increasing order
+enum simd_level_t { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+
+// The best level the CPU supports
+inline simd_level_t simd_detected_level() {
+  static simd_level_t detected = SIMD_SCALAR;
+  static bool done = false;
+  if (!done) {
+#ifdef SIMD_SORT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+      detected = SIMD_AVX512;
+    else if (__builtin_cpu_supports("avx2"))
+      detected = SIMD_AVX2;
+#endif
+    done = true;
+  }
+  return detected;
+}
+
+// The level to run: the requested one, or the best one below it the CPU supports
+inline simd_level_t simd_level(simd_level_t requested) {
+  return std::min(requested, simd_detected_level());
+}
+
+inline const char* simd_level_name(simd_level_t level) {
+  switch (level) {
+  case SIMD_AVX512:
+    return "avx512";
+  case SIMD_AVX2:
+    return "avx2";
+  default:
+    return "scalar";
+  }
+}
+
+// Parses a level name, or "auto" for the best level; returns false if name is none of them
+inline bool simd_parse_level(const std::string& name, simd_level_t& level) {
+  if (name == "auto" || name == "avx512")
+    level = SIMD_AVX512;
+  else if (name == "avx2")
+    level = SIMD_AVX2;
+  else if (name == "scalar")
+    level = SIMD_SCALAR;
+  else
+    return false;
+  return true;
+}
+
+// The generic code below passes vectors between functions that flatten inlines
+// into one target() function, so no call ABI is involved
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+// Merges a[0, na) and b[0, nb) into out; the 3*W-key tail is left to std::merge
+template <class Kernel>
+inline int* simd_merge_runs(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  typedef typename Kernel::vector_t vector_t;
+  const size_t W = Kernel::WIDTH;
+  if (na < W || nb < W)
+    return std::merge(a, a + na, b, b + nb, out);
+  const int* a_end = a + na;
+  const int* b_end = b + nb;
+  vector_t lo, hi;
+  Kernel::merge(Kernel::load(a), Kernel::load(b), lo, hi);
+  a += W;
+  b += W;
+  Kernel::store(out, lo);
+  out += W;
+  // hi holds W keys no smaller than anything written, and no larger than anything left
+  while (a + W <= a_end && b + W <= b_end) {
+    vector_t next;
+    if (*a < *b) {
+      next = Kernel::load(a);
+      a += W;
+    } else {
+      next = Kernel::load(b);
+      b += W;
+    }
+    Kernel::merge(next, hi, lo, hi);
+    Kernel::store(out, lo);
+    out += W;
+  }
+
+  // One list has fewer than W keys left: merge them with hi first, then with the other list
+  int high[Kernel::WIDTH], tail[2*Kernel::WIDTH];
+  Kernel::store(high, hi);
+  bool a_short = a + W > a_end;
+  const int* short_begin = a_short ? a : b;
+  const int* short_end = a_short ? a_end : b_end;
+  int* tail_end = std::merge(high, high + W, short_begin, short_end, tail);
+  return a_short ? std::merge(tail, tail_end, b, b_end, out) : std::merge(tail, tail_end, a, a_end, out);
+}
+
+// Sorts data[0, n) with scratch[0, n) as the other buffer of the merge passes
+template <class Kernel>
+inline void simd_sort_runs(int* data, size_t n, int* scratch) {
+  typedef typename Kernel::vector_t vector_t;
+  const size_t W = Kernel::WIDTH;
+  // Blocks of 2W keys are sorted in registers, the rest by std::sort
+  size_t blocked = n - n%(2*W);
+  for (size_t i = 0; i < blocked; i += 2*W) {
+    vector_t lo, hi;
+    Kernel::merge(Kernel::sort(Kernel::load(data + i)), Kernel::sort(Kernel::load(data + i + W)), lo, hi);
+    Kernel::store(data + i, lo);
+    Kernel::store(data + i + W, hi);
+  }
+  std::sort(data + blocked, data + n);
+
+  int* src = data;
+  int* dst = scratch;
+  for (size_t width = 2*W; width < n; width *= 2) {
+    for (size_t first = 0; first < n; first += 2*width) {
+      size_t middle = std::min(first + width, n), last = std::min(first + 2*width, n);
+      simd_merge_runs<Kernel>(src + first, middle - first, src + middle, last - middle, dst + first);
+    }
+    std::swap(src, dst);
+  }
+  if (src != data)
+    std::copy(src, src + n, data);
+}
+
+#ifdef SIMD_SORT_X86
+
+// Lane i takes the larger key of its compare-exchange with lane i^j in the
+// round (k, j) of a bitonic sort: the upper lane of an ascending pair, or the
+// lower lane of a descending one (pairs with i&k set descend)
+constexpr unsigned simd_sort_max_lanes(unsigned width, unsigned k, unsigned j, unsigned i = 0) {
+  return i == width ? 0 : ((((i & j) != 0) != ((i & k) != 0)) << i) | simd_sort_max_lanes(width, k, j, i + 1);
+}
+
+#define SIMD_SORT_AVX2 __attribute__((target("avx2")))
+
+struct simd_avx2_kernel {
+  typedef __m256i vector_t;
+  static const size_t WIDTH = 8;
+
+  static SIMD_SORT_AVX2 inline vector_t load(const int* p) { return _mm256_loadu_si256((const __m256i*) p); }
+  static SIMD_SORT_AVX2 inline void store(int* p, vector_t v) { _mm256_storeu_si256((__m256i*) p, v); }
+
+  // v with lane i moved to lane i^J
+  template <unsigned J>
+  static SIMD_SORT_AVX2 inline vector_t exchange(vector_t v) {
+    if (J == 1)
+      return _mm256_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1));
+    if (J == 2)
+      return _mm256_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2));
+    return _mm256_permute2x128_si256(v, v, 1);
+  }
+
+  // One round of compare-exchanges between lanes i and i^J, directed by K
+  template <unsigned K, unsigned J>
+  static SIMD_SORT_AVX2 inline vector_t round(vector_t v) {
+    vector_t partner = exchange<J>(v);
+    return _mm256_blend_epi32(_mm256_min_epi32(v, partner), _mm256_max_epi32(v, partner),
+                              simd_sort_max_lanes(WIDTH, K, J));
+  }
+
+  static SIMD_SORT_AVX2 inline vector_t sort(vector_t v) {
+    v = round<2, 1>(v);
+    v = round<4, 1>(round<4, 2>(v));
+    return clean(v);
+  }
+
+  // Sorts a bitonic register (ascending rounds only, k = WIDTH)
+  static SIMD_SORT_AVX2 inline vector_t clean(vector_t v) {
+    return round<8, 1>(round<8, 2>(round<8, 4>(v)));
+  }
+
+  static SIMD_SORT_AVX2 inline void merge(vector_t a, vector_t b, vector_t& lo, vector_t& hi) {
+    vector_t reversed = _mm256_permutevar8x32_epi32(b, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+    lo = clean(_mm256_min_epi32(a, reversed));
+    hi = clean(_mm256_max_epi32(a, reversed));
+  }
+};
+
+#define SIMD_SORT_AVX512 __attribute__((target("avx512f")))
+
+struct simd_avx512_kernel {
+  typedef __m512i vector_t;
+  static const size_t WIDTH = 16;
+
+  static SIMD_SORT_AVX512 inline vector_t load(const int* p) { return _mm512_loadu_si512(p); }
+  static SIMD_SORT_AVX512 inline void store(int* p, vector_t v) { _mm512_storeu_si512(p, v); }
+
+  template <unsigned J>
+  static SIMD_SORT_AVX512 inline vector_t exchange(vector_t v) {
+    if (J == 1)
+      return _mm512_shuffle_epi32(v, (_MM_PERM_ENUM) _MM_SHUFFLE(2, 3, 0, 1));
+    if (J == 2)
+      return _mm512_shuffle_epi32(v, (_MM_PERM_ENUM) _MM_SHUFFLE(1, 0, 3, 2));
+    if (J == 4)
+      return _mm512_shuffle_i32x4(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm512_shuffle_i32x4(v, v, _MM_SHUFFLE(1, 0, 3, 2));
+  }
+
+  template <unsigned K, unsigned J>
+  static SIMD_SORT_AVX512 inline vector_t round(vector_t v) {
+    vector_t partner = exchange<J>(v);
+    return _mm512_mask_mov_epi32(_mm512_min_epi32(v, partner), (__mmask16) simd_sort_max_lanes(WIDTH, K, J),
+                                 _mm512_max_epi32(v, partner));
+  }
+
+  static SIMD_SORT_AVX512 inline vector_t sort(vector_t v) {
+    v = round<2, 1>(v);
+    v = round<4, 1>(round<4, 2>(v));
+    v = round<8, 1>(round<8, 2>(round<8, 4>(v)));
+    return clean(v);
+  }
+
+  // Sorts a bitonic register (ascending rounds only, k = WIDTH)
+  static SIMD_SORT_AVX512 inline vector_t clean(vector_t v) {
+    return round<16, 1>(round<16, 2>(round<16, 4>(round<16, 8>(v))));
+  }
+
+  static SIMD_SORT_AVX512 inline void merge(vector_t a, vector_t b, vector_t& lo, vector_t& hi) {
+    vector_t reversed = _mm512_permutexvar_epi32(
+        _mm512_setr_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), b);
+    lo = clean(_mm512_min_epi32(a, reversed));
+    hi = clean(_mm512_max_epi32(a, reversed));
+  }
+};
+
+__attribute__((target("avx2"), flatten)) inline int* simd_merge_avx2(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  return simd_merge_runs<simd_avx2_kernel>(a, na, b, nb, out);
+}
+
+__attribute__((target("avx2"), flatten)) inline void simd_sort_avx2(int* data, size_t n, int* scratch) {
+  simd_sort_runs<simd_avx2_kernel>(data, n, scratch);
+}
+
+__attribute__((target("avx512f"), flatten)) inline int* simd_merge_avx512(const int* a, size_t na, const int* b, size_t nb,
+                                                                 int* out) {
+  return simd_merge_runs<simd_avx512_kernel>(a, na, b, nb, out);
+}
+
+__attribute__((target("avx512f"), flatten)) inline void simd_sort_avx512(int* data, size_t n, int* scratch) {
+  simd_sort_runs<simd_avx512_kernel>(data, n, scratch);
+}
+
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Sorts data[0, n) at the given level (see simd_level()), with scratch[0, n) as working space
+inline void simd_sort(simd_level_t level, int* data, size_t n, int* scratch) {
+#ifdef SIMD_SORT_X86
+  if (level == SIMD_AVX512)
+    return simd_sort_avx512(data, n, scratch);
+  if (level == SIMD_AVX2)
+    return simd_sort_avx2(data, n, scratch);
+#endif
+  std::sort(data, data + n);
+}
+
+// Merges a[0, na) and b[0, nb) into out at the given level; returns the end of the output
+inline int* simd_merge(simd_level_t level, const int* a, size_t na, const int* b, size_t nb, int* out) {
+#ifdef SIMD_SORT_X86
+  if (level == SIMD_AVX512)
+    return simd_merge_avx512(a, na, b, nb, out);
+  if (level == SIMD_AVX2)
+    return simd_merge_avx2(a, na, b, nb, out);
+#endif
+  return std::merge(a, a + na, b, b + nb, out);
+}
+
+// simd_sort() and simd_merge() at a fixed level, as the leaf kernels of
+// parallel_merge_sort() for int keys in std::less order (the networks are not
+// stable, which equal ints cannot tell apart)
+struct simd_sort_kernels {
+  // The bottom-up merges of simd_sort() ping-pong with the pipeline's idle buffer
+  static const bool uses_scratch = true;
+  simd_level_t level;
+
+  template <class RandomIt, class ScratchIt>
+  void sort(RandomIt first, RandomIt last, ScratchIt scratch, std::less<int>) const {
+    if (first != last)
+      simd_sort(level, &*first, last - first, &*scratch);
+  }
+
+  template <class RandomIt1, class RandomIt2, class RandomIt3>
+  void merge(RandomIt1 a, RandomIt1 a_end, RandomIt2 b, RandomIt2 b_end, RandomIt3 out, std::less<int>) const {
+    // Empty inputs are never dereferenced
+    const int* a_data = a == a_end ? NULL : &*a;
+    const int* b_data = b == b_end ? NULL : &*b;
+    if (a != a_end || b != b_end)
+      simd_merge(level, a_data, a_end - a, b_data, b_end - b, &*out);
+  }
+};
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef WORK_STEALING_POOL_H
+#define WORK_STEALING_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+
+// A fixed set of worker threads, each with its own deque of tasks. A worker
+// pushes and pops its own tasks at the back (newest first, which keeps the data
+// of nested tasks in its cache) and, once its deque is empty, steals the oldest
+// task from the front of another worker's deque. Any thread that waits for a
+// task group runs queued tasks in the meantime, so tasks may submit and wait
+// for tasks of their own without tying up a worker.
+
+// A set of tasks that is waited for as a whole
+struct task_group {
+  std::atomic<size_t> pending;
+
+  task_group() : pending(0) {}
+};
+
+class work_stealing_pool {
+ public:
+  // threads: number of worker threads (0 = one per online CPU)
+  explicit work_stealing_pool(size_t threads = 0) : queued(0), sleepers(0), stopping(false), next_victim(0) {
+    if (!threads) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? cpus : 1;
+    }
+    pthread_mutex_init(&sleep_lock, NULL);
+    pthread_cond_init(&wake, NULL);
+    for (size_t i = 0; i < threads; i++) {
+      worker_t* worker = new worker_t;
+      worker->pool = this;
+      pthread_mutex_init(&worker->lock, NULL);
+      workers.push_back(worker);
+    }
+    for (size_t i = 0; i < threads; i++)
+      pthread_create(&workers[i]->thread, NULL, &run_worker, (void*) workers[i]);
+  }
+
+  ~work_stealing_pool() {
+    pthread_mutex_lock(&sleep_lock);
+    stopping = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&sleep_lock);
+    for (size_t i = 0; i < workers.size(); i++) {
+      pthread_join(workers[i]->thread, NULL);
+      pthread_mutex_destroy(&workers[i]->lock);
+      delete workers[i];
+    }
+    pthread_cond_destroy(&wake);
+    pthread_mutex_destroy(&sleep_lock);
+  }
+
+  size_t size() const { return workers.size(); }
+
+  // Queues fn as part of group: on the calling worker's own deque, or spread
+  // over the workers when called from outside the pool. std::function stores a
+  // lambda of up to two pointers without allocating, so loops submitting many
+  // tasks put what the tasks share in a local struct and capture only a
+  // reference to it and the task's index.
+  void submit(task_group& group, const std::function<void()>& fn) {
+    worker_t* target = current_worker();
+    if (!target || target->pool != this)
+      target = workers[next_victim.fetch_add(1, std::memory_order_relaxed) % workers.size()];
+
+    group.pending.fetch_add(1);
+    task_t task = {fn, &group};
+    pthread_mutex_lock(&target->lock);
+    target->tasks.push_back(std::move(task));
+    queued.fetch_add(1);
+    pthread_mutex_unlock(&target->lock);
+
+    // Only take the sleep lock's cost when someone may be asleep
+    if (sleepers.load())
+      wake_sleepers(false);
+  }
+
+  // Returns once every task of group has finished, running queued tasks
+  // (of any group) while it waits
+  void wait(task_group& group) {
+    worker_t* self = current_worker();
+    if (self && self->pool != this)
+      self = NULL;
+    while (group.pending.load() > 0) {
+      if (run_one(self))
+        continue;
+      pthread_mutex_lock(&sleep_lock);
+      sleepers++;
+      while (group.pending.load() > 0 && queued.load() == 0)
+        pthread_cond_wait(&wake, &sleep_lock);
+      sleepers--;
+      pthread_mutex_unlock(&sleep_lock);
+    }
+  }
+
+ private:
+  struct task_t {
+    std::function<void()> fn;
+    task_group* group;
+  };
+
+  struct worker_t {
+    pthread_t thread;
+    // Guards tasks; the owner works at the back, thieves at the front
+    pthread_mutex_t lock;
+    std::deque<task_t> tasks;
+    work_stealing_pool* pool;
+  };
+
+  // The worker the calling thread is, if it is one
+  static worker_t*& current_worker() {
+    static thread_local worker_t* worker = NULL;
+    return worker;
+  }
+
+  static void* run_worker(void* args_ptr) {
+    worker_t* self = (worker_t*) args_ptr;
+    current_worker() = self;
+    work_stealing_pool* pool = self->pool;
+    while (true) {
+      if (pool->run_one(self))
+        continue;
+      pthread_mutex_lock(&pool->sleep_lock);
+      pool->sleepers++;
+      while (!pool->stopping && pool->queued.load() == 0)
+        pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+      pool->sleepers--;
+      bool stop = pool->stopping && pool->queued.load() == 0;
+      pthread_mutex_unlock(&pool->sleep_lock);
+      if (stop)
+        break;
+    }
+    return NULL;
+  }
+
+  // Takes the newest task of self, or else the oldest task of another worker
+  bool take(worker_t* self, task_t& task) {
+    if (self) {
+      pthread_mutex_lock(&self->lock);
+      bool found = !self->tasks.empty();
+      if (found) {
+        task = std::move(self->tasks.back());
+        self->tasks.pop_back();
+        queued.fetch_sub(1);
+      }
+      pthread_mutex_unlock(&self->lock);
+      if (found)
+        return true;
+    }
+    if (queued.load() == 0)
+      return false;
+    size_t start = next_victim.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < workers.size(); i++) {
+      worker_t* victim = workers[(start + i) % workers.size()];
+      if (victim == self)
+        continue;
+      pthread_mutex_lock(&victim->lock);
+      bool found = !victim->tasks.empty();
+      if (found) {
+        task = std::move(victim->tasks.front());
+        victim->tasks.pop_front();
+        queued.fetch_sub(1);
+      }
+      pthread_mutex_unlock(&victim->lock);
+      if (found)
+        return true;
+    }
+    return false;
+  }
+
+  // Runs one queued task, if there is any
+  bool run_one(worker_t* self) {
+    task_t task;
+    if (!take(self, task))
+      return false;
+    task.fn();
+    // The last task of a group wakes whoever waits for it
+    if (task.group->pending.fetch_sub(1) == 1 && sleepers.load())
+      wake_sleepers(true);
+    return true;
+  }
+
+  // Wakes one sleeper, or all of them. The callers changed queued or a group's
+  // pending count and then saw sleepers > 0; a sleeper raises sleepers before it
+  // checks those counts. All four accesses are sequentially consistent, so
+  // either the caller sees the sleeper or the sleeper sees the change. Taking
+  // the lock makes sure a sleeper that has counted itself is inside
+  // pthread_cond_wait() before the signal goes out.
+  void wake_sleepers(bool all) {
+    pthread_mutex_lock(&sleep_lock);
+    if (all)
+      pthread_cond_broadcast(&wake);
+    else
+      pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&sleep_lock);
+  }
+
+  std::vector<worker_t*> workers;
+  // queued: tasks sitting in the deques
+  std::atomic<size_t> queued;
+  // Idle workers and waiting threads sleep on wake, counted by sleepers (changed
+  // only under sleep_lock, read without it by submit() and run_one())
+  pthread_mutex_t sleep_lock;
+  pthread_cond_t wake;
+  std::atomic<size_t> sleepers;
+  bool stopping;
+  // Spreads outside submissions and steal attempts over the workers
+  std::atomic<size_t> next_victim;
+
+  // Not copyable: the workers point back at the pool
+  work_stealing_pool(const work_stealing_pool&);
+  work_stealing_pool& operator=(const work_stealing_pool&);
+};
+
+#endif